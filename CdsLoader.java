@@ -0,0 +1,16 @@
+/**
+ * loads the service classes given as arguments so that "make cds" can dump them to a CDS archive.
+ * run as a source file (java CdsLoader.java) to keep the class path identical to the one of c-icap-java.
+ */
+class CdsLoader {
+    public static void main(final String[] args) throws Exception {
+        final ClassLoader loader = ClassLoader.getSystemClassLoader();
+        for (final String name : args) {
+            try {
+                Class.forName(name, true, loader);
+            } catch (final ClassNotFoundException | LinkageError e) {
+                System.err.println("CdsLoader: skipped " + name + ": " + e);
+            }
+        }
+    }
+}
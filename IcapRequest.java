@@ -0,0 +1,25 @@
+/**
+ * natives registered by c-icap-java to read the current request on demand.
+ * a request handle is given to S(String mod_type, long request) and reset(String, long),
+ * and it is valid only until the request is released. every method returns null or 0 afterwards,
+ * e.g. in a preview() or service() still running past the Deadline. don't keep it.
+ * the handle is 0 in the warm-up (WarmupDir), every method returns null or 0 then.
+ */
+final class IcapRequest {
+    private IcapRequest() {
+    }
+    /** @return value of the http header (request for REQMOD, response for RESPMOD) or null */
+    public static native String getHeader(final long request, final String name);
+    /** @return value of the http request header or null */
+    public static native String getRequestHeader(final long request, final String name);
+    /** @return number of header lines, the request or status line is at 0 */
+    public static native int getHeaderCount(final long request);
+    /** @return "Name: value" or null */
+    public static native String getHeaderAt(final long request, final int index);
+    /** @return X-Client-IP sent by the proxy or the address of the ICAP client */
+    public static native String getClientIp(final long request);
+    /** @return url of the http request or null */
+    public static native String getUrl(final long request);
+    /** @return "REQMOD" or "RESPMOD" */
+    public static native String getMethod(final long request);
+}
@@ -0,0 +1,19 @@
+/**
+ * a request in a batch given to static int[] previewBatch(RequestView[]) by c-icap-java, see BatchWindow in README.
+ * the request handle reads the request through IcapRequest natives like S(String mod_type, long request).
+ * views and handles are valid only in the call. don't keep them.
+ */
+final class RequestView {
+    /** "REQMOD" or "RESPMOD" */
+    public final String mod_type;
+    /** request handle for IcapRequest natives */
+    public final long request;
+    /** the whole http body, it fitted in the preview */
+    public final byte[] body;
+
+    RequestView(final String mod_type, final long request, final byte[] body) {
+        this.mod_type = mod_type;
+        this.request = request;
+        this.body = body;
+    }
+}
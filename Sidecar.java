@@ -0,0 +1,293 @@
+import java.io.BufferedInputStream;
+import java.io.BufferedOutputStream;
+import java.io.ByteArrayOutputStream;
+import java.io.DataInputStream;
+import java.io.DataOutputStream;
+import java.io.EOFException;
+import java.io.IOException;
+import java.lang.reflect.Constructor;
+import java.lang.reflect.InvocationTargetException;
+import java.lang.reflect.Method;
+import java.net.StandardProtocolFamily;
+import java.net.UnixDomainSocketAddress;
+import java.nio.ByteBuffer;
+import java.nio.MappedByteBuffer;
+import java.nio.channels.Channels;
+import java.nio.channels.FileChannel;
+import java.nio.channels.ServerSocketChannel;
+import java.nio.channels.SocketChannel;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.nio.file.Paths;
+import java.nio.file.StandardOpenOption;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.ConcurrentHashMap;
+
+/**
+ * one JVM serving the services of every c-icap child, see java_handler.Sidecar in README. needs JDK 16+.
+ * java -cp ServicesDir:JavaClassPath Sidecar /run/c-icap-java.sock
+ *
+ * every worker thread of c-icap has its own connection, served by a thread here, and one request at a time on it.
+ * body bytes are passed through a file in /dev/shm mapped by both sides (the ring), the socket carries
+ * op (1 byte), payload length (4 bytes) and payload. services have the iService contract, without IcapRequest
+ * natives and onData() which need the JVM inside c-icap.
+ */
+class Sidecar {
+    static final int VERSION = 1;
+    static final int MAX_REPLY = 65536;
+
+    /** reflection of a service class, looked up once */
+    static final class Service {
+        final Constructor<?> constructor;
+        final Method preview;
+        final Method service;
+        final Method headers;
+        final Method onMatches;
+
+        Service(final Class<?> cls) throws ReflectiveOperationException {
+            constructor = cls.getDeclaredConstructor(String.class, String[].class);
+            constructor.setAccessible(true);
+            preview = optional(cls, "preview");
+            service = optional(cls, "service");
+            headers = method(cls, "headers");
+            Method matches = null;
+            try {
+                matches = cls.getDeclaredMethod("onMatches", int[].class, long[].class);
+                matches.setAccessible(true);
+            } catch (final NoSuchMethodException e) {
+                matches = null;
+            }
+            onMatches = matches;
+        }
+
+        /** byte[] parameter preferred over ByteBuffer, like c-icap-java */
+        static Method optional(final Class<?> cls, final String name) {
+            final Method method = method(cls, name, byte[].class);
+            return method != null ? method : method(cls, name, ByteBuffer.class);
+        }
+
+        /** declared method with exactly these parameters, or null */
+        static Method method(final Class<?> cls, final String name, final Class<?>... types) {
+            try {
+                final Method method = cls.getDeclaredMethod(name, types);
+                method.setAccessible(true);
+                return method;
+            } catch (final NoSuchMethodException e) {
+                return null;
+            }
+        }
+    }
+
+    static final ConcurrentHashMap<String, Service> services = new ConcurrentHashMap<>();
+
+    static Service service(final String name) throws ReflectiveOperationException {
+        Service service = services.get(name);
+        if (service == null) {
+            service = new Service(Class.forName(name));
+            services.putIfAbsent(name, service);
+        }
+        return service;
+    }
+
+    public static void main(final String[] args) throws IOException {
+        final Path socket = Paths.get(args.length > 0 ? args[0] : "/tmp/c-icap-java.sock");
+        Files.deleteIfExists(socket);
+        final ServerSocketChannel server = ServerSocketChannel.open(StandardProtocolFamily.UNIX);
+        server.bind(UnixDomainSocketAddress.of(socket));
+        while (true) {
+            final SocketChannel channel = server.accept();
+            final Thread thread = new Thread(new Connection(channel), "sidecar-" + channel.hashCode());
+            thread.setDaemon(true);
+            thread.start();
+        }
+    }
+
+    /** a connection of a c-icap worker thread */
+    static final class Connection implements Runnable {
+        final SocketChannel channel;
+        MappedByteBuffer ring;
+        Service service;
+        Object instance;
+        final ByteArrayOutputStream body = new ByteArrayOutputStream();
+        byte[] result;
+
+        Connection(final SocketChannel channel) {
+            this.channel = channel;
+        }
+
+        @Override
+        public void run() {
+            try (SocketChannel c = channel) {
+                final DataInputStream in = new DataInputStream(new BufferedInputStream(Channels.newInputStream(c)));
+                final DataOutputStream out = new DataOutputStream(new BufferedOutputStream(Channels.newOutputStream(c)));
+                while (true) {
+                    final int op = in.read();
+                    if (op < 0) {
+                        return;
+                    }
+                    final byte[] payload = new byte[in.readInt()];
+                    in.readFully(payload);
+                    try {
+                        handle((char) op, payload, out);
+                    } catch (final InvocationTargetException e) {
+                        instance = null;
+                        reply(out, 'E', String.valueOf(e.getCause()).getBytes(StandardCharsets.UTF_8));
+                    } catch (final ReflectiveOperationException | RuntimeException e) {
+                        instance = null;
+                        reply(out, 'E', String.valueOf(e).getBytes(StandardCharsets.UTF_8));
+                    }
+                    out.flush();
+                }
+            } catch (final EOFException e) {
+                return;
+            } catch (final IOException e) {
+                System.err.println("Sidecar: connection closed: " + e);
+            }
+        }
+
+        void handle(final char op, final byte[] payload, final DataOutputStream out) throws IOException, ReflectiveOperationException {
+            final ByteBuffer args = ByteBuffer.wrap(payload);
+            switch (op) {
+            case 'H': {
+                final int size = args.getInt();
+                final Path path = Paths.get(new String(payload, 4, payload.length - 4, StandardCharsets.UTF_8));
+                try (FileChannel file = FileChannel.open(path, StandardOpenOption.READ, StandardOpenOption.WRITE)) {
+                    ring = file.map(FileChannel.MapMode.READ_WRITE, 0, size);
+                }
+                replyInt(out, 'R', VERSION);
+                return;
+            }
+            case 'O': {
+                final List<String> strings = new ArrayList<>();
+                int start = 0;
+                for (int i = 0; i < payload.length; i++) {
+                    if (payload[i] == 0) {
+                        if (i == start && strings.size() >= 2) {
+                            break;//empty line
+                        }
+                        strings.add(new String(payload, start, i - start, StandardCharsets.ISO_8859_1));
+                        start = i + 1;
+                    }
+                }
+                instance = null;
+                result = null;
+                body.reset();
+                service = service(strings.get(1));
+                instance = service.constructor.newInstance(strings.get(0), strings.subList(2, strings.size()).toArray(new String[0]));
+                replyInt(out, 'R', 0);
+                return;
+            }
+            case 'P': {
+                final int length = args.getInt();
+                int status = 0;
+                if (service.preview != null) {
+                    status = (Integer) service.preview.invoke(instance, argument(service.preview, length));
+                }
+                replyInt(out, 'R', status);
+                return;
+            }
+            case 'M': {
+                final int count = args.getInt();
+                final int[] ids = new int[count];
+                final long[] offsets = new long[count];
+                for (int i = 0; i < count; i++) {
+                    ids[i] = args.getInt();
+                    offsets[i] = args.getLong();
+                }
+                if (service.onMatches != null) {
+                    service.onMatches.invoke(instance, ids, offsets);
+                }
+                replyInt(out, 'R', 0);
+                return;
+            }
+            case 'D': {
+                final int length = args.getInt();
+                final byte[] chunk = new byte[length];
+                ring.get(0, chunk);
+                body.write(chunk, 0, length);
+                replyInt(out, 'R', 0);
+                return;
+            }
+            case 'S': {
+                final int length = args.getInt();
+                result = null;
+                if (service.service != null) {
+                    result = (byte[]) service.service.invoke(instance, argument(service.service, length));
+                }
+                if (result == null) {
+                    reply(out, 'N', new byte[0]);
+                    return;
+                }
+                final String[] lines = service.headers != null ? (String[]) service.headers.invoke(instance) : null;
+                final ByteArrayOutputStream headers = new ByteArrayOutputStream();
+                for (int i = 0; lines != null && i < lines.length; i++) {
+                    if (lines[i] != null && !lines[i].isEmpty()) {
+                        headers.write(lines[i].getBytes(StandardCharsets.ISO_8859_1));
+                        headers.write(0);
+                    }
+                }
+                ring.put(0, result, 0, Math.min(result.length, ring.capacity()));
+                if (headers.size() == 0 || headers.size() + 5 >= MAX_REPLY) {
+                    replyInt(out, 'M', result.length);
+                    return;
+                }
+                headers.write(0);
+                final byte[] blob = headers.toByteArray();
+                out.writeByte('H');
+                out.writeInt(4 + blob.length);
+                out.writeInt(result.length);
+                out.write(blob);
+                return;
+            }
+            case 'G': {
+                final int offset = args.getInt();
+                final int length = Math.min(result.length - offset, ring.capacity());
+                ring.put(0, result, offset, length);
+                replyInt(out, 'R', length);
+                return;
+            }
+            case 'C':
+                instance = null;
+                result = null;
+                body.reset();
+                return;//no reply
+            default:
+                throw new IOException("unknown op " + (int) op);
+            }
+        }
+
+        /** preview or body of the request: the chunks received so far and length bytes in the ring */
+        Object argument(final Method method, final int length) {
+            final boolean direct = method.getParameterTypes()[0] == ByteBuffer.class;
+            if (body.size() == 0) {
+                if (direct) {
+                    return ring.slice(0, length).asReadOnlyBuffer();
+                }
+                final byte[] data = new byte[length];
+                ring.get(0, data);
+                return data;
+            }
+            final byte[] chunk = new byte[length];
+            ring.get(0, chunk);
+            body.write(chunk, 0, length);
+            final byte[] data = body.toByteArray();
+            body.reset();
+            return direct ? ByteBuffer.wrap(data).asReadOnlyBuffer() : data;
+        }
+
+        static void reply(final DataOutputStream out, final char op, final byte[] payload) throws IOException {
+            final int length = Math.min(payload.length, MAX_REPLY - 1);
+            out.writeByte(op);
+            out.writeInt(length);
+            out.write(payload, 0, length);
+        }
+
+        static void replyInt(final DataOutputStream out, final char op, final int value) throws IOException {
+            out.writeByte(op);
+            out.writeInt(4);
+            out.writeInt(value);
+        }
+    }
+}
@@ -0,0 +1,389 @@
+/**
+ * @file bench.c
+ * @brief load generator and latency benchmark of c-icap-java without c-icap
+ *
+ * loads the module built against bench/c_icap (see "make bench") and runs the request flow of flow.dot:
+ * java_init_request_data -> java_check_preview_handler -> java_service_io -> java_end_of_data_handler -> java_release_request_data
+ * on many threads, then reports throughput and p50/p99/p999 latency of each phase.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <libgen.h>
+
+#include "c_icap/c-icap.h"
+#include "c_icap/service.h"
+#include "c_icap/module.h"
+#include "c_icap/request.h"
+#include "c_icap/commands.h"
+#include "c_icap/header.h"
+#include "c_icap/debug.h"
+#include "standin.h"
+
+#define BENCH_MAX_DIRECTIVES 64
+#define BENCH_MAX_ARGS 16
+
+enum { PHASE_INIT, PHASE_PREVIEW, PHASE_IO, PHASE_EOD, PHASE_DRAIN, PHASE_RELEASE, PHASE_TOTAL, PHASES };
+static const char * phase_names[PHASES] = {"init", "preview", "io", "end_of_data", "drain", "release", "total"};
+
+/**
+ * command line options.
+ */
+static struct {
+    const char * module_path;
+    const char * service_file;
+    int body_size;
+    int preview_size;
+    int headers;
+    int threads;
+    int requests;//per thread
+    int warmup;//per thread, not measured
+    int chunk;//bytes of a service_io() call
+    int type;//ICAP_REQMOD or ICAP_RESPMOD
+    int allow204;
+    const char * directives[BENCH_MAX_DIRECTIVES];//"java_handler.X args" or "Service.X args"
+    int directives_used;
+} opt = {"./c-icap-java-bench.so", NULL, 16384, 1024, 16, 4, 10000, 1000, 8192, ICAP_RESPMOD, 1, {NULL}, 0};
+
+static service_handler_module_t * handler;
+static ci_service_module_t * service;
+static char * body;
+static uint64_t * samples[PHASES];//[thread * requests + i]
+static int results[4];//CI_MOD_ALLOW204 at preview, at end of data, modified, errors
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage(const char * name) {
+    fprintf(stderr,
+        "usage: %s -s Service.class [options]\n"
+        "  -M path     module built by \"make bench\" (%s)\n"
+        "  -s file     java service class file. its directory is the ServicesDir\n"
+        "  -b bytes    http body size (%d)\n"
+        "  -p bytes    preview size (%d)\n"
+        "  -H count    http headers per request (%d)\n"
+        "  -t threads  worker threads (%d)\n"
+        "  -n count    measured requests per thread (%d)\n"
+        "  -w count    warm-up requests per thread (%d)\n"
+        "  -c bytes    bytes per service_io() call (%d)\n"
+        "  -m mode     reqmod or respmod (respmod)\n"
+        "  -a 0|1      client allows 204 (%d)\n"
+        "  -D 'Name.Directive args'  c-icap.conf line, e.g. -D 'java_handler.JavaOption -Xmx256m' -D 'MyService.Async on'\n"
+        "  -v level    c-icap debug level (%d)\n",
+        name, opt.module_path, opt.body_size, opt.preview_size, opt.headers, opt.threads, opt.requests,
+        opt.warmup, opt.chunk, opt.allow204, CI_DEBUG_LEVEL);
+    exit(2);
+}
+
+/**
+ * Apply a "Name.Directive args" line to the conf table of the handler or the service.
+ */
+static int apply_directive(const char * line) {
+    char * copy = strdup(line);
+    char * argv[BENCH_MAX_ARGS + 1];
+    int argc = 0;
+    char * save = NULL;
+    char * token;
+    for (token = strtok_r(copy, " \t", &save); token != NULL && argc < BENCH_MAX_ARGS; token = strtok_r(NULL, " \t", &save)) {
+        argv[argc++] = token;
+    }
+    argv[argc] = NULL;
+    int ret = 0;
+    char * dot = argc > 0 ? strchr(argv[0], '.') : NULL;
+    if (dot != NULL) {
+        *dot = '\0';
+        struct ci_conf_entry * table = NULL;
+        if (strcmp(argv[0], handler->name) == 0) {
+            table = handler->conf_table;
+        } else if (service != NULL && strcmp(argv[0], service->mod_name) == 0) {
+            table = service->mod_conf_table;
+        }
+        if (table != NULL) {
+            ret = standin_conf(table, dot + 1, (const char **)(argv + 1));
+        }
+    }
+    if (!ret) {
+        fprintf(stderr, "bad directive: %s\n", line);
+    }
+    free(copy);
+    return ret;
+}
+
+static void apply_directives(const char * prefix) {
+    int i;
+    for (i = 0; i < opt.directives_used; i++) {
+        if (strncmp(opt.directives[i], prefix, strlen(prefix)) == 0 && opt.directives[i][strlen(prefix)] == '.') {
+            if (!apply_directive(opt.directives[i])) {
+                exit(1);
+            }
+        }
+    }
+}
+
+/**
+ * http headers of a request. the body belongs to the request for REQMOD, to the response for RESPMOD.
+ */
+static ci_headers_list_t * new_http_headers(int response, int index) {
+    ci_headers_list_t * heads = ci_headers_create();
+    char line[256];
+    int i;
+    if (response) {
+        ci_headers_add(heads, "HTTP/1.1 200 OK");
+        ci_headers_add(heads, "Content-Type: text/html; charset=utf-8");
+    } else {
+        snprintf(line, sizeof(line), "%s /bench/%d HTTP/1.1", opt.type == ICAP_REQMOD ? "POST" : "GET", index);
+        ci_headers_add(heads, line);
+        ci_headers_add(heads, "Host: bench.example.com");
+    }
+    if (response || opt.type == ICAP_REQMOD) {
+        if (!response) {
+            ci_headers_add(heads, "Content-Type: application/octet-stream");
+        }
+        snprintf(line, sizeof(line), "Content-Length: %d", opt.body_size);
+        ci_headers_add(heads, line);
+    }
+    for (i = 0; i < opt.headers; i++) {
+        snprintf(line, sizeof(line), "X-Bench-%d: value-%d-of-the-benchmark-header", i, i);
+        ci_headers_add(heads, line);
+    }
+    return heads;
+}
+
+/**
+ * Run one request the way c-icap does and record the time of each phase.
+ */
+static void run_request(ci_request_t * req, uint64_t * t, int index) {
+    char wbuf[65536];
+    int wlen;
+    int rlen;
+    int ret;
+    int sent = 0;
+    uint64_t start = now_ns();
+    uint64_t mark = start;
+    memset(t, 0, sizeof(uint64_t) * PHASES);
+
+    req->http_request_header = new_http_headers(0, index);
+    req->http_response_header = (req->type == ICAP_RESPMOD) ? new_http_headers(1, index) : NULL;
+    int preview = opt.preview_size < opt.body_size ? opt.preview_size : opt.body_size;
+    req->eof_received = (preview == opt.body_size);
+    req->data_locked = 0;
+
+#define PHASE_END(phase) do { uint64_t n = now_ns(); t[phase] += n - mark; mark = n; } while (0)
+    req->service_data = service->mod_init_request_data(req);
+    PHASE_END(PHASE_INIT);
+    if (req->service_data == NULL) {
+        __atomic_add_fetch(&results[3], 1, __ATOMIC_RELAXED);
+        goto END_OF_REQUEST;
+    }
+
+    ret = service->mod_check_preview_handler(body, preview, req);
+    PHASE_END(PHASE_PREVIEW);
+    if (ret == CI_MOD_ALLOW204) {
+        __atomic_add_fetch(&results[0], 1, __ATOMIC_RELAXED);
+        goto RELEASE;
+    }
+    if (ret == CI_ERROR) {
+        __atomic_add_fetch(&results[3], 1, __ATOMIC_RELAXED);
+        goto RELEASE;
+    }
+
+    //rest of the body, reading what the module sends as c-icap does
+    for (sent = preview; sent < opt.body_size; ) {
+        rlen = opt.body_size - sent < opt.chunk ? opt.body_size - sent : opt.chunk;
+        wlen = sizeof(wbuf);
+        int eof = (sent + rlen == opt.body_size);
+        if (service->mod_service_io(wbuf, &wlen, body + sent, &rlen, eof, req) == CI_ERROR) {
+            __atomic_add_fetch(&results[3], 1, __ATOMIC_RELAXED);
+            goto RELEASE;
+        }
+        sent += rlen;
+    }
+    PHASE_END(PHASE_IO);
+
+    ret = service->mod_end_of_data_handler(req);
+    PHASE_END(PHASE_EOD);
+    if (ret == CI_MOD_ALLOW204) {
+        __atomic_add_fetch(&results[1], 1, __ATOMIC_RELAXED);
+        goto RELEASE;
+    }
+    if (ret == CI_ERROR) {
+        __atomic_add_fetch(&results[3], 1, __ATOMIC_RELAXED);
+        goto RELEASE;
+    }
+    __atomic_add_fetch(&results[2], 1, __ATOMIC_RELAXED);
+    do {
+        wlen = sizeof(wbuf);
+        if (service->mod_service_io(wbuf, &wlen, NULL, NULL, 1, req) == CI_ERROR) {
+            __atomic_add_fetch(&results[3], 1, __ATOMIC_RELAXED);
+            break;
+        }
+    } while (wlen != CI_EOF);
+    PHASE_END(PHASE_DRAIN);
+
+RELEASE:
+    service->mod_release_request_data(req->service_data);
+    PHASE_END(PHASE_RELEASE);
+#undef PHASE_END
+END_OF_REQUEST:
+    t[PHASE_TOTAL] = now_ns() - start;
+    ci_headers_destroy(req->http_request_header);
+    ci_headers_destroy(req->http_response_header);
+}
+
+static void * worker(void * data) {
+    int id = (int)(intptr_t)data;
+    ci_request_t req;
+    uint64_t t[PHASES];
+    int i, p;
+    memset(&req, 0, sizeof(req));
+    req.type = opt.type;
+    req.allow204 = opt.allow204;
+    req.hasbody = 1;
+    req.preview = opt.preview_size;
+    req.current_service_mod = service;
+    req.request_header = ci_headers_create();
+    for (i = 0; i < opt.warmup; i++) {
+        run_request(&req, t, i);
+    }
+    for (i = 0; i < opt.requests; i++) {
+        run_request(&req, t, i);
+        for (p = 0; p < PHASES; p++) {
+            samples[p][(size_t)id * opt.requests + i] = t[p];
+        }
+    }
+    ci_headers_destroy(req.request_header);
+    return NULL;
+}
+
+static int compare_u64(const void * a, const void * b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(uint64_t * sorted, size_t n, double p) {
+    size_t i = (size_t)(p * (n - 1));
+    return sorted[i] / 1000.0;
+}
+
+int main(int argc, char ** argv) {
+    int c;
+    while ((c = getopt(argc, argv, "M:s:b:p:H:t:n:w:c:m:a:D:v:h")) != -1) {
+        switch (c) {
+        case 'M': opt.module_path = optarg; break;
+        case 's': opt.service_file = optarg; break;
+        case 'b': opt.body_size = atoi(optarg); break;
+        case 'p': opt.preview_size = atoi(optarg); break;
+        case 'H': opt.headers = atoi(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'n': opt.requests = atoi(optarg); break;
+        case 'w': opt.warmup = atoi(optarg); break;
+        case 'c': opt.chunk = atoi(optarg); break;
+        case 'm': opt.type = (strcmp(optarg, "reqmod") == 0) ? ICAP_REQMOD : ICAP_RESPMOD; break;
+        case 'a': opt.allow204 = atoi(optarg); break;
+        case 'D':
+            if (opt.directives_used == BENCH_MAX_DIRECTIVES) {
+                usage(argv[0]);
+            }
+            opt.directives[opt.directives_used++] = optarg;
+            break;
+        case 'v': CI_DEBUG_LEVEL = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (opt.service_file == NULL || opt.threads <= 0 || opt.requests <= 0 || opt.body_size < 0 || opt.chunk <= 0) {
+        usage(argv[0]);
+    }
+
+    void * dl = dlopen(opt.module_path, RTLD_NOW | RTLD_GLOBAL);
+    if (dl == NULL) {
+        fprintf(stderr, "dlopen %s: %s\n", opt.module_path, dlerror());
+        return 1;
+    }
+    handler = (service_handler_module_t *)dlsym(dl, "module");
+    if (handler == NULL) {
+        fprintf(stderr, "no module in %s\n", opt.module_path);
+        return 1;
+    }
+
+    //same order as c-icap: handler init, handler directives, service load, service directives, post init, fork
+    static struct ci_server_conf conf;
+    char * file_copy = strdup(opt.service_file);
+    conf.SERVICES_DIR = dirname(file_copy);
+    conf.TMPDIR = "/tmp";
+    if (handler->init_service_handler(&conf) != CI_OK) {
+        return 1;
+    }
+    apply_directives(handler->name);
+    service = handler->create_service(opt.service_file);
+    if (service == NULL) {
+        return 1;
+    }
+    ci_service_xdata_t * xdata = standin_xdata_new();
+    service->mod_init_service(xdata, &conf);
+    apply_directives(service->mod_name);
+    handler->post_init_service_handler(&conf);
+    if (service->mod_post_init_service) {
+        service->mod_post_init_service(xdata, &conf);
+    }
+    uint64_t boot = now_ns();
+    standin_run_commands(CI_CMD_CHILD_START);
+    boot = now_ns() - boot;
+
+    body = (char *)malloc(opt.body_size > 0 ? opt.body_size : 1);
+    int i, p;
+    for (i = 0; i < opt.body_size; i++) {
+        body[i] = "<html><body>benchmark body</body></html>\n"[i % 41];
+    }
+    size_t total = (size_t)opt.threads * opt.requests;
+    for (p = 0; p < PHASES; p++) {
+        samples[p] = (uint64_t *)calloc(total, sizeof(uint64_t));
+        if (samples[p] == NULL) {
+            fprintf(stderr, "too many requests\n");
+            return 1;
+        }
+    }
+
+    pthread_t * threads = (pthread_t *)calloc(opt.threads, sizeof(pthread_t));
+    uint64_t start = now_ns();
+    for (i = 0; i < opt.threads; i++) {
+        pthread_create(&threads[i], NULL, worker, (void *)(intptr_t)i);
+    }
+    for (i = 0; i < opt.threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    size_t done = (size_t)opt.threads * (opt.requests + opt.warmup);
+    printf("service %s, %s, body %d bytes, preview %d, %d headers, %d threads x %d requests (+%d warm-up)\n",
+        service->mod_name, opt.type == ICAP_REQMOD ? "REQMOD" : "RESPMOD", opt.body_size, opt.preview_size,
+        opt.headers, opt.threads, opt.requests, opt.warmup);
+    printf("child start (JVM boot) %.1f ms\n", boot / 1e6);
+    printf("throughput %.0f req/s, %.1f MB/s\n", done / elapsed, done * (double)opt.body_size / elapsed / 1e6);
+    printf("204 at preview %d, 204 at end of data %d, done %d, errors %d\n", results[0], results[1], results[2], results[3]);
+    printf("%-12s %10s %10s %10s %10s %10s   (microseconds)\n", "phase", "mean", "p50", "p99", "p999", "max");
+    for (p = 0; p < PHASES; p++) {
+        double sum = 0;
+        size_t k;
+        for (k = 0; k < total; k++) {
+            sum += samples[p][k];
+        }
+        qsort(samples[p], total, sizeof(uint64_t), compare_u64);
+        printf("%-12s %10.1f %10.1f %10.1f %10.1f %10.1f\n", phase_names[p], sum / total / 1000.0,
+            percentile(samples[p], total, 0.50), percentile(samples[p], total, 0.99),
+            percentile(samples[p], total, 0.999), samples[p][total - 1] / 1000.0);
+    }
+
+    standin_print_stats(stdout);
+    handler->release_service_handler();
+    return results[3] ? 1 : 0;
+}
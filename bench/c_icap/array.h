@@ -0,0 +1,18 @@
+/* stand-in of c-icap's c_icap/array.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_ARRAY_H
+#define CIJ_BENCH_ARRAY_H
+#include <stddef.h>
+typedef struct ci_array_item { char *name; void *value; } ci_array_item_t;
+typedef struct ci_dyn_array { ci_array_item_t **items; int max_size; int count; } ci_dyn_array_t;
+ci_dyn_array_t *ci_dyn_array_new(size_t size);
+const ci_array_item_t *ci_dyn_array_add(ci_dyn_array_t *array, const char *name, const void *value, size_t size);
+const void *ci_dyn_array_search(ci_dyn_array_t *array, const char *name);
+void ci_dyn_array_destroy(ci_dyn_array_t *array);
+void ci_dyn_array_iterate(const ci_dyn_array_t *array, void *data, int (*fn)(void *data, const char *name, const void *value));
+typedef ci_dyn_array_t ci_ptr_dyn_array_t;
+#define ci_ptr_dyn_array_new(size) ci_dyn_array_new(size)
+#define ci_ptr_dyn_array_search(ptr_array, name) ci_dyn_array_search(ptr_array, name)
+#define ci_ptr_dyn_array_destroy(ptr_array) ci_dyn_array_destroy(ptr_array)
+#define ci_ptr_dyn_array_iterate(ptr_array, data, fn) ci_dyn_array_iterate(ptr_array, data, fn)
+const ci_array_item_t *ci_ptr_dyn_array_add(ci_ptr_dyn_array_t *ptr_array, const char *name, void *value);
+#endif
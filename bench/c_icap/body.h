@@ -0,0 +1,17 @@
+/* stand-in of c-icap's c_icap/body.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_BODY_H
+#define CIJ_BENCH_BODY_H
+#include "c-icap.h"
+#include "array.h"
+#define CI_FILE_USELOCK 0x01
+#define CI_FILE_HAS_EOF 0x02
+typedef struct ci_cached_file { ci_off_t endpos; ci_off_t readpos; int bufsize; int flags; ci_off_t unlocked; char *buf; int fd; char filename[CI_FILENAME_LEN + 1]; void *attributes; } ci_cached_file_t;
+extern int CI_BODY_MAX_MEM;
+ci_cached_file_t *ci_cached_file_new(int size);
+void ci_cached_file_reset(ci_cached_file_t *body, int new_size);
+void ci_cached_file_destroy(ci_cached_file_t *body);
+int ci_cached_file_write(ci_cached_file_t *body, const char *buf, int len, int iseof);
+int ci_cached_file_read(ci_cached_file_t *body, char *buf, int len);
+#define ci_cached_file_size(body) ((body)->endpos)
+#define ci_cached_file_haseof(body) ((body)->flags & CI_FILE_HAS_EOF)
+#endif
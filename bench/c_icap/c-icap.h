@@ -0,0 +1,16 @@
+/* stand-in of c-icap's c_icap/c-icap.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_C_ICAP_H
+#define CIJ_BENCH_C_ICAP_H
+#include <stddef.h>
+#include <sys/types.h>
+#define CI_OK 1
+#define CI_NEEDS_MORE 2
+#define CI_ERROR -1
+#define CI_EOF -2
+#define CI_DECLARE_DATA
+#define CI_DECLARE_FUNC(type) type
+#define MAX_SERVICE_NAME 63
+#define CI_FILENAME_LEN 512
+typedef long long ci_off_t;
+struct ci_server_conf { char *TMPDIR; char *SERVICES_DIR; char *MODULES_DIR; };
+#endif
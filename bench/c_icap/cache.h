@@ -0,0 +1,11 @@
+/* stand-in of c-icap's c_icap/cache.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_CACHE_H
+#define CIJ_BENCH_CACHE_H
+#include <time.h>
+#include "types_ops.h"
+typedef struct ci_cache ci_cache_t;
+ci_cache_t *ci_cache_build(const char *name, const char *cache_type, unsigned int cache_size, unsigned int max_object_size, int ttl, const ci_type_ops_t *key_ops);
+const void *ci_cache_search(ci_cache_t *cache, const void *key, void **val, void *data, void *(*dup_from_cache)(const void *stored_val, size_t stored_val_size, void *data));
+int ci_cache_update(ci_cache_t *cache, const void *key, const void *val, size_t val_size, void *(*copy_to_cache)(void *buf, const void *val, size_t buf_size));
+void ci_cache_destroy(ci_cache_t *cache);
+#endif
@@ -0,0 +1,10 @@
+/* stand-in of c-icap's c_icap/cfg_param.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_CFG_PARAM_H
+#define CIJ_BENCH_CFG_PARAM_H
+struct ci_conf_entry { char *name; void *data; int (*action)(const char *name, const char **argv, void *setdata); char *msg; };
+int ci_cfg_set_int(const char *directive, const char **argv, void *setdata);
+int ci_cfg_set_str(const char *directive, const char **argv, void *setdata);
+int ci_cfg_onoff(const char *directive, const char **argv, void *setdata);
+int ci_cfg_size_off(const char *directive, const char **argv, void *setdata);
+int ci_cfg_size_long(const char *directive, const char **argv, void *setdata);
+#endif
@@ -0,0 +1,10 @@
+/* stand-in of c-icap's c_icap/commands.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_COMMANDS_H
+#define CIJ_BENCH_COMMANDS_H
+#define CI_CMD_ONDEMAND 1
+#define CI_CMD_CHILD_START 2
+#define CI_CMD_CHILD_STOP 4
+#define CI_CMD_POST_CONFIG 8
+#define CI_CMD_MONITOR_START 16
+void ci_command_register_action(const char *name, int type, void *data, void (*command_action)(const char *name, int type, void *data));
+#endif
@@ -0,0 +1,7 @@
+/* stand-in of c-icap's c_icap/debug.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_DEBUG_H
+#define CIJ_BENCH_DEBUG_H
+extern int CI_DEBUG_LEVEL;
+extern void (*__log_error)(void *req, const char *format, ...);
+#define ci_debug_printf(i, args...) {if (i <= CI_DEBUG_LEVEL) { if (__log_error) (*__log_error)(NULL, args);}}
+#endif
@@ -0,0 +1,15 @@
+/* stand-in of c-icap's c_icap/header.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_HEADER_H
+#define CIJ_BENCH_HEADER_H
+enum ci_method { ICAP_OPTIONS = 0x01, ICAP_REQMOD = 0x02, ICAP_RESPMOD = 0x04 };
+extern const char *CI_Methods[];
+#define ci_method_string(method) (method <= ICAP_RESPMOD && method >= ICAP_OPTIONS ? CI_Methods[method] : "UNKNOWN")
+typedef struct ci_headers_list { int size; int used; char **headers; int bufsize; int bufused; char *buf; int packed; } ci_headers_list_t;
+ci_headers_list_t *ci_headers_create();
+void ci_headers_destroy(ci_headers_list_t *heads);
+void ci_headers_reset(ci_headers_list_t *heads);
+const char *ci_headers_add(ci_headers_list_t *heads, const char *header);
+int ci_headers_remove(ci_headers_list_t *heads, const char *header);
+const char *ci_headers_search(ci_headers_list_t *heads, const char *header);
+const char *ci_headers_value(ci_headers_list_t *heads, const char *header);
+#endif
@@ -0,0 +1,14 @@
+/* stand-in of c-icap's c_icap/module.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_MODULE_H
+#define CIJ_BENCH_MODULE_H
+#include "service.h"
+typedef struct service_handler_module {
+    const char *name;
+    const char *extensions;
+    int (*init_service_handler)(struct ci_server_conf *server_conf);
+    int (*post_init_service_handler)(struct ci_server_conf *server_conf);
+    void (*release_service_handler)();
+    ci_service_module_t *(*create_service)(const char *service_file);
+    struct ci_conf_entry *conf_table;
+} service_handler_module_t;
+#endif
@@ -0,0 +1,7 @@
+/* stand-in of c-icap's c_icap/net_io.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_NET_IO_H
+#define CIJ_BENCH_NET_IO_H
+#include <netinet/in.h>
+typedef struct ci_sockaddr { struct sockaddr_storage sockaddr; int ci_sin_family; int ci_sin_port; void *ci_sin_addr; int ci_inaddr_len; } ci_sockaddr_t;
+const char *ci_sockaddr_t_to_ip(ci_sockaddr_t *addr, char *ip, int maxlen);
+#endif
@@ -0,0 +1,33 @@
+/* stand-in of c-icap's c_icap/request.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_REQUEST_H
+#define CIJ_BENCH_REQUEST_H
+#include "c-icap.h"
+#include "header.h"
+#include "net_io.h"
+struct ci_service_module;
+typedef struct ci_connection { int fd; ci_sockaddr_t claddr; ci_sockaddr_t srvaddr; } ci_connection_t;
+typedef struct ci_request {
+    ci_connection_t *connection;
+    int type;
+    char service[MAX_SERVICE_NAME + 1];
+    int preview;
+    int allow204;
+    int hasbody;
+    int eof_received;
+    int data_locked;
+    struct ci_service_module *current_service_mod;
+    ci_headers_list_t *request_header;
+    ci_headers_list_t *response_header;
+    ci_headers_list_t *http_request_header;
+    ci_headers_list_t *http_response_header;
+    void *service_data;
+} ci_request_t;
+#define ci_req_lock_data(req) ((req)->data_locked = 1)
+#define ci_req_unlock_data(req) ((req)->data_locked = 0)
+#define ci_req_hasbody(req) ((req)->hasbody)
+#define ci_req_type(req) ((req)->type)
+#define ci_req_preview_size(req) ((req)->preview)
+#define ci_req_allow204(req) ((req)->allow204)
+#define ci_req_hasalldata(req) ((req)->eof_received)
+#define ci_service_data(req) ((req)->service_data)
+#endif
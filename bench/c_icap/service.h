@@ -0,0 +1,38 @@
+/* stand-in of c-icap's c_icap/service.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_SERVICE_H
+#define CIJ_BENCH_SERVICE_H
+#include "c-icap.h"
+#include "request.h"
+#include "cfg_param.h"
+#define CI_MOD_NOT_READY 0
+#define CI_MOD_DONE 1
+#define CI_MOD_CONTINUE 100
+#define CI_MOD_ALLOW204 204
+#define CI_MOD_ALLOW206 206
+#define CI_MOD_ERROR -1
+#define CI_SERVICE_OK 1
+#define CI_SERVICE_ERROR -1
+typedef struct ci_service_xdata ci_service_xdata_t;
+typedef struct ci_service_module {
+    const char *mod_name;
+    const char *mod_short_descr;
+    int mod_type;
+    int (*mod_init_service)(ci_service_xdata_t *srv_xdata, struct ci_server_conf *server_conf);
+    int (*mod_post_init_service)(ci_service_xdata_t *srv_xdata, struct ci_server_conf *server_conf);
+    void (*mod_close_service)();
+    void *(*mod_init_request_data)(ci_request_t *);
+    void (*mod_release_request_data)(void *);
+    int (*mod_check_preview_handler)(char *preview_data, int preview_data_len, ci_request_t *);
+    int (*mod_end_of_data_handler)(ci_request_t *);
+    int (*mod_service_io)(char *wbuf, int *wlen, char *rbuf, int *rlen, int iseof, ci_request_t *);
+    struct ci_conf_entry *mod_conf_table;
+    void *mod_data;
+} ci_service_module_t;
+void ci_service_set_preview(ci_service_xdata_t *srv_xdata, int preview);
+void ci_service_enable_204(ci_service_xdata_t *srv_xdata);
+void ci_service_set_transfer_preview(ci_service_xdata_t *srv_xdata, const char *preview);
+void ci_service_set_transfer_ignore(ci_service_xdata_t *srv_xdata, const char *ignore);
+void ci_service_set_transfer_complete(ci_service_xdata_t *srv_xdata, const char *complete);
+void ci_service_set_istag(ci_service_xdata_t *srv_xdata, const char *istag);
+void ci_service_set_options_ttl(ci_service_xdata_t *srv_xdata, int ttl);
+#endif
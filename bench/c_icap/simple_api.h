@@ -0,0 +1,19 @@
+/* stand-in of c-icap's c_icap/simple_api.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_SIMPLE_API_H
+#define CIJ_BENCH_SIMPLE_API_H
+#include "request.h"
+#include "body.h"
+ci_headers_list_t *ci_http_response_headers(ci_request_t *req);
+ci_headers_list_t *ci_http_request_headers(ci_request_t *req);
+int ci_http_response_reset_headers(ci_request_t *req);
+int ci_http_request_reset_headers(ci_request_t *req);
+const char *ci_http_response_add_header(ci_request_t *req, const char *header);
+const char *ci_http_request_add_header(ci_request_t *req, const char *header);
+int ci_http_response_remove_header(ci_request_t *req, const char *header);
+int ci_http_request_remove_header(ci_request_t *req, const char *header);
+const char *ci_http_response_get_header(ci_request_t *req, const char *head_name);
+const char *ci_http_request_get_header(ci_request_t *req, const char *head_name);
+ci_off_t ci_http_content_length(ci_request_t *req);
+char *ci_http_request(ci_request_t *req);
+int ci_http_request_url(ci_request_t *req, char *buf, int buf_size);
+#endif
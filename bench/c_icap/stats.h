@@ -0,0 +1,8 @@
+/* stand-in of c-icap's c_icap/stats.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_STATS_H
+#define CIJ_BENCH_STATS_H
+typedef enum ci_stat_type {STAT_INT64_T, STAT_KBS_T, STAT_TYPE_END} ci_stat_type_t;
+int ci_stat_entry_register(const char *label, ci_stat_type_t type, const char *group);
+void ci_stat_uint64_inc(int ID, int count);
+void ci_stat_kbs_inc(int ID, int count);
+#endif
@@ -0,0 +1,13 @@
+/* stand-in of c-icap's c_icap/types_ops.h for the benchmark. see bench/standin.c */
+#ifndef CIJ_BENCH_TYPES_OPS_H
+#define CIJ_BENCH_TYPES_OPS_H
+#include <stddef.h>
+typedef struct ci_type_ops {
+    void *(*dup)(const char *, void *);
+    void (*free)(void *key, void *);
+    int (*compare)(const void *key1, const void *key2);
+    size_t (*size)(const void *key);
+    int (*equal)(const void *key1, const void *key2);
+} ci_type_ops_t;
+extern const ci_type_ops_t ci_str_ops;
+#endif
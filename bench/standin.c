@@ -0,0 +1,606 @@
+/**
+ * @file standin.c
+ * @brief minimal stand-in of the c-icap library for the benchmark
+ *
+ * implements only what c-icap-java.c uses, with the layouts of the headers in bench/c_icap.
+ * the module built by "make bench" resolves these symbols from the driver (linked with -rdynamic).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "c_icap/c-icap.h"
+#include "c_icap/service.h"
+#include "c_icap/module.h"
+#include "c_icap/header.h"
+#include "c_icap/body.h"
+#include "c_icap/simple_api.h"
+#include "c_icap/debug.h"
+#include "c_icap/commands.h"
+#include "c_icap/types_ops.h"
+#include "c_icap/cache.h"
+#include "c_icap/stats.h"
+#include "standin.h"
+
+int CI_DEBUG_LEVEL = 1;
+int CI_BODY_MAX_MEM = 131072;
+const char * CI_Methods[] = {"UNKNOWN", "OPTIONS", "REQMOD", "UNKNOWN", "RESPMOD"};
+
+static void standin_log_error(void * req, const char * format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
+
+void (*__log_error)(void * req, const char * format, ...) = standin_log_error;
+
+//---service xdata: c-icap keeps OPTIONS answers here. the benchmark does not send OPTIONS.
+struct ci_service_xdata {
+    int preview;
+};
+
+void ci_service_set_preview(ci_service_xdata_t * srv_xdata, int preview) {
+    srv_xdata->preview = preview;
+}
+void ci_service_enable_204(ci_service_xdata_t * srv_xdata) {}
+void ci_service_set_transfer_preview(ci_service_xdata_t * srv_xdata, const char * preview) {}
+void ci_service_set_transfer_ignore(ci_service_xdata_t * srv_xdata, const char * ignore) {}
+void ci_service_set_transfer_complete(ci_service_xdata_t * srv_xdata, const char * complete) {}
+void ci_service_set_istag(ci_service_xdata_t * srv_xdata, const char * istag) {}
+void ci_service_set_options_ttl(ci_service_xdata_t * srv_xdata, int ttl) {}
+
+ci_service_xdata_t * standin_xdata_new() {
+    return (ci_service_xdata_t *)calloc(1, sizeof(ci_service_xdata_t));
+}
+
+//---conf table actions
+int ci_cfg_set_int(const char * directive, const char ** argv, void * setdata) {
+    if (argv == NULL || argv[0] == NULL) {
+        return 0;
+    }
+    *(int *)setdata = atoi(argv[0]);
+    return 1;
+}
+
+int ci_cfg_set_str(const char * directive, const char ** argv, void * setdata) {
+    if (argv == NULL || argv[0] == NULL) {
+        return 0;
+    }
+    *(char **)setdata = strdup(argv[0]);
+    return 1;
+}
+
+int ci_cfg_onoff(const char * directive, const char ** argv, void * setdata) {
+    if (argv == NULL || argv[0] == NULL) {
+        return 0;
+    }
+    *(int *)setdata = (strcasecmp(argv[0], "on") == 0) ? 1 : 0;
+    return 1;
+}
+
+static long long standin_size(const char * str) {
+    char * end;
+    long long size = strtoll(str, &end, 10);
+    switch (*end) {
+    case 'g': case 'G': size *= 1024;//fall through
+    case 'm': case 'M': size *= 1024;//fall through
+    case 'k': case 'K': size *= 1024;
+    }
+    return size;
+}
+
+int ci_cfg_size_off(const char * directive, const char ** argv, void * setdata) {
+    if (argv == NULL || argv[0] == NULL) {
+        return 0;
+    }
+    *(ci_off_t *)setdata = standin_size(argv[0]);
+    return 1;
+}
+
+int ci_cfg_size_long(const char * directive, const char ** argv, void * setdata) {
+    if (argv == NULL || argv[0] == NULL) {
+        return 0;
+    }
+    *(long *)setdata = (long)standin_size(argv[0]);
+    return 1;
+}
+
+int standin_conf(struct ci_conf_entry * table, const char * directive, const char ** argv) {
+    for (; table != NULL && table->name != NULL; table++) {
+        if (strcmp(table->name, directive) == 0) {
+            return table->action(directive, argv, table->data);
+        }
+    }
+    fprintf(stderr, "unknown directive %s\n", directive);
+    return 0;
+}
+
+//---commands
+#define STANDIN_MAX_COMMANDS 16
+static struct {
+    int type;
+    void * data;
+    void (*action)(const char * name, int type, void * data);
+    const char * name;
+} standin_commands[STANDIN_MAX_COMMANDS];
+static int standin_commands_used = 0;
+
+void ci_command_register_action(const char * name, int type, void * data, void (*command_action)(const char * name, int type, void * data)) {
+    if (standin_commands_used < STANDIN_MAX_COMMANDS) {
+        standin_commands[standin_commands_used].type = type;
+        standin_commands[standin_commands_used].data = data;
+        standin_commands[standin_commands_used].action = command_action;
+        standin_commands[standin_commands_used].name = name;
+        standin_commands_used++;
+    }
+}
+
+void standin_run_commands(int type) {
+    int i;
+    for (i = 0; i < standin_commands_used; i++) {
+        if (standin_commands[i].type & type) {
+            standin_commands[i].action(standin_commands[i].name, type, standin_commands[i].data);
+        }
+    }
+}
+
+//---arrays
+ci_dyn_array_t * ci_dyn_array_new(size_t size) {
+    ci_dyn_array_t * array = (ci_dyn_array_t *)calloc(1, sizeof(ci_dyn_array_t));
+    if (array == NULL) {
+        return NULL;
+    }
+    array->max_size = size > 0 ? (int)size : 16;
+    array->items = (ci_array_item_t **)calloc(array->max_size, sizeof(ci_array_item_t *));
+    if (array->items == NULL) {
+        free(array);
+        return NULL;
+    }
+    return array;
+}
+
+const ci_array_item_t * ci_ptr_dyn_array_add(ci_ptr_dyn_array_t * array, const char * name, void * value) {
+    if (array->count == array->max_size) {
+        ci_array_item_t ** items = (ci_array_item_t **)realloc(array->items, array->max_size * 2 * sizeof(ci_array_item_t *));
+        if (items == NULL) {
+            return NULL;
+        }
+        array->items = items;
+        array->max_size *= 2;
+    }
+    ci_array_item_t * item = (ci_array_item_t *)malloc(sizeof(ci_array_item_t));
+    if (item == NULL) {
+        return NULL;
+    }
+    item->name = strdup(name);
+    item->value = value;
+    array->items[array->count++] = item;
+    return item;
+}
+
+const void * ci_dyn_array_search(ci_dyn_array_t * array, const char * name) {
+    int i;
+    for (i = 0; i < array->count; i++) {
+        if (strcmp(array->items[i]->name, name) == 0) {
+            return array->items[i]->value;
+        }
+    }
+    return NULL;
+}
+
+void ci_dyn_array_iterate(const ci_dyn_array_t * array, void * data, int (*fn)(void * data, const char * name, const void * value)) {
+    int i;
+    for (i = 0; array != NULL && i < array->count; i++) {
+        if (fn(data, array->items[i]->name, array->items[i]->value)) {
+            break;
+        }
+    }
+}
+
+void ci_dyn_array_destroy(ci_dyn_array_t * array) {
+    int i;
+    if (array == NULL) {
+        return;
+    }
+    for (i = 0; i < array->count; i++) {
+        free(array->items[i]->name);
+        free(array->items[i]);
+    }
+    free(array->items);
+    free(array);
+}
+
+//---headers. one strdup per line, good enough to compare java calls against.
+ci_headers_list_t * ci_headers_create() {
+    ci_headers_list_t * heads = (ci_headers_list_t *)calloc(1, sizeof(ci_headers_list_t));
+    if (heads == NULL) {
+        return NULL;
+    }
+    heads->size = 64;
+    heads->headers = (char **)calloc(heads->size, sizeof(char *));
+    if (heads->headers == NULL) {
+        free(heads);
+        return NULL;
+    }
+    return heads;
+}
+
+void ci_headers_reset(ci_headers_list_t * heads) {
+    int i;
+    for (i = 0; i < heads->used; i++) {
+        free(heads->headers[i]);
+    }
+    heads->used = 0;
+}
+
+void ci_headers_destroy(ci_headers_list_t * heads) {
+    if (heads == NULL) {
+        return;
+    }
+    ci_headers_reset(heads);
+    free(heads->headers);
+    free(heads);
+}
+
+const char * ci_headers_add(ci_headers_list_t * heads, const char * header) {
+    if (heads->used == heads->size) {
+        char ** headers = (char **)realloc(heads->headers, heads->size * 2 * sizeof(char *));
+        if (headers == NULL) {
+            return NULL;
+        }
+        heads->headers = headers;
+        heads->size *= 2;
+    }
+    heads->headers[heads->used] = strdup(header);
+    return heads->headers[heads->used++];
+}
+
+static int standin_header_index(ci_headers_list_t * heads, const char * header) {
+    size_t length = strlen(header);
+    int i;
+    for (i = 0; heads != NULL && i < heads->used; i++) {
+        if (strncasecmp(heads->headers[i], header, length) == 0 && heads->headers[i][length] == ':') {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int ci_headers_remove(ci_headers_list_t * heads, const char * header) {
+    int i = standin_header_index(heads, header);
+    if (i < 0) {
+        return 0;
+    }
+    free(heads->headers[i]);
+    memmove(&(heads->headers[i]), &(heads->headers[i + 1]), (heads->used - i - 1) * sizeof(char *));
+    heads->used--;
+    return 1;
+}
+
+const char * ci_headers_search(ci_headers_list_t * heads, const char * header) {
+    int i = standin_header_index(heads, header);
+    return i < 0 ? NULL : heads->headers[i];
+}
+
+const char * ci_headers_value(ci_headers_list_t * heads, const char * header) {
+    const char * line = ci_headers_search(heads, header);
+    if (line == NULL) {
+        return NULL;
+    }
+    line += strlen(header) + 1;
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    return line;
+}
+
+//---simple api
+ci_headers_list_t * ci_http_response_headers(ci_request_t * req) {
+    return req->http_response_header;
+}
+ci_headers_list_t * ci_http_request_headers(ci_request_t * req) {
+    return req->http_request_header;
+}
+int ci_http_response_reset_headers(ci_request_t * req) {
+    ci_headers_reset(req->http_response_header);
+    return 1;
+}
+int ci_http_request_reset_headers(ci_request_t * req) {
+    ci_headers_reset(req->http_request_header);
+    return 1;
+}
+const char * ci_http_response_add_header(ci_request_t * req, const char * header) {
+    return req->http_response_header ? ci_headers_add(req->http_response_header, header) : NULL;
+}
+const char * ci_http_request_add_header(ci_request_t * req, const char * header) {
+    return req->http_request_header ? ci_headers_add(req->http_request_header, header) : NULL;
+}
+int ci_http_response_remove_header(ci_request_t * req, const char * header) {
+    return ci_headers_remove(req->http_response_header, header);
+}
+int ci_http_request_remove_header(ci_request_t * req, const char * header) {
+    return ci_headers_remove(req->http_request_header, header);
+}
+const char * ci_http_response_get_header(ci_request_t * req, const char * head_name) {
+    return req->http_response_header ? ci_headers_value(req->http_response_header, head_name) : NULL;
+}
+const char * ci_http_request_get_header(ci_request_t * req, const char * head_name) {
+    return req->http_request_header ? ci_headers_value(req->http_request_header, head_name) : NULL;
+}
+
+ci_off_t ci_http_content_length(ci_request_t * req) {
+    ci_headers_list_t * heads = (req->type == ICAP_RESPMOD) ? req->http_response_header : req->http_request_header;
+    const char * value = heads ? ci_headers_value(heads, "Content-Length") : NULL;
+    return value ? strtoll(value, NULL, 10) : -1;
+}
+
+char * ci_http_request(ci_request_t * req) {
+    if (req->http_request_header == NULL || req->http_request_header->used == 0) {
+        return NULL;
+    }
+    return req->http_request_header->headers[0];
+}
+
+int ci_http_request_url(ci_request_t * req, char * buf, int buf_size) {
+    const char * line = ci_http_request(req);
+    const char * host = ci_http_request_get_header(req, "Host");
+    if (line == NULL || buf_size <= 0) {
+        return 0;
+    }
+    const char * path = strchr(line, ' ');
+    if (path == NULL) {
+        return 0;
+    }
+    path++;
+    size_t length = strcspn(path, " ");
+    int n;
+    if (strncmp(path, "http://", 7) == 0 || host == NULL) {
+        n = snprintf(buf, buf_size, "%.*s", (int)length, path);
+    } else {
+        n = snprintf(buf, buf_size, "%s%.*s", host, (int)length, path);
+    }
+    return n < buf_size ? n : buf_size - 1;
+}
+
+const char * ci_sockaddr_t_to_ip(ci_sockaddr_t * addr, char * ip, int maxlen) {
+    return inet_ntop(addr->sockaddr.ss_family, addr->ci_sin_addr, ip, maxlen);
+}
+
+//---cached file. spills to a temporary file like c-icap, so that mmap of big bodies is measured too.
+ci_cached_file_t * ci_cached_file_new(int size) {
+    ci_cached_file_t * body = (ci_cached_file_t *)calloc(1, sizeof(ci_cached_file_t));
+    if (body == NULL) {
+        return NULL;
+    }
+    body->bufsize = size > 0 ? size : CI_BODY_MAX_MEM;
+    body->buf = (char *)malloc(body->bufsize);
+    if (body->buf == NULL) {
+        free(body);
+        return NULL;
+    }
+    body->fd = -1;
+    return body;
+}
+
+void ci_cached_file_reset(ci_cached_file_t * body, int new_size) {
+    if (body->fd >= 0) {
+        close(body->fd);
+        unlink(body->filename);
+        body->fd = -1;
+    }
+    body->endpos = body->readpos = body->unlocked = 0;
+    body->flags = 0;
+}
+
+void ci_cached_file_destroy(ci_cached_file_t * body) {
+    if (body == NULL) {
+        return;
+    }
+    ci_cached_file_reset(body, 0);
+    free(body->buf);
+    free(body);
+}
+
+static int standin_spill(ci_cached_file_t * body) {
+    snprintf(body->filename, sizeof(body->filename), "/tmp/CI_TMP_XXXXXX");
+    body->fd = mkstemp(body->filename);
+    if (body->fd < 0) {
+        return CI_ERROR;
+    }
+    if (body->endpos > 0 && write(body->fd, body->buf, body->endpos) != body->endpos) {
+        return CI_ERROR;
+    }
+    return CI_OK;
+}
+
+int ci_cached_file_write(ci_cached_file_t * body, const char * buf, int len, int iseof) {
+    if (iseof) {
+        body->flags |= CI_FILE_HAS_EOF;
+    }
+    if (len <= 0) {
+        return 0;
+    }
+    if (body->fd < 0 && body->endpos + len > body->bufsize && standin_spill(body) != CI_OK) {
+        return CI_ERROR;
+    }
+    if (body->fd < 0) {
+        memcpy(body->buf + body->endpos, buf, len);
+    } else if (pwrite(body->fd, buf, len, body->endpos) != len) {
+        return CI_ERROR;
+    }
+    body->endpos += len;
+    return len;
+}
+
+int ci_cached_file_read(ci_cached_file_t * body, char * buf, int len) {
+    ci_off_t remains = body->endpos - body->readpos;
+    if (remains <= 0) {
+        return (body->flags & CI_FILE_HAS_EOF) ? CI_EOF : 0;
+    }
+    if (len > remains) {
+        len = (int)remains;
+    }
+    if (body->fd < 0) {
+        memcpy(buf, body->buf + body->readpos, len);
+    } else if (pread(body->fd, buf, len, body->readpos) != len) {
+        return CI_ERROR;
+    }
+    body->readpos += len;
+    return len;
+}
+
+//---cache. one locked hash table per cache without eviction, enough for hit/miss costs.
+const ci_type_ops_t ci_str_ops = {NULL, NULL, NULL, NULL, NULL};
+
+#define STANDIN_CACHE_BUCKETS 4096
+typedef struct standin_entry {
+    struct standin_entry * next;
+    char * key;
+    void * val;
+    size_t size;
+    time_t expires;
+} standin_entry_t;
+
+struct ci_cache {
+    pthread_mutex_t mutex;
+    standin_entry_t * buckets[STANDIN_CACHE_BUCKETS];
+    size_t used;
+    size_t max_size;
+    size_t max_object_size;
+    int ttl;
+};
+
+static unsigned int standin_hash(const char * key) {
+    unsigned int h = 5381;
+    while (*key) {
+        h = h * 33 + (unsigned char)*key++;
+    }
+    return h % STANDIN_CACHE_BUCKETS;
+}
+
+ci_cache_t * ci_cache_build(const char * name, const char * cache_type, unsigned int cache_size, unsigned int max_object_size, int ttl, const ci_type_ops_t * key_ops) {
+    ci_cache_t * cache = (ci_cache_t *)calloc(1, sizeof(ci_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&(cache->mutex), NULL);
+    cache->max_size = cache_size;
+    cache->max_object_size = max_object_size;
+    cache->ttl = ttl;
+    return cache;
+}
+
+const void * ci_cache_search(ci_cache_t * cache, const void * key, void ** val, void * data, void *(*dup_from_cache)(const void * stored_val, size_t stored_val_size, void * data)) {
+    const void * found = NULL;
+    *val = NULL;
+    pthread_mutex_lock(&(cache->mutex));
+    standin_entry_t * entry;
+    for (entry = cache->buckets[standin_hash(key)]; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->key, key) == 0 && entry->expires > time(NULL)) {
+            *val = dup_from_cache(entry->val, entry->size, data);
+            found = key;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&(cache->mutex));
+    return found;
+}
+
+int ci_cache_update(ci_cache_t * cache, const void * key, const void * val, size_t val_size, void *(*copy_to_cache)(void * buf, const void * val, size_t buf_size)) {
+    if (val_size > cache->max_object_size) {
+        return 0;
+    }
+    pthread_mutex_lock(&(cache->mutex));
+    if (cache->used + val_size > cache->max_size) {
+        pthread_mutex_unlock(&(cache->mutex));
+        return 0;
+    }
+    standin_entry_t * entry = (standin_entry_t *)malloc(sizeof(standin_entry_t));
+    if (entry != NULL) {
+        entry->key = strdup(key);
+        entry->val = malloc(val_size);
+        memcpy(entry->val, val, val_size);
+        entry->size = val_size;
+        entry->expires = time(NULL) + cache->ttl;
+        unsigned int h = standin_hash(key);
+        entry->next = cache->buckets[h];
+        cache->buckets[h] = entry;
+        cache->used += val_size;
+    }
+    pthread_mutex_unlock(&(cache->mutex));
+    return entry != NULL;
+}
+
+void ci_cache_destroy(ci_cache_t * cache) {
+    int i;
+    for (i = 0; i < STANDIN_CACHE_BUCKETS; i++) {
+        standin_entry_t * entry = cache->buckets[i];
+        while (entry != NULL) {
+            standin_entry_t * next = entry->next;
+            free(entry->key);
+            free(entry->val);
+            free(entry);
+            entry = next;
+        }
+    }
+    pthread_mutex_destroy(&(cache->mutex));
+    free(cache);
+}
+
+//---statistics. one process, so plain atomic counters. bytes are kept as bytes, not kilobytes.
+#define STANDIN_MAX_STATS 512
+static struct {
+    const char * label;
+    const char * group;
+    ci_stat_type_t type;
+    unsigned long long value;
+} standin_stats[STANDIN_MAX_STATS];
+static int standin_stats_used = 0;
+
+int ci_stat_entry_register(const char * label, ci_stat_type_t type, const char * group) {
+    int i;
+    for (i = 0; i < standin_stats_used; i++) {
+        if (strcmp(standin_stats[i].label, label) == 0 && strcmp(standin_stats[i].group, group) == 0) {
+            return i;
+        }
+    }
+    if (standin_stats_used == STANDIN_MAX_STATS) {
+        return -1;
+    }
+    standin_stats[standin_stats_used].label = strdup(label);
+    standin_stats[standin_stats_used].group = strdup(group);
+    standin_stats[standin_stats_used].type = type;
+    return standin_stats_used++;
+}
+
+void ci_stat_uint64_inc(int ID, int count) {
+    if (ID >= 0 && ID < standin_stats_used) {
+        __atomic_add_fetch(&(standin_stats[ID].value), count, __ATOMIC_RELAXED);
+    }
+}
+
+void ci_stat_kbs_inc(int ID, int count) {
+    ci_stat_uint64_inc(ID, count);
+}
+
+void standin_print_stats(FILE * out) {
+    int i;
+    const char * group = NULL;
+    for (i = 0; i < standin_stats_used; i++) {
+        if (group == NULL || strcmp(group, standin_stats[i].group) != 0) {
+            group = standin_stats[i].group;
+            fprintf(out, "[%s]\n", group);
+        }
+        fprintf(out, "  %-32s %llu%s\n", standin_stats[i].label, standin_stats[i].value,
+            standin_stats[i].type == STAT_KBS_T ? " bytes" : "");
+    }
+}
@@ -0,0 +1,29 @@
+/**
+ * @file standin.h
+ * @brief hooks of the c-icap stand-in for the benchmark driver
+ */
+#ifndef CIJ_BENCH_STANDIN_H
+#define CIJ_BENCH_STANDIN_H
+
+#include <stdio.h>
+#include "c_icap/service.h"
+
+/**
+ * Run an entry of a conf table like c-icap does for "Prefix.directive arg ..." lines.
+ * @return 1 if the directive is accepted
+ */
+int standin_conf(struct ci_conf_entry * table, const char * directive, const char ** argv);
+
+/**
+ * Run the actions registered by ci_command_register_action() for the type, e.g. CI_CMD_CHILD_START.
+ */
+void standin_run_commands(int type);
+
+ci_service_xdata_t * standin_xdata_new();
+
+/**
+ * Print the counters registered by ci_stat_entry_register(), group by group.
+ */
+void standin_print_stats(FILE * out);
+
+#endif
@@ -0,0 +1,22 @@
+class iBatchService {
+    /** small requests are previewed together by previewBatch() if BatchWindow is set, the others by preview() */
+    public iBatchService(final String mod_type, final long request) {
+        return;
+    }
+    /** @return a status of preview() for each view, in order */
+    public static int[] previewBatch(final RequestView[] views) {
+        final int[] status = new int[views.length];
+        for (int i = 0; i < views.length; i++) {
+            status[i] = views[i].body.length == 0 ? 204 : 0;
+        }
+        return status;
+    }
+    /** @return 0 or 100 to hook the request, 204 to unhook it */
+    public int preview(final byte[] data) {
+        return 0;
+    }
+    /** @return modified body or null if not modified */
+    public byte[] service(final byte[] body) {
+        return null;
+    }
+}
@@ -0,0 +1,28 @@
+import java.nio.ByteBuffer;
+
+/**
+ * iService receiving direct ByteBuffers instead of byte[].
+ * The buffers are views of c-icap's memory (no copy into the java heap),
+ * so they are valid only while the method runs. Do not keep them.
+ * They are read-only: return a modified body from service() instead of writing into them.
+ */
+class iDirectService {
+    public iDirectService(final String mod_type, final String[] headers) {
+        return;
+    }
+    /** @return 0 or 100 to hook the request, 204 to unhook it */
+    public int preview(final ByteBuffer data) {
+        return 0;
+    }
+    /** @return modified body or null if not modified */
+    public byte[] service(final ByteBuffer body) {
+        return null;
+    }
+}
+/*
+  public int preview(java.nio.ByteBuffer);
+    descriptor: (Ljava/nio/ByteBuffer;)I
+
+  public byte[] service(java.nio.ByteBuffer);
+    descriptor: (Ljava/nio/ByteBuffer;)[B
+*/
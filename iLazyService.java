@@ -0,0 +1,19 @@
+class iLazyService {
+    private String contentType;
+    /** headers are read by IcapRequest only when needed. the request handle is valid only in this call. */
+    public iLazyService(final String mod_type, final long request) {
+        reset(mod_type, request);
+    }
+    /** optional. if present, instances are pooled and reset per request instead of constructed. */
+    public void reset(final String mod_type, final long request) {
+        contentType = IcapRequest.getHeader(request, "Content-Type");
+    }
+    /** @return 0 or 100 to hook the request, 204 to unhook it */
+    public int preview(final byte[] data) {
+        return (contentType != null && contentType.startsWith("text/")) ? 0 : 204;
+    }
+    /** @return modified body or null if not modified */
+    public byte[] service(final byte[] body) {
+        return null;
+    }
+}
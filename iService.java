@@ -1,13 +1,31 @@
 class iService {
+    /** optional OPTIONS metadata, read from the class file by c-icap-java. see README */
+    static final int PREVIEW_SIZE = 1024;
+    static final String TRANSFER_PREVIEW = "*";
+    static final String MOD_TYPE = "REQMOD RESPMOD";
     public iService(final String mod_type, final String[] headers) {
         return;
     }
+    /** optional. if present, instances are pooled and reset per request instead of constructed. */
+    public void reset(final String mod_type, final String[] headers) {
+        return;
+    }
+    /** @return 0 or 100 to hook the request, 204 to unhook it. data is reused by the next request after preview() returns, copy what you keep */
     public int preview(final byte[] data) {
-        return 1;
+        return 0;
     }
+    /** @return modified body or null if not modified */
     public byte[] service(final byte[] body) {
         return null;
     }
+    /** optional. PrescanPatterns matches so far, called before preview() and service() when there are new ones */
+    public void onMatches(final int[] ids, final long[] offsets) {
+        return;
+    }
+    /** optional. called after service() returned a body. "Name: value" replaces Name, "Name:" removes it */
+    public String[] headers() {
+        return null;
+    }
 }
 /*
   <init>();
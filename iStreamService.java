@@ -0,0 +1,50 @@
+import java.nio.ByteBuffer;
+
+/**
+ * iService receiving the body chunk by chunk as c-icap receives it.
+ * Output may be written before the end of data, so memory per request is
+ * bounded by the chunk size instead of the body size.
+ * in and out are views of c-icap's buffers, valid only while onData() runs.
+ * preview(ByteBuffer) or preview(byte[]) may be added to return 204.
+ */
+class iStreamService {
+    private ByteBuffer pending = null;
+
+    public iStreamService(final String mod_type, final String[] headers) {
+        return;
+    }
+    /**
+     * @param in received chunk. consume all of it.
+     * @param out c-icap's write buffer. put up to out.remaining() bytes, keep the rest for the next call.
+     * @param eof no more input after in. onData() is called again with empty in until it returns -1.
+     * @return bytes put to out, or -1 when all output has been written (only after eof).
+     */
+    public int onData(final ByteBuffer in, final ByteBuffer out, final boolean eof) {
+        //pass through
+        ByteBuffer data = in;
+        if (pending != null) {
+            ByteBuffer joined = ByteBuffer.allocate(pending.remaining() + in.remaining());
+            joined.put(pending).put(in).flip();
+            data = joined;
+        }
+        if (eof && !data.hasRemaining()) {
+            return -1;
+        }
+        int n = Math.min(data.remaining(), out.remaining());
+        ByteBuffer slice = data.duplicate();
+        slice.limit(slice.position() + n);
+        out.put(slice);
+        data.position(data.position() + n);
+        if (data.hasRemaining()) {
+            pending = ByteBuffer.allocate(data.remaining());
+            pending.put(data).flip();
+        } else {
+            pending = null;
+        }
+        return n;
+    }
+}
+/*
+  public int onData(java.nio.ByteBuffer, java.nio.ByteBuffer, boolean);
+    descriptor: (Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;Z)I
+*/
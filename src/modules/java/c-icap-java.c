@@ -12,6 +12,27 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <strings.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <zlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 //---beware JNI Version
 #include "jni.h"
@@ -23,6 +44,10 @@
 #include "c_icap/body.h"
 #include "c_icap/simple_api.h"
 #include "c_icap/debug.h"
+#include "c_icap/commands.h"
+#include "c_icap/types_ops.h"
+#include "c_icap/cache.h"
+#include "c_icap/stats.h"
 
 #define CIJ_ERROR_LEVEL 1
 #define CIJ_WARN_LEVEL 3
@@ -37,29 +62,311 @@
     #define cij_debug_printf(lev,msg, ...) ci_debug_printf(lev, "CIJ:"msg"\n", ## __VA_ARGS__)
 #endif
 
-#define MAX_JVM_OPTIONS 4
-#define MAX_CLASS_NAME 1024
+#define MAX_JVM_OPTIONS 4 //built-in options: class path, library path and CDS archive
 
 /**
- * one ICAP service handles one JVIEnv (Java Process).
+ * one ICAP service handles one java class.
+ * every service of the process shares one JavaVM, see cij_service_env(jData_t * jdata).
  * S(mod_type,headers)
- * S.preview(byte[])
- * S.service(byte[])
+ * S.preview(byte[]) or S.preview(ByteBuffer)
+ * S.service(byte[]) or S.service(ByteBuffer)
+ * or streaming: S.onData(ByteBuffer in, ByteBuffer out, boolean eof) per received chunk
+ * S.reset(mod_type,headers) if the class has it, to reuse pooled instances
+ * or S(mod_type,long request) and S.reset(mod_type,long request) to read the request lazily by IcapRequest natives
+ * preview() and service() run on the executor of the service with a deadline if Async is on, see cij_job_submit(cij_job_t * job)
+ * verdicts are cached by url and body digest if VerdictCache is on, see cij_verdict_lookup(jServiceData_t * jServiceData)
+ * requests matching Bypass* rules are answered 204 by C, see cij_bypass(jData_t * jdata, ci_request_t * req)
+ */
+#define CIJ_MATCH_EXACT 0
+#define CIJ_MATCH_PREFIX 1 //"abc*"
+#define CIJ_MATCH_SUFFIX 2 //"*abc" or host ".example.com"
+#define CIJ_MATCH_GLOB 3 //anything else. fnmatch()
+
+/**
+ * a pattern compiled to the cheapest way to match it.<br>
+ */
+typedef struct cijPatternStruct {
+    char * text;//without the wildcard of PREFIX/SUFFIX
+    size_t length;
+    int kind;//CIJ_MATCH_*
+} cij_pattern_t;
+
+#define CIJ_PATTERNS_GLOB 0 //Content-Type globs, case insensitive
+#define CIJ_PATTERNS_PREFIX 1 //url prefixes
+#define CIJ_PATTERNS_HOST 2 //host names, ".example.com" for subdomains too. case insensitive
+#define CIJ_PATTERNS_WORD 3 //http methods, case insensitive
+
+/**
+ * a list of patterns given by a Bypass* directive.<br>
  */
+typedef struct cijPatternsStruct {
+    int mode;//CIJ_PATTERNS_*. how directive arguments are compiled
+    cij_pattern_t * items;
+    int used;
+    int size;
+} cij_patterns_t;
+
+#define CIJ_CALL_CONSTRUCTOR 0 //constructor or reset()
+#define CIJ_CALL_PREVIEW 1
+#define CIJ_CALL_SERVICE 2
+#define CIJ_CALL_ON_DATA 3
+#define CIJ_CALLS 4
+#define CIJ_HIST_BUCKETS 5 //<100us, <1ms, <10ms, <100ms, >=100ms
+
+/**
+ * a loaded version of the java class of a service.<br>
+ * replaced by a new version when the class file changes (ReloadInterval). requests and jobs hold a reference,
+ * so that in-flight requests finish on the version they started with.<br>
+ */
+typedef struct cijClassStruct {
+    struct jDataStruct * jdata;
+    jclass jIcapClass;//global ref
+    jobject loader;//global ref of the URLClassLoader. NULL if loaded by the system class loader
+    time_t mtime;//of the class files when loaded. see cij_class_mtime(jData_t * jdata)
+    int refs;//jdata->current, requests and jobs. guarded by jdata->class_mutex
+    jmethodID jServiceConstructor;//Constructor(String, String[])
+    jmethodID jServiceConstructorLazy;//Constructor(String, long). preferred, no header array is built
+    jmethodID jPreview;//preview(byte[])
+    jmethodID jPreviewDirect;//preview(ByteBuffer)
+    jmethodID jService;//service(byte[])
+    jmethodID jServiceDirect;//service(ByteBuffer)
+    jmethodID jHeaders;//String[] headers(). optional, header changes applied with the modified body
+    jmethodID jOnData;//onData(ByteBuffer, ByteBuffer, boolean). streaming mode if the class has it
+    jmethodID jOnMatches;//onMatches(int[], long[]). optional, gets the PrescanPatterns matches
+    jmethodID jPreviewBatch;//static int[] previewBatch(RequestView[]). optional, see BatchWindow
+    jclass jViewClass;//global ref of RequestView of the loader of the class
+    jmethodID jViewConstructor;//RequestView(String, long, byte[])
+    jmethodID jReset;//reset(String, String[]). instances are pooled if the class has it
+    jmethodID jResetLazy;//reset(String, long)
+    jobject * pool;//global refs of idle instances
+    int pool_used;
+} cij_class_t;
+
 typedef struct jDataStruct {
-    JNIEnv * jni;
-    JavaVM * jvm;
-    jclass jIcapClass;
+    cij_class_t * current;//NULL until bound to the JVM of this process. see cij_bind_service(jData_t * jdata, JNIEnv * jni)
     char * name;
-    jmethodID jServiceConstructor;//Constructor
-    jmethodID jPreview;//preview()
-    jmethodID jService;//service()
+    char * file;//the .class file
+    int reload_interval;//ReloadInterval. seconds between checks of the class files, 0 to load the class once
+    time_t reload_checked;
+    time_t reload_failed;//mtime of class files which failed to load. not tried again
+    pthread_mutex_t class_mutex;//guards current and refs of the versions
+    pthread_mutex_t reload_mutex;//one thread reloads at a time
+    int pool_size;//max idle instances per version
+    pthread_mutex_t pool_mutex;
+    ci_off_t body_max_mem;//bodies larger than this are spilled to a temporary file
+    int preview_size;//PREVIEW_SIZE of the class. see cij_class_options(jData_t * jdata)
+    int mod_type;//MOD_TYPE
+    char * transfer_preview;//TRANSFER_PREVIEW
+    char * transfer_ignore;//TRANSFER_IGNORE
+    char * transfer_complete;//TRANSFER_COMPLETE
+    char * istag;//ISTAG
+    int options_ttl;//OPTIONS_TTL. 0 for c-icap's default
+    struct ci_conf_entry * conf_table;//per service directives. see cij_service_conf_table(jData_t * jdata)
+    int async;//run preview() and service() on the executor threads
+    int deadline;//milliseconds to wait for java in async mode
+    int concurrency;//executor threads. also max java calls in flight, including abandoned ones
+    int fail_open;//answer 204 (or the original body) when java is saturated or late. CI_ERROR if off
+    pthread_mutex_t exec_mutex;//guards the fields below
+    pthread_cond_t exec_cond;//signals queued jobs to the executor threads
+    struct cijJobStruct * exec_head;//queued jobs
+    struct cijJobStruct * exec_tail;
+    int exec_inflight;//queued or running jobs
+    pid_t exec_pid;//the process running the executor threads. they don't survive fork()
+    int exec_threads;//executor threads running in exec_pid
+    int exec_stop;//the executor threads exit once the queue is empty. see cij_executor_stop(jData_t * jdata)
+    int cache_enable;//VerdictCache
+    char * cache_type;//"local" or "shared" (across children)
+    ci_off_t cache_size;
+    ci_off_t cache_max_object;//larger modified bodies are not cached
+    int cache_ttl;//seconds
+    ci_cache_t * cache;//built in the parent by post_init_java_handler(struct ci_server_conf * server_conf)
+    cij_patterns_t bypass_content_type;//BypassContentType
+    cij_patterns_t bypass_url;//BypassUrlPrefix
+    cij_patterns_t bypass_host;//BypassHost
+    cij_patterns_t bypass_method;//BypassMethod
+    ci_off_t bypass_max_length;//BypassMaxContentLength. bodies larger than this are not scanned. 0 to disable
+    ci_off_t bypass_min_length;//BypassMinContentLength. bodies smaller than this are not scanned. 0 to disable
+    int decode;//DecodeBody. java gets gzip/deflate bodies inflated
+    int decode_max_ratio;//DecodeMaxRatio. decoded/encoded bytes above this is a decompression bomb
+    ci_off_t decode_max_size;//DecodeMaxSize. decoded bodies larger than this are rejected
+    char * warmup_dir;//WarmupDir. sample requests replayed when a child starts. see cij_warmup(jData_t * jdata, JNIEnv * jni)
+    int warmup_requests;//WarmupRequests
+    int warmup_time;//WarmupTime. seconds, 0 or less for no time limit
+    int warming;//cij_warmup() runs. its calls are counted apart, the child serves nothing yet
+    char * prescan_file;//PrescanPatterns
+    struct cijPrescanStruct * prescan;//built in the parent from prescan_file. see cij_build_prescan(void * data, const char * name, const void * value)
+    int batch_window;//BatchWindow. microseconds a batch waits for more requests, 0 to disable batching
+    int batch_size;//BatchSize. a full batch is called at once
+    ci_off_t batch_max_body;//BatchMaxBody. larger bodies are previewed alone
+    pthread_mutex_t batch_mutex;//guards the fields below
+    pthread_cond_t batch_cond;//signals the leader of a full batch, and the followers of a done batch
+    struct cijBatchEntryStruct * batch_head;//requests waiting for the next batch
+    struct cijBatchEntryStruct * batch_tail;
+    int batch_used;
+    int batch_leader;//a thread is collecting the next batch
+    char * stat_group;//"Service <name>" on the info page. see cij_register_stats(void * data, const char * name, const void * value)
+    int stat_requests;
+    int stat_allow204;
+    int stat_errors;
+    int stat_bypass;
+    int stat_cache_hit;
+    int stat_cache_miss;
+    int stat_saturated;
+    int stat_late;
+    int stat_sidecar_errors;
+    int stat_bytes_in;
+    int stat_bytes_out;
+    int stat_prescan_clean;
+    int stat_batches;
+    int stat_warmup_calls;
+    int stat_calls[CIJ_CALLS];
+    int stat_call_us[CIJ_CALLS];
+    int stat_call_hist[CIJ_CALLS][CIJ_HIST_BUCKETS];
 } jData_t;
 
+/**
+ * streaming SipHash-2-4 with 128 bit output.<br>
+ */
+typedef struct cijSipHashStruct {
+    uint64_t v0, v1, v2, v3;
+    uint64_t tail;//bytes not yet compressed, little endian
+    uint64_t length;
+} cij_siphash_t;
+
+#define CIJ_KEY_SIZE 34 //verdict cache key: mod type char, 32 hex digits and NUL
+
+/**
+ * a verdict from the cache. 'N' not modified or 'M' followed by the modified body.<br>
+ */
+typedef struct cijVerdictStruct {
+    size_t size;
+    char data[];
+} cij_verdict_t;
+
+#define CIJ_CODEC_CHUNK 16384
+#define CIJ_ARENA_BLOCK (48 * 1024) //jServiceData_t and both codecs fit in the first block
+#define CIJ_ARENA_CACHE 4 //idle arenas kept per thread
+#define CIJ_SIDECAR_VERSION 1
+#define CIJ_SIDECAR_HELLO 'H' //ring size and path of the ring file
+#define CIJ_SIDECAR_OPEN 'O' //mod type, service name and http headers
+#define CIJ_SIDECAR_PREVIEW 'P' //length of preview data in the ring
+#define CIJ_SIDECAR_DATA 'D' //length of a body chunk in the ring
+#define CIJ_SIDECAR_SERVICE 'S' //length of the last body chunk in the ring
+#define CIJ_SIDECAR_GET 'G' //offset of the next chunk of the modified body to put in the ring
+#define CIJ_SIDECAR_CLOSE 'C' //the request is released. no reply
+#define CIJ_SIDECAR_MATCHES 'M' //count, then id (4 bytes) and offset (8 bytes) of each PrescanPatterns match
+#define CIJ_SIDECAR_REPLY 'R' //4 bytes value. service() replies with a verdict type instead
+#define CIJ_SIDECAR_ERROR 'E' //message. java threw an exception
+#define CIJ_SIDECAR_MAX_REPLY 65536
+#define CIJ_DEFAULT_SIDECAR_RING (1024 * 1024)
+#define CIJ_DEFAULT_SIDECAR_MAX_BODY (64 * 1024 * 1024) //modified bodies from the sidecar larger than this are refused
+#define CIJ_SIDECAR_SHM_DIR "/dev/shm"
+#define CIJ_LOCAL_FRAME 32 //local refs reserved per handler call. see cij_frame_push(jServiceData_t * jServiceData)
+
+/**
+ * native memory of one request. allocations are bumped in the blocks and released together
+ * by cij_arena_release(). the first block goes back to the thread for the next request.<br>
+ */
+typedef struct cijArenaStruct {
+    struct cijArenaStruct * next;//overflow blocks, or the next idle arena of the thread
+    size_t size;//bytes of data
+    size_t used;
+    char data[] __attribute__((aligned(16)));
+} cij_arena_t;
+#define CIJ_ENCODING_GZIP 1
+#define CIJ_ENCODING_DEFLATE 2
+
+/**
+ * zlib stream of a request body. inflates the http body for java, or deflates the modified body to wbuf.<br>
+ */
+typedef struct cijCodecStruct {
+    z_stream z;
+    int encoding;//CIJ_ENCODING_GZIP or CIJ_ENCODING_DEFLATE
+    int started;//the stream is initialized. the inflater waits for the first bytes to tell zlib from raw deflate
+    int deflater;
+    int finished;//Z_STREAM_END
+    int failed;//the http body is not what Content-Encoding says. java sees it as is. see cij_decode_fail()
+    char buf[CIJ_CODEC_CHUNK];
+} cij_codec_t;
+
+#define CIJ_PRESCAN_MAX_MATCHES 256 //matches kept per request. more are counted only
+#define CIJ_PRESCAN_SIMD_BYTES 4 //first bytes compared at once by SSE2. see cij_prescan_skip()
+
+typedef struct cijAcEdgeStruct {
+    int32_t from;
+    int32_t next;
+    int32_t sibling;//next edge of from while building. unused once sorted
+    unsigned char byte;
+} cij_ac_edge_t;
+
+typedef struct cijAcStateStruct {
+    int32_t edges;//first of the sorted edges
+    int32_t edges_used;
+    int32_t fail;
+    int32_t output;//id of the pattern ending here or -1
+    int32_t dict;//nearest state on the failure chain with an output or -1
+} cij_ac_state_t;
+
+/**
+ * Aho-Corasick automaton of PrescanPatterns, with a first byte and a two byte prefix filter
+ * to skip text while at the root.<br>
+ */
+typedef struct cijPrescanStruct {
+    int32_t root[256];//transitions of the root. 0 stays at the root
+    cij_ac_state_t * states;
+    int32_t states_used;
+    int32_t states_size;
+    cij_ac_edge_t * edges;
+    int32_t edges_used;
+    int32_t edges_size;
+    int32_t * lengths;//of the patterns by id
+    int32_t lengths_size;
+    int32_t patterns;
+    uint8_t first[256];//bytes starting a pattern
+    unsigned char first_bytes[CIJ_PRESCAN_SIMD_BYTES];
+    int first_count;
+    uint8_t bigrams[256 * 32];//bit set of the first two bytes of the patterns
+} cij_prescan_t;
+
+typedef struct cijMatchStruct {
+    int32_t id;//number of the pattern in PrescanPatterns, from 0
+    int64_t offset;//of the first byte of the match in the body java sees
+} cij_match_t;
+
 typedef struct jServiceDataStruct {
+    cij_arena_t * arena;//owns this struct, the codecs and the verdict
     jData_t * jdata;//includes JVM
-    jobject instance;
-    ci_membuf_t * buffer;
+    cij_class_t * klass;//referred version of the class the request runs on. NULL if bypassed
+    jobject instance;//global ref. from the pool of the version or newly constructed
+    int discard;//the instance threw an exception. not to be reused
+    ci_cached_file_t * buffer;//http body. sent as is unless java modified it
+    cij_codec_t * decoder;//DecodeBody: inflates buffer into decoded. NULL if the body is not encoded
+    ci_cached_file_t * decoded;//the body java sees if decoder is set
+    cij_codec_t * encoder;//deflates the modified body of a decoded body
+    jbyteArray output;//global ref of the modified body returned by java service(). read into wbuf
+    const char * output_data;//or the modified body in verdict
+    jsize output_len;
+    jsize output_pos;//bytes already sent
+    int eof;//end of data has handled. buffer is ready to send
+    int stream_eof;//streaming mode: java has seen the end of input
+    int stream_done;//streaming mode: java has written all output
+    ci_request_t * req;//to construct the instance lazily. see cij_service_instance(JNIEnv * jni, jServiceData_t * jServiceData)
+    cij_siphash_t digest;//url and body received so far
+    int preview_len;//bytes of preview at the head of buffer
+    int preview_deferred;//preview() is called at end of data after the cache missed
+    int sidecar;//java runs in the sidecar process. klass and instance are not used
+    int sidecar_open;//the sidecar holds an instance for the request
+    int looked_up;//the cache has been searched
+    char key[CIJ_KEY_SIZE];
+    cij_verdict_t * verdict;//cache hit or NULL
+    int bypass;//matched Bypass* rules. the body is sent as is without calling java
+    int32_t prescan_state;//of the automaton after the bytes fed so far
+    int64_t prescan_offset;//bytes fed
+    cij_match_t * prescan_matches;//in the arena. NULL until the first match
+    int prescan_used;
+    int prescan_total;//matches found, including those not kept
+    int prescan_delivered;//prescan_total when java onMatches() was called last
+    jlong handle;//IcapRequest handle given to java. revoked at release. 0 if not issued
 } jServiceData_t;
 
 int init_java_handler(struct ci_server_conf * server_conf);
@@ -76,6 +383,50 @@ int java_check_preview_handler(char * preview_data, int preview_data_len, ci_req
 int java_end_of_data_handler(ci_request_t * req);
 int java_service_io(char * wbuf, int * wlen, char * rbuf, int * rlen, int iseof, ci_request_t * req);
 
+static char * cij_conf_class_path = NULL; //java_handler.JavaClassPath. appended to ServicesDir
+static char * cij_conf_library_path = NULL; //java_handler.JavaLibraryPath
+static char * cij_conf_cds_archive = NULL; //java_handler.JavaCDSArchive. see "make cds"
+static char ** cij_conf_options = NULL; //java_handler.JavaOption. given to JNI_CreateJavaVM as is
+static int cij_conf_options_used = 0;
+static jint cij_conf_jni_version = JNI_VERSION_1_6; //java_handler.JNIVersion
+#define CIJ_MAX_HANDLES 4096 //requests of a child holding an IcapRequest handle at once. see cij_handle_issue(ci_request_t * req)
+
+/**
+ * a slot of IcapRequest handles. see cij_handle_issue(ci_request_t * req)<br>
+ */
+typedef struct cijHandleStruct {
+    pthread_mutex_t mutex;//held by a native while it reads the request
+    ci_request_t * req;//NULL if free or revoked
+    uint32_t generation;//bumped when revoked
+    int next_free;
+} cij_handle_t;
+
+static cij_handle_t cij_handles[CIJ_MAX_HANDLES];
+static int cij_handles_used = 0; //slots initialized
+static int cij_handles_free = -1; //first free slot
+static pthread_mutex_t cij_handles_mutex = PTHREAD_MUTEX_INITIALIZER; //guards the fields above and next_free
+static char * cij_conf_sidecar = NULL; //java_handler.Sidecar. unix socket of the java sidecar, no JVM in c-icap if set
+static ci_off_t cij_conf_sidecar_ring = 0; //java_handler.SidecarRingSize
+static ci_off_t cij_conf_sidecar_max_body = CIJ_DEFAULT_SIDECAR_MAX_BODY; //java_handler.SidecarMaxBody
+static int cij_cfg_java_option(const char * directive, const char ** argv, void * setdata);
+static int cij_cfg_jni_version(const char * directive, const char ** argv, void * setdata);
+
+/**
+ * "java_handler.Directive value" in c-icap.conf.<br>
+ * read before any JVM is created. JVM is created per child process, see cij_create_jvm().
+ */
+static struct ci_conf_entry java_conf_table[] = {
+    {"JavaOption", &cij_conf_options, cij_cfg_java_option, NULL},
+    {"JavaClassPath", &cij_conf_class_path, ci_cfg_set_str, NULL},
+    {"JavaLibraryPath", &cij_conf_library_path, ci_cfg_set_str, NULL},
+    {"JavaCDSArchive", &cij_conf_cds_archive, ci_cfg_set_str, NULL},
+    {"JNIVersion", &cij_conf_jni_version, cij_cfg_jni_version, NULL},
+    {"Sidecar", &cij_conf_sidecar, ci_cfg_set_str, NULL},
+    {"SidecarRingSize", &cij_conf_sidecar_ring, ci_cfg_size_off, NULL},
+    {"SidecarMaxBody", &cij_conf_sidecar_max_body, ci_cfg_size_off, NULL},
+    {NULL, NULL, NULL, NULL}
+};
+
 /**
  * Declare c-icap module handler.<br>
  * <br>
@@ -88,356 +439,4934 @@ CI_DECLARE_DATA service_handler_module_t module = {
     post_init_java_handler,
     release_java_handler,
     load_java_module,
-    NULL // TODO: conf-table
+    java_conf_table
 };
 
-ci_dyn_array_t * environments; //JVM environments
-#define MAX_ENVIRONMENTS_SIZE 256
-#define CIJ_CLASS_MOD_TYPE "MOD_TYPE"
+ci_ptr_dyn_array_t * java_services; //jData_t of every loaded service
+#define MAX_SERVICES_SIZE 256
+#define CIJ_CLASS_MOD_TYPE "MOD_TYPE" //static final fields read by cij_class_options(jData_t * jdata)
+#define CIJ_CLASS_PREVIEW_SIZE "PREVIEW_SIZE"
+#define CIJ_CLASS_TRANSFER_PREVIEW "TRANSFER_PREVIEW"
+#define CIJ_CLASS_TRANSFER_IGNORE "TRANSFER_IGNORE"
+#define CIJ_CLASS_TRANSFER_COMPLETE "TRANSFER_COMPLETE"
+#define CIJ_CLASS_ISTAG "ISTAG"
+#define CIJ_CLASS_OPTIONS_TTL "OPTIONS_TTL"
+#define CIJ_DEFAULT_PREVIEW_SIZE 1024
+#define CIJ_DEFAULT_WARMUP_REQUESTS 10000
+#define CIJ_DEFAULT_WARMUP_TIME 10 //seconds
+#define CIJ_WARMUP_MAX_SAMPLE (16 * 1024 * 1024)
+#define CIJ_MAX_CLASS_FILE (16 * 1024 * 1024)
+#define CIJ_CF_MAGIC 0xCAFEBABE
+#define CIJ_CF_UTF8 1 //constant pool tags of the class file format
+#define CIJ_CF_INTEGER 3
+#define CIJ_CF_FLOAT 4
+#define CIJ_CF_LONG 5
+#define CIJ_CF_DOUBLE 6
+#define CIJ_CF_CLASS 7
+#define CIJ_CF_STRING 8
+#define CIJ_CF_FIELDREF 9
+#define CIJ_CF_METHODREF 10
+#define CIJ_CF_INTERFACE_METHODREF 11
+#define CIJ_CF_NAME_AND_TYPE 12
+#define CIJ_CF_METHOD_HANDLE 15
+#define CIJ_CF_METHOD_TYPE 16
+#define CIJ_CF_DYNAMIC 17
+#define CIJ_CF_INVOKE_DYNAMIC 18
+#define CIJ_CF_MODULE 19
+#define CIJ_CF_PACKAGE 20
+#define CIJ_CF_ACC_STATIC 0x0008
 
 const char * JAVA_CLASS_PATH;
-const char * JAVA_LIBRARY_PATH;
+
+static jData_t * cij_loading = NULL; //the service just loaded. c-icap calls mod_init_service right after load_java_module
+static pthread_key_t cij_env_key; //JNIEnv of worker threads attached by us
+static pthread_key_t cij_thread_key; //cij_thread_t of worker threads
+static JavaVM * cij_jvm = NULL; //one JVM per process shared by every service
+static pid_t cij_jvm_pid = 0; //the process created cij_jvm
+static pthread_mutex_t cij_jvm_mutex = PTHREAD_MUTEX_INITIALIZER; //guards JVM creation and class binding
+static char cij_empty[1]; //address of zero length direct buffers
+static jstring cij_jstr_reqmod = NULL; //global ref of "REQMOD"
+static jstring cij_jstr_respmod = NULL; //global ref of "RESPMOD"
+static jclass cij_class_string = NULL; //global ref of java.lang.String
+static jmethodID cij_read_only_method = NULL; //ByteBuffer.asReadOnlyBuffer(). see cij_read_only_buffer(JNIEnv * jni, char * data, jlong length)
+#define CIJ_DEFAULT_POOL_SIZE 32
+#define CIJ_REQUEST_CLASS "IcapRequest" //holds natives to read the request. see cij_register_natives(JNIEnv * jni)
+#define CIJ_VIEW_CLASS "RequestView" //a request given to previewBatch(RequestView[])
+#define CIJ_DEFAULT_BATCH_SIZE 32
+#define CIJ_DEFAULT_BATCH_MAX_BODY 4096
+#define CIJ_MAX_URL 8192
+#define CIJ_MAX_HEADER_NAME 256
+#define CIJ_DEFAULT_DEADLINE 1000 //milliseconds
+#define CIJ_DEFAULT_CONCURRENCY 8
+#define CIJ_EXECUTOR_STOP_WAIT 5 //seconds to wait for executor threads at release
+#define CIJ_DEFAULT_CACHE_SIZE (16 * 1024 * 1024)
+#define CIJ_DEFAULT_CACHE_MAX_OBJECT (64 * 1024)
+#define CIJ_DEFAULT_CACHE_TTL 600 //seconds
+#define CIJ_VERDICT_NOT_MODIFIED 'N'
+#define CIJ_VERDICT_MODIFIED 'M'
+#define CIJ_VERDICT_MODIFIED_HEADERS 'H' //followed by header lines, then the modified body
+#define CIJ_DEFAULT_DECODE_MAX_RATIO 100
+#define CIJ_DEFAULT_DECODE_MAX_SIZE (64 * 1024 * 1024)
+#define CIJ_DECODE_RATIO_FLOOR (1024 * 1024) //ratio is not checked below this decoded size
+static uint64_t cij_siphash_key[2]; //generated in the parent so that children share verdicts
+static int cij_stat_jvm_starts = -1; //JavaVMs created, one per child
+static int cij_stat_jvm_start_ms = -1;
+static int cij_stat_gc_count = -1; //sum of GarbageCollectorMXBean of every child
+static int cij_stat_gc_ms = -1;
+static jobjectArray cij_gc_beans = NULL; //global ref of GarbageCollectorMXBean[]
+static jmethodID cij_gc_count_method = NULL;
+static jmethodID cij_gc_time_method = NULL;
+static jlong cij_gc_last_count = 0;
+static jlong cij_gc_last_ms = 0;
+static time_t cij_gc_sampled = 0; //GC beans are read at most once a second
 
 /**
- * Called When c-icap process start.<br>
- * prev = none<br>
- * next = load_java_module(const char * service_file)<br>
+ * Increment a c-icap statistics counter if it has been registered.<br>
+ */
+static void cij_stat_inc(int id, long long count) {
+    if (id >= 0 && count > 0) {
+        ci_stat_uint64_inc(id, count > INT_MAX ? INT_MAX : (int)count);
+    }
+}
+
+static void cij_stat_kbs(int id, long long bytes) {
+    if (id >= 0 && bytes > 0) {
+        ci_stat_kbs_inc(id, bytes > INT_MAX ? INT_MAX : (int)bytes);
+    }
+}
+
+/**
+ * microseconds of a monotonic clock, to time java calls.<br>
+ */
+static uint64_t cij_now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+/**
+ * Account a java call to the call count, the total time and the latency histogram of the service.<br>
+ * calls of the warm-up are only counted by JAVA WARMUP CALLS, they would fill the histogram with cold calls.<br>
  *
- * @see load_java_module(const char * service_file)
- * @param server_conf a pointer to the server configurations.
- * @return CI_OK
+ * @param jdata the service
+ * @param call CIJ_CALL_*
+ * @param start cij_now_us() before the call
  */
-int init_java_handler(struct ci_server_conf * server_conf) {
-    environments = ci_dyn_array_new(MAX_ENVIRONMENTS_SIZE);//FREEME
-    JAVA_CLASS_PATH = server_conf->SERVICES_DIR;
-    return CI_OK;
+static void cij_stat_call(jData_t * jdata, int call, uint64_t start) {
+    if (jdata->warming) {
+        cij_stat_inc(jdata->stat_warmup_calls, 1);
+        return;
+    }
+    uint64_t us = cij_now_us() - start;
+    int bucket = us < 100 ? 0 : us < 1000 ? 1 : us < 10000 ? 2 : us < 100000 ? 3 : 4;
+    cij_stat_inc(jdata->stat_calls[call], 1);
+    cij_stat_inc(jdata->stat_call_us[call], (long long)us);
+    cij_stat_inc(jdata->stat_call_hist[call][bucket], 1);
 }
 
 /**
- * Called When all c-icap-java services's "java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)" has called.<br>
- * prev = java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)<br>
- * next = java_post_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)<br>
+ * pthread key destructor. detaches the exiting c-icap worker thread from JVM.<br>
  *
- * @see java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)
- * @see java_post_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)
- * @param server_conf a pointer to the server configurations.
- * @return CI_OK
+ * @see cij_attach_env(JavaVM * jvm)
+ * @param value JNIEnv saved by cij_attach_env(JavaVM * jvm)
  */
-int post_init_java_handler(struct ci_server_conf * server_conf) {
-    return CI_OK;
+static void cij_detach_env(void * value) {
+    JavaVM * jvm = __atomic_load_n(&cij_jvm, __ATOMIC_ACQUIRE);
+    if (jvm == NULL) {
+        return;//already destroyed
+    }
+    (*jvm)->DetachCurrentThread(jvm);
 }
 
 /**
- * Called by each service scripts. initialize JVM.<br>
- * prev = init_java_handler(struct ci_server_conf * server_conf)<br>
- * next = java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)<br>
+ * Get JNIEnv of the current thread.<br>
+ * A JNIEnv is only valid on the thread which owns it, so each c-icap worker thread
+ * attaches itself (as a daemon) at the first call, keeps its JNIEnv in thread local storage
+ * and detaches when the thread exits.<br>
  *
- * @see init_java_handler(struct ci_server_conf * server_conf)
- * @see java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)
- * @param service_file not to 'free'? idk...
- * @return
+ * @see cij_detach_env(void * value)
+ * @param jvm a pointer of JavaVM
+ * @return JNIEnv of the current thread or NULL if failed to attach
  */
-ci_service_module_t * load_java_module(const char * service_file) {
-    ci_service_module_t * service = NULL;
-    jData_t * jdata = NULL;
-    service = (ci_service_module_t *)malloc(sizeof(ci_service_module_t));//FREEME
-    if (service == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL,"Failed to allocate memory for service %s",service_file);
-        return NULL;
+static JNIEnv * cij_attach_env(JavaVM * jvm) {
+    JNIEnv * jni = (JNIEnv *)pthread_getspecific(cij_env_key);
+    if (jni != NULL) {
+        return jni;
     }
-    jdata = (jData_t *)malloc(sizeof(jData_t));//FREEME
-    if (jdata == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL,"Failed to allocate memory for service %s",service_file);
-        free(service);
+    jint ret = (*jvm)->GetEnv(jvm, (void **)&jni, cij_conf_jni_version);
+    if (ret == JNI_OK) {
+        return jni;//the thread created JVM. not ours to detach.
+    }
+    if (ret != JNI_EDETACHED) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to get JNIEnv(%d).", ret);
         return NULL;
     }
-
-    {//set service file name to SERVICE NAME
-    const char * service_file_name = basename(service_file);// increase pointer to the next of last "/"(in *nixOS) or "\"(in windowsOS)
-    char * name = strndup(service_file_name, MAX_SERVICE_NAME);//duplicate filename string
-    if (name == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL,"Failed to allocate memory for service %s",service_file);
-        free(service);
-        free(jdata);
+    JavaVMAttachArgs args;
+    args.version = cij_conf_jni_version;
+    args.name = NULL;
+    args.group = NULL;
+    ret = (*jvm)->AttachCurrentThreadAsDaemon(jvm, (void **)&jni, &args);
+    if (ret != JNI_OK) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to attach thread to JavaVM(%d).", ret);
         return NULL;
     }
-    name[strnlen(name, MAX_SERVICE_NAME)-strnlen(".class", MAX_SERVICE_NAME)] = '\0';//strip ".class" from the file
-    jdata->name = name;//FREEME
+    if (pthread_setspecific(cij_env_key, jni) != 0) {
+        cij_debug_printf(CIJ_WARN_LEVEL, "Failed to save JNIEnv of the thread.");
     }
+    return jni;
+}
 
-    {//set CLASSPATH
-    #define NUM_JVM_OPTIONS 1
-    JavaVMOption options[NUM_JVM_OPTIONS];
-    int ret = asprintf(&(options[0].optionString), "-Djava.class.path=%s",JAVA_CLASS_PATH);//FREEME
-    //"-verbose:jni";
-    //"-Djava.library.path=%s.jar"
+/**
+ * connection of a worker thread to the java sidecar (java_handler.Sidecar).<br>
+ * control messages go over the unix socket, body bytes through a shared memory region mapped by both sides.
+ * a connection carries one request at a time, so the region is simply reused chunk by chunk.<br>
+ * message: 1 byte op, 4 bytes big endian payload length, payload. see Sidecar.java
+ */
+typedef struct cijSidecarStruct {
+    int fd;
+    char * ring;//shared with the sidecar
+    size_t ring_size;
+    int timeout;//milliseconds of SO_RCVTIMEO currently set
+    int timed_out;//the last reply did not come within SO_RCVTIMEO
+    char reply[CIJ_SIDECAR_MAX_REPLY];//payload of the last reply
+    uint32_t reply_len;
+} cij_sidecar_t;
 
-    if (ret < 0) { // asprintf always returns -1 if some error occured.
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to allocate memory for service '%s'.", jdata->name);
-        goto FAIL_TO_LOAD_SERVICE;
+/**
+ * close a sidecar connection. the sidecar drops the instance of an open request.<br>
+ */
+static void cij_sidecar_close(cij_sidecar_t * sc) {
+    if (sc == NULL) {
+        return;
+    }
+    if (sc->fd >= 0) {
+        close(sc->fd);
+    }
+    if (sc->ring != NULL) {
+        munmap(sc->ring, sc->ring_size);
     }
+    free(sc);
+}
 
-    //create VM
-    JavaVMInitArgs jvmInitArgs;
-    jvmInitArgs.options = options;
-    jvmInitArgs.nOptions = NUM_JVM_OPTIONS; //TODO:CLASSPATH,VERSION,...
-    jvmInitArgs.version = JNI_VERSION_1_6;
-    jvmInitArgs.ignoreUnrecognized = JNI_FALSE;
-    ret = JNI_CreateJavaVM(&(jdata->jvm), (void **)&(jdata->jni), (void *)(&jvmInitArgs));
-    free(options[0].optionString);
-    if (ret != JNI_OK) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to setup JavaVM(%d).", ret);
-        goto FAIL_TO_LOAD_SERVICE;
+static int cij_sidecar_write(int fd, const struct iovec * iov, int iovcnt) {
+    struct iovec v[2];
+    memcpy(v, iov, iovcnt * sizeof(struct iovec));
+    struct iovec * p = v;
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, p, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return CI_ERROR;
+        }
+        while (iovcnt > 0 && (size_t)n >= p->iov_len) {
+            n -= p->iov_len;
+            p++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            p->iov_base = (char *)p->iov_base + n;
+            p->iov_len -= n;
+        }
     }
+    return CI_OK;
+}
+
+static int cij_sidecar_read(int fd, char * buf, size_t length) {
+    while (length > 0) {
+        ssize_t n = read(fd, buf, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0) {
+            errno = ECONNRESET;//closed by the sidecar
+        }
+        if (n <= 0) {
+            return CI_ERROR;//closed, or SO_RCVTIMEO expired with EAGAIN
+        }
+        buf += n;
+        length -= n;
     }
+    return CI_OK;
+}
 
-    JNIEnv * jni = jdata->jni;
+/**
+ * Send a message to the sidecar.<br>
+ *
+ * @param sc the connection
+ * @param op message type
+ * @param payload payload or NULL
+ * @param length payload byte length
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_sidecar_send(cij_sidecar_t * sc, char op, const char * payload, uint32_t length) {
+    char head[5];
+    uint32_t n = htonl(length);
+    head[0] = op;
+    memcpy(head + 1, &n, 4);
+    struct iovec iov[2] = {{head, sizeof(head)}, {(void *)payload, length}};
+    return cij_sidecar_write(sc->fd, iov, length > 0 ? 2 : 1);
+}
 
-    //find class
-    {
-    char className[MAX_CLASS_NAME];
-    if (snprintf(className, MAX_CLASS_NAME, "L%s;", jdata->name) < 0) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to setup className string for java class '%s'.", className);
-        goto FAIL_TO_LOAD_SERVICE;
+/**
+ * Send a message with a 4 bytes value as payload, mostly a length of bytes in the ring.<br>
+ */
+static int cij_sidecar_send_u32(cij_sidecar_t * sc, char op, uint32_t value) {
+    uint32_t n = htonl(value);
+    return cij_sidecar_send(sc, op, (const char *)&n, 4);
+}
+
+/**
+ * Receive a reply of the sidecar into sc->reply.<br>
+ * an error reply (java threw) is logged. the connection is still in sync then.<br>
+ *
+ * @param sc the connection
+ * @param jdata the service, for logging
+ * @return op of the reply, or CI_ERROR on i/o errors and timeouts. sc->timed_out tells a timeout
+ */
+static int cij_sidecar_recv(cij_sidecar_t * sc, jData_t * jdata) {
+    char head[5];
+    uint32_t n;
+    sc->timed_out = 0;
+    if (cij_sidecar_read(sc->fd, head, sizeof(head)) != CI_OK) {
+        sc->timed_out = errno == EAGAIN || errno == EWOULDBLOCK;
+        cij_debug_printf(CIJ_ERROR_LEVEL, "No reply from sidecar for service '%s' (%s).", jdata->name, strerror(errno));
+        return CI_ERROR;
     }
-    jclass service_class = (*jni)->FindClass(jni, className);
-    if (service_class == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to find java class '%s'.", className);
-        goto FAIL_TO_LOAD_SERVICE;
+    memcpy(&n, head + 1, 4);
+    sc->reply_len = ntohl(n);
+    if (sc->reply_len >= sizeof(sc->reply) || cij_sidecar_read(sc->fd, sc->reply, sc->reply_len) != CI_OK) {
+        sc->timed_out = sc->reply_len < sizeof(sc->reply) && (errno == EAGAIN || errno == EWOULDBLOCK);
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Broken reply from sidecar for service '%s'.", jdata->name);
+        return CI_ERROR;
     }
-    jdata->jIcapClass = service_class;
+    sc->reply[sc->reply_len] = '\0';
+    if (head[0] == CIJ_SIDECAR_ERROR) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Sidecar error in service '%s': %s", jdata->name, sc->reply);
     }
-    jclass cls = jdata->jIcapClass;
-/*
-    //identify REQMOD, RESPMOD 'int class.MOD_TYPE'
-    jfieldID mod_type_fid = (*jni)->GetStaticFieldID(jni, cls, "si", CIJ_CLASS_MOD_TYPE);
-    if (mod_type_fid == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to find field '%s'.", CIJ_CLASS_MOD_TYPE);
-        goto FAIL_TO_LOAD_SERVICE;
+    return (unsigned char)head[0];
+}
+
+/**
+ * 4 bytes value of the last reply.<br>
+ */
+static uint32_t cij_sidecar_reply_u32(cij_sidecar_t * sc) {
+    uint32_t n = 0;
+    if (sc->reply_len >= 4) {
+        memcpy(&n, sc->reply, 4);
     }
-    jint mod_type = (*jni)->GetStaticIntField(jni, cls, mod_type_fid);
-    jdata->mod_type = mod_type;
-*/
-    {
-    jmethodID init = (*jni)->GetMethodID(jni, cls, "<init>", "(Ljava/lang/String;[Ljava/lang/String;)V");
-    if (init == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to find constructor method '%s()'.", jdata->name);
-        goto FAIL_TO_LOAD_SERVICE;
+    return ntohl(n);
+}
+
+/**
+ * Connect to the sidecar and share a new ring with it.<br>
+ * the ring file is unlinked as soon as the sidecar has mapped it, so nothing is left behind by a crash.<br>
+ *
+ * @return the connection or NULL
+ */
+static cij_sidecar_t * cij_sidecar_connect() {
+    static unsigned int serial = 0;
+    char path[PATH_MAX];
+    int ring_fd = -1;
+    cij_sidecar_t * sc = (cij_sidecar_t *)calloc(1, sizeof(cij_sidecar_t));//FREEME by cij_sidecar_close()
+    if (sc == NULL) {
+        return NULL;
     }
-    jdata->jServiceConstructor = init;
+    sc->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, cij_conf_sidecar, sizeof(addr.sun_path) - 1);
+    if (sc->fd < 0 || connect(sc->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to connect to sidecar '%s' (%s).", cij_conf_sidecar, strerror(errno));
+        goto FAIL_TO_CONNECT;
     }
 
-    {
-    jmethodID preview = (*jni)->GetMethodID(jni, cls, "preview", "([B)I");
-    if (preview == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to find method 'int preview(byte[])'.");
-        goto FAIL_TO_LOAD_SERVICE;
+    sc->ring_size = cij_conf_sidecar_ring > 0 ? (size_t)cij_conf_sidecar_ring : CIJ_DEFAULT_SIDECAR_RING;
+    snprintf(path, sizeof(path), "%s/c-icap-java.%d.%u", CIJ_SIDECAR_SHM_DIR, (int)getpid(), __atomic_fetch_add(&serial, 1, __ATOMIC_RELAXED));
+    ring_fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (ring_fd < 0 || ftruncate(ring_fd, sc->ring_size) != 0) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to create sidecar ring '%s' (%s).", path, strerror(errno));
+        goto FAIL_TO_CONNECT;
     }
-    jdata->jPreview = preview;
+    sc->ring = (char *)mmap(NULL, sc->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+    if (sc->ring == MAP_FAILED) {
+        sc->ring = NULL;
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to map sidecar ring '%s' (%s).", path, strerror(errno));
+        goto FAIL_TO_CONNECT;
     }
-
-    {
-    jmethodID service = (*jni)->GetMethodID(jni, cls, "service", "([B)[B");
-    if (service == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to find method 'byte[] service(byte[])'.");
-        goto FAIL_TO_LOAD_SERVICE;
+    //hello: ring size and path
+    char hello[4 + PATH_MAX];
+    uint32_t size = htonl((uint32_t)sc->ring_size);
+    memcpy(hello, &size, 4);
+    size_t path_len = strlen(path);
+    memcpy(hello + 4, path, path_len);
+    if (cij_sidecar_send(sc, CIJ_SIDECAR_HELLO, hello, 4 + path_len) != CI_OK) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to greet sidecar '%s' (%s).", cij_conf_sidecar, strerror(errno));
+        goto FAIL_TO_CONNECT;
     }
-    jdata->jService = service;
+    char op[5];
+    uint32_t version = 0;
+    if (cij_sidecar_read(sc->fd, op, sizeof(op)) != CI_OK || op[0] != CIJ_SIDECAR_REPLY
+        || cij_sidecar_read(sc->fd, (char *)&version, 4) != CI_OK || ntohl(version) != CIJ_SIDECAR_VERSION) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Sidecar '%s' did not accept the ring.", cij_conf_sidecar);
+        goto FAIL_TO_CONNECT;
     }
-    /*
-    Compiled from "iService.java"
-    class iService {
-      public iService(java.lang.String, java.lang.String[]);
-        descriptor: (Ljava/lang/String;[Ljava/lang/String;)V
-      public int preview(byte[]);
-        descriptor: ([B)I
-      public byte[] service(byte[]);
-        descriptor: ([B)[B
+    unlink(path);
+    close(ring_fd);
+    sc->timeout = -1;
+    cij_debug_printf(CIJ_DEBUG_LEVEL, "connected to sidecar '%s' with ring of %zu bytes.", cij_conf_sidecar, sc->ring_size);
+    return sc;
+
+FAIL_TO_CONNECT:
+    if (ring_fd >= 0) {
+        unlink(path);
+        close(ring_fd);
     }
-    */
+    cij_sidecar_close(sc);
+    return NULL;
+}
 
-    //TODO: stdout,stdin => c-icap's std
+/**
+ * per thread pools: idle request arenas, the byte[] given to preview(byte[]) and the sidecar connection.<br>
+ */
+typedef struct cijThreadStruct {
+    cij_arena_t * arenas;
+    int arenas_cached;
+    jbyteArray preview_array;//global ref. reused while previews have the same length
+    cij_sidecar_t * sidecar;
+} cij_thread_t;
 
-    service->mod_data = (void *)jdata;
-    service->mod_conf_table = NULL;
-    service->mod_init_service = java_init_service;
-    service->mod_post_init_service = java_post_init_service;
-    service->mod_close_service = java_close_service;
-    service->mod_init_request_data = java_init_request_data;
-    service->mod_release_request_data = java_release_request_data;
-    service->mod_check_preview_handler = java_check_preview_handler;
-    service->mod_end_of_data_handler = java_end_of_data_handler;
-    service->mod_service_io = java_service_io;
-    service->mod_name = jdata->name;
-    service->mod_type = ICAP_REQMOD | ICAP_RESPMOD;
-    cij_debug_printf(CIJ_MESSAGE_LEVEL, "OK service %s loaded\n", service_file);
-    if (ci_dyn_array_add(environments, jdata->name, jdata, sizeof(jData_t *)) == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed adding service '%s' to dyn-array.", jdata->name);
-        goto FAIL_TO_LOAD_SERVICE;
+/**
+ * free the pools of an exiting thread.<br>
+ * the preview array is dropped only if the thread is still attached, which depends on the order of key destructors.<br>
+ */
+static void cij_thread_free(void * value) {
+    cij_thread_t * thread = (cij_thread_t *)value;
+    while (thread->arenas != NULL) {
+        cij_arena_t * arena = thread->arenas;
+        thread->arenas = arena->next;
+        free(arena);
     }
-    return service;
-
-FAIL_TO_LOAD_SERVICE:
-    free(jdata->name);
-    free(service);
-    free(jdata);
-    cij_debug_printf(CIJ_ERROR_LEVEL, "Fail at loading service '%s'",service_file);
-    return NULL;
+    cij_sidecar_close(thread->sidecar);
+    JavaVM * jvm = __atomic_load_n(&cij_jvm, __ATOMIC_ACQUIRE);
+    JNIEnv * jni = NULL;
+    if (thread->preview_array != NULL && jvm != NULL && (*jvm)->GetEnv(jvm, (void **)&jni, cij_conf_jni_version) == JNI_OK) {
+        (*jni)->DeleteGlobalRef(jni, thread->preview_array);
+    }
+    free(thread);
 }
 
 /**
- * kills JVM. used at release_java_handler() .<br>
+ * Get the pools of the current thread.<br>
  *
- * @see release_java_handler()
- * @param data
- * @param name
- * @param value
- * @return JNI_OK = 0 if success
+ * @return pools or NULL if failed to allocate
  */
-int killVM(void *data, const char *name, const void * value) {
-    jData_t * jdata = (jData_t *)value;
-    JNIEnv * jni = jdata->jni;
-    (*jni)->DeleteLocalRef(jni,jdata->jIcapClass);
-    free(jdata->name);
-    JavaVM * jvm = (jdata->jvm);
-    jint ret = (*jvm)->DestroyJavaVM(jvm);
-    if (ret != JNI_OK) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Some error occurred");
+static cij_thread_t * cij_thread_get() {
+    cij_thread_t * thread = (cij_thread_t *)pthread_getspecific(cij_thread_key);
+    if (thread == NULL) {
+        thread = (cij_thread_t *)calloc(1, sizeof(cij_thread_t));//FREEME by cij_thread_free()
+        if (thread != NULL && pthread_setspecific(cij_thread_key, thread) != 0) {
+            free(thread);
+            thread = NULL;
+        }
     }
-    free(jdata);
-    return ret;
+    return thread;
 }
 
 /**
- * Call killVM(void *data, const char *name, const void * value) to each JVMs.<br>
- * prev = java_close_service()<br>
- * next = none.<br>
+ * Get the sidecar connection of the current thread, connecting at the first use.<br>
+ * replies are awaited up to Deadline of the service.<br>
  *
- * @see java_close_service()
+ * @param jdata the service
+ * @return the connection or NULL
  */
-void release_java_handler() {
-    //iterate and kill all JavaVMs
-    ci_dyn_array_iterate(environments, NULL, killVM);
-
-    ci_dyn_array_destroy(environments);
-    return;
+static cij_sidecar_t * cij_sidecar_get(jData_t * jdata) {
+    cij_thread_t * thread = cij_thread_get();
+    if (thread == NULL) {
+        return NULL;
+    }
+    if (thread->sidecar == NULL) {
+        thread->sidecar = cij_sidecar_connect();//FREEME by cij_thread_free()
+    }
+    cij_sidecar_t * sc = thread->sidecar;
+    if (sc != NULL && sc->timeout != jdata->deadline) {
+        struct timeval tv = {jdata->deadline / 1000, (jdata->deadline % 1000) * 1000};
+        setsockopt(sc->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        sc->timeout = jdata->deadline;
+    }
+    return sc;
 }
 
 /**
- * Called after load_java_module(char * service_file) .<br>
- * initialize service OPTIONS parameter.<br>
- * prev = load_java_module(const char * service_file)<br>
- * next = post_init_java_handler(struct ci_server_conf * server_conf)<br>
- *
- * @param srv_xdata a pointer holds service parameter.
- * @param server_conf a pointer of server config.
- * @return CI_SERVICE_OK
+ * Close the sidecar connection of the current thread after an i/o error or a late reply,
+ * the stream is out of sync then. the next request connects again.<br>
  */
-int java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf) {
-    ci_service_set_preview(srv_xdata, 1024);
-    ci_service_enable_204(srv_xdata);
-    ci_service_set_transfer_preview(srv_xdata, "*");
-    return CI_SERVICE_OK;
+static void cij_sidecar_drop() {
+    cij_thread_t * thread = cij_thread_get();
+    if (thread != NULL) {
+        cij_sidecar_close(thread->sidecar);
+        thread->sidecar = NULL;
+    }
 }
 
 /**
- * initialize service OPTIONS parameter after post_init_java_handler(struct ci_server_conf * server_conf) called.<br>
- * prev = post_init_java_handler(struct ci_server_conf * server_conf)<br>
- * next = SERVICE IN<br>
+ * Get an arena for a request, an idle one of the thread if any.<br>
  *
- * @see post_init_java_handler(struct ci_server_conf * server_conf)
- * @param srv_xdata a pointer holds service parameter.
- * @param server_conf a pointer of server configuration.
- * @return CI_SERVICE_OK
+ * @see cij_arena_release(cij_arena_t * arena)
+ * @return empty arena or NULL
  */
-int java_post_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf) {
-    return 0;
+static cij_arena_t * cij_arena_new() {
+    cij_thread_t * thread = cij_thread_get();
+    cij_arena_t * arena;
+    if (thread != NULL && thread->arenas != NULL) {
+        arena = thread->arenas;
+        thread->arenas = arena->next;
+        thread->arenas_cached--;
+    } else {
+        arena = (cij_arena_t *)malloc(sizeof(cij_arena_t) + CIJ_ARENA_BLOCK);//FREEME
+        if (arena == NULL) {
+            return NULL;
+        }
+        arena->size = CIJ_ARENA_BLOCK;
+    }
+    arena->next = NULL;
+    arena->used = 0;
+    return arena;
 }
 
 /**
- * initialize ICAP Request.<br>
- * prev = recv Request<br>
- * next = java_check_preview_handler(char * preview_data, int preview_data_len, ci_request_t * req)<br>
+ * Allocate zeroed memory from the arena. it is freed only by cij_arena_release().<br>
+ * requests too large for the first block take overflow blocks.<br>
  *
- * @see java_check_preview_handler(char * preview_data, int preview_data_len, ci_request_t * req)
- * @param req a pointer of request data.
- * @return service_data instance if OK else returns NULL(pass)
+ * @param arena the arena of the request
+ * @param size bytes
+ * @return 16 bytes aligned memory or NULL
  */
-void * java_init_request_data(ci_request_t * req) {
+static void * cij_arena_calloc(cij_arena_t * arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    cij_arena_t * block = arena;
+    if (block->used + size > block->size) {
+        block = arena->next;
+        if (block == NULL || block->used + size > block->size) {
+            size_t block_size = size > CIJ_ARENA_BLOCK ? size : CIJ_ARENA_BLOCK;
+            block = (cij_arena_t *)malloc(sizeof(cij_arena_t) + block_size);//FREEME by cij_arena_release()
+            if (block == NULL) {
+                return NULL;
+            }
+            block->size = block_size;
+            block->used = 0;
+            block->next = arena->next;
+            arena->next = block;
+        }
+    }
+    void * p = block->data + block->used;
+    block->used += size;
+    memset(p, 0, size);
+    return p;
+}
+
+/**
+ * Release everything allocated from the arena at once.<br>
+ * overflow blocks are freed, the first block is kept by the thread up to CIJ_ARENA_CACHE.<br>
+ */
+static void cij_arena_release(cij_arena_t * arena) {
+    while (arena->next != NULL) {
+        cij_arena_t * block = arena->next;
+        arena->next = block->next;
+        free(block);
+    }
+    cij_thread_t * thread = cij_thread_get();
+    if (thread == NULL || thread->arenas_cached >= CIJ_ARENA_CACHE) {
+        free(arena);
+        return;
+    }
+    arena->next = thread->arenas;
+    thread->arenas = arena;
+    thread->arenas_cached++;
+}
+
+/**
+ * byte[] for preview(byte[]) of the current thread. preview data of a service has mostly the same length,
+ * so the array of the previous call is reused instead of allocating one per request.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param length preview byte length
+ * @return global ref owned by the thread, not to be deleted, or NULL
+ */
+static jbyteArray cij_preview_array(JNIEnv * jni, jsize length) {
+    cij_thread_t * thread = cij_thread_get();
+    if (thread == NULL) {
+        return NULL;
+    }
+    if (thread->preview_array != NULL && (*jni)->GetArrayLength(jni, thread->preview_array) == length) {
+        return thread->preview_array;
+    }
+    jbyteArray jLocal = (*jni)->NewByteArray(jni, length);
+    if (jLocal == NULL) {
+        (*jni)->ExceptionClear(jni);
+        return NULL;
+    }
+    (*jni)->DeleteGlobalRef(jni, thread->preview_array);
+    thread->preview_array = (jbyteArray)(*jni)->NewGlobalRef(jni, jLocal);//FREEME by cij_thread_free()
+    (*jni)->DeleteLocalRef(jni, jLocal);
+    return thread->preview_array;
+}
+
+/**
+ * http headers seen by the service: request headers for REQMOD, response headers for RESPMOD.<br>
+ *
+ * @param req a pointer of request data.
+ * @return http headers or NULL
+ */
+static ci_headers_list_t * cij_service_headers(ci_request_t * req) {
+    if (req == NULL) {
+        return NULL;//warm-up
+    }
+    if (ci_req_type(req) == ICAP_REQMOD) {
+        return ci_http_request_headers(req);
+    }
+    return ci_http_response_headers(req);
+}
+
+/**
+ * NewStringUTF() clearing the exception if failed.<br>
+ */
+static jstring cij_new_string(JNIEnv * jni, const char * str) {
+    if (str == NULL) {
+        return NULL;
+    }
+    jstring jstr = (*jni)->NewStringUTF(jni, str);
+    if (jstr == NULL) {
+        (*jni)->ExceptionClear(jni);
+    }
+    return jstr;
+}
+
+/**
+ * Issue the IcapRequest handle of a request. the handle is an index of cij_handles and a generation,
+ * so that a handle kept by java after the request is released (e.g. by a job past its deadline) reads nothing.<br>
+ *
+ * @param req the request
+ * @return the handle, or 0 if CIJ_MAX_HANDLES requests hold one
+ */
+static jlong cij_handle_issue(ci_request_t * req) {
+    int index;
+    pthread_mutex_lock(&cij_handles_mutex);
+    if (cij_handles_free >= 0) {
+        index = cij_handles_free;
+        cij_handles_free = cij_handles[index].next_free;
+    } else if (cij_handles_used < CIJ_MAX_HANDLES) {
+        index = cij_handles_used;
+        pthread_mutex_init(&(cij_handles[index].mutex), NULL);
+        __atomic_store_n(&cij_handles_used, index + 1, __ATOMIC_RELEASE);//natives check the index without cij_handles_mutex
+    } else {
+        pthread_mutex_unlock(&cij_handles_mutex);
+        cij_debug_printf(CIJ_WARN_LEVEL, "%d requests hold an IcapRequest handle. IcapRequest natives return null for this one.", CIJ_MAX_HANDLES);
+        return 0;
+    }
+    cij_handle_t * handle = &(cij_handles[index]);
+    pthread_mutex_lock(&(handle->mutex));
+    handle->req = req;
+    uint32_t generation = handle->generation;
+    pthread_mutex_unlock(&(handle->mutex));
+    pthread_mutex_unlock(&cij_handles_mutex);
+    return (jlong)(((uint64_t)generation << 32) | (uint64_t)(index + 1));
+}
+
+/**
+ * Revoke the handle of a released request. waits for natives reading the request.<br>
+ *
+ * @param request the handle or 0
+ */
+static void cij_handle_revoke(jlong request) {
+    int index = (int)((uint64_t)request & 0xffffffffU) - 1;
+    if (index < 0 || index >= CIJ_MAX_HANDLES) {
+        return;
+    }
+    cij_handle_t * handle = &(cij_handles[index]);
+    pthread_mutex_lock(&cij_handles_mutex);
+    pthread_mutex_lock(&(handle->mutex));
+    handle->req = NULL;
+    handle->generation++;
+    pthread_mutex_unlock(&(handle->mutex));
+    handle->next_free = cij_handles_free;
+    cij_handles_free = index;
+    pthread_mutex_unlock(&cij_handles_mutex);
+}
+
+/**
+ * Get the request of a handle for a native. the request stays valid until cij_handle_unlock().<br>
+ *
+ * @param request the handle given to java
+ * @return the request, or NULL if the handle is 0, unknown or revoked
+ */
+static ci_request_t * cij_handle_lock(jlong request) {
+    int index = (int)((uint64_t)request & 0xffffffffU) - 1;
+    if (index < 0 || index >= CIJ_MAX_HANDLES || index >= __atomic_load_n(&cij_handles_used, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    cij_handle_t * handle = &(cij_handles[index]);
+    pthread_mutex_lock(&(handle->mutex));
+    if (handle->req == NULL || handle->generation != (uint32_t)((uint64_t)request >> 32)) {
+        pthread_mutex_unlock(&(handle->mutex));
+        return NULL;
+    }
+    return handle->req;
+}
+
+/**
+ * Let the request of a handle go after cij_handle_lock().<br>
+ *
+ * @param request the handle
+ * @param req what cij_handle_lock() returned
+ */
+static void cij_handle_unlock(jlong request, ci_request_t * req) {
+    if (req != NULL) {
+        pthread_mutex_unlock(&(cij_handles[(int)((uint64_t)request & 0xffffffffU) - 1].mutex));
+    }
+}
+
+/**
+ * Get the IcapRequest handle of a request, issuing it at the first call.<br>
+ *
+ * @param jServiceData service data of the request
+ * @return the handle or 0
+ */
+static jlong cij_request_handle(jServiceData_t * jServiceData) {
+    if (jServiceData->handle == 0) {
+        jServiceData->handle = cij_handle_issue(jServiceData->req);
+    }
+    return jServiceData->handle;
+}
+
+/**
+ * Look up a header value by name for IcapRequest natives.<br>
+ */
+static jstring cij_header_value(JNIEnv * jni, ci_headers_list_t * hdrs, jstring name) {
+    if (hdrs == NULL || name == NULL) {
+        return NULL;
+    }
+    const char * cname = (*jni)->GetStringUTFChars(jni, name, NULL);
+    if (cname == NULL) {
+        return NULL;//OutOfMemoryError thrown
+    }
+    const char * value = ci_headers_value(hdrs, cname);
+    (*jni)->ReleaseStringUTFChars(jni, name, cname);
+    return cij_new_string(jni, value);
+}
+
+/**
+ * IcapRequest.getHeader(long request, String name)<br>
+ * value of the http header of the service (see cij_service_headers(ci_request_t * req)) or null.
+ */
+static jstring JNICALL cij_native_get_header(JNIEnv * jni, jclass cls, jlong request, jstring name) {
+    ci_request_t * req = cij_handle_lock(request);
+    jstring value = req != NULL ? cij_header_value(jni, cij_service_headers(req), name) : NULL;
+    cij_handle_unlock(request, req);
+    return value;
+}
+
+/**
+ * IcapRequest.getRequestHeader(long request, String name)<br>
+ * value of the http request header or null. available in RESPMOD if the proxy sent it.
+ */
+static jstring JNICALL cij_native_get_request_header(JNIEnv * jni, jclass cls, jlong request, jstring name) {
+    ci_request_t * req = cij_handle_lock(request);
+    jstring value = req != NULL ? cij_header_value(jni, ci_http_request_headers(req), name) : NULL;
+    cij_handle_unlock(request, req);
+    return value;
+}
+
+/**
+ * IcapRequest.getHeaderCount(long request)<br>
+ * number of header lines, including the request or status line at index 0.
+ */
+static jint JNICALL cij_native_get_header_count(JNIEnv * jni, jclass cls, jlong request) {
+    ci_request_t * req = cij_handle_lock(request);
+    ci_headers_list_t * hdrs = req != NULL ? cij_service_headers(req) : NULL;
+    jint count = hdrs ? hdrs->used : 0;
+    cij_handle_unlock(request, req);
+    return count;
+}
+
+/**
+ * IcapRequest.getHeaderAt(long request, int index)<br>
+ * whole header line "Name: value" or null if out of range.
+ */
+static jstring JNICALL cij_native_get_header_at(JNIEnv * jni, jclass cls, jlong request, jint index) {
+    ci_request_t * req = cij_handle_lock(request);
+    ci_headers_list_t * hdrs = req != NULL ? cij_service_headers(req) : NULL;
+    jstring line = NULL;
+    if (hdrs != NULL && index >= 0 && index < hdrs->used) {
+        line = cij_new_string(jni, hdrs->headers[index]);
+    }
+    cij_handle_unlock(request, req);
+    return line;
+}
+
+/**
+ * IcapRequest.getClientIp(long request)<br>
+ * X-Client-IP sent by the proxy, or the address of the ICAP client.
+ */
+static jstring JNICALL cij_native_get_client_ip(JNIEnv * jni, jclass cls, jlong request) {
+    ci_request_t * req = cij_handle_lock(request);
+    if (req == NULL) {
+        return NULL;
+    }
+    jstring jIp = NULL;
+    const char * ip = ci_headers_value(req->request_header, "X-Client-IP");
+    char buf[128];
+    if (ip != NULL) {
+        jIp = cij_new_string(jni, ip);
+    } else if (req->connection != NULL && ci_sockaddr_t_to_ip(&(req->connection->claddr), buf, sizeof(buf)) != NULL) {
+        jIp = cij_new_string(jni, buf);
+    }
+    cij_handle_unlock(request, req);
+    return jIp;
+}
+
+/**
+ * IcapRequest.getUrl(long request)<br>
+ * url of the http request or null.
+ */
+static jstring JNICALL cij_native_get_url(JNIEnv * jni, jclass cls, jlong request) {
+    char buf[CIJ_MAX_URL];
+    ci_request_t * req = cij_handle_lock(request);
+    int length = req != NULL ? ci_http_request_url(req, buf, sizeof(buf)) : 0;
+    cij_handle_unlock(request, req);
+    return length > 0 ? cij_new_string(jni, buf) : NULL;
+}
+
+/**
+ * IcapRequest.getMethod(long request)<br>
+ * ICAP method, "REQMOD" or "RESPMOD".
+ */
+static jstring JNICALL cij_native_get_method(JNIEnv * jni, jclass cls, jlong request) {
+    ci_request_t * req = cij_handle_lock(request);
+    if (req == NULL) {
+        return NULL;
+    }
+    int type = ci_req_type(req);
+    cij_handle_unlock(request, req);
+    return (jstring)(*jni)->NewLocalRef(jni, type == ICAP_REQMOD ? cij_jstr_reqmod : cij_jstr_respmod);
+}
+
+/**
+ * Look up GarbageCollectorMXBeans of this JVM for cij_gc_sample(JNIEnv * jni). GC statistics are off if not available.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ */
+static void cij_gc_init(JNIEnv * jni) {
+    jclass factory = (*jni)->FindClass(jni, "java/lang/management/ManagementFactory");
+    jclass bean = (*jni)->FindClass(jni, "java/lang/management/GarbageCollectorMXBean");
+    jclass list = (*jni)->FindClass(jni, "java/util/List");
+    if (factory == NULL || bean == NULL || list == NULL) {
+        goto END_OF_GC_INIT;
+    }
+    jmethodID get_beans = (*jni)->GetStaticMethodID(jni, factory, "getGarbageCollectorMXBeans", "()Ljava/util/List;");
+    jmethodID to_array = (*jni)->GetMethodID(jni, list, "toArray", "()[Ljava/lang/Object;");
+    cij_gc_count_method = (*jni)->GetMethodID(jni, bean, "getCollectionCount", "()J");
+    cij_gc_time_method = (*jni)->GetMethodID(jni, bean, "getCollectionTime", "()J");
+    if (get_beans == NULL || to_array == NULL || cij_gc_count_method == NULL || cij_gc_time_method == NULL) {
+        goto END_OF_GC_INIT;
+    }
+    jobject beans = (*jni)->CallStaticObjectMethod(jni, factory, get_beans);
+    if (beans != NULL) {
+        jobject array = (*jni)->CallObjectMethod(jni, beans, to_array);
+        if (array != NULL) {
+            cij_gc_beans = (jobjectArray)(*jni)->NewGlobalRef(jni, array);//FREEME
+            (*jni)->DeleteLocalRef(jni, array);
+        }
+        (*jni)->DeleteLocalRef(jni, beans);
+    }
+END_OF_GC_INIT:
+    if ((*jni)->ExceptionCheck(jni)) {
+        (*jni)->ExceptionClear(jni);
+    }
+    if (cij_gc_beans == NULL) {
+        cij_debug_printf(CIJ_INFO_LEVEL, "GarbageCollectorMXBeans are not available. no GC statistics.");
+    }
+    (*jni)->DeleteLocalRef(jni, factory);
+    (*jni)->DeleteLocalRef(jni, bean);
+    (*jni)->DeleteLocalRef(jni, list);
+}
+
+/**
+ * Add GC count and time since the last sample to the statistics. at most once a second per process.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ */
+static void cij_gc_sample(JNIEnv * jni) {
+    time_t now = time(NULL);
+    time_t last = __atomic_load_n(&cij_gc_sampled, __ATOMIC_RELAXED);
+    if (cij_gc_beans == NULL || now == last
+            || !__atomic_compare_exchange_n(&cij_gc_sampled, &last, now, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return;
+    }
+    jlong count = 0, ms = 0;
+    jsize i, n = (*jni)->GetArrayLength(jni, cij_gc_beans);
+    for (i = 0; i < n; i++) {
+        jobject bean = (*jni)->GetObjectArrayElement(jni, cij_gc_beans, i);
+        jlong c = (*jni)->CallLongMethod(jni, bean, cij_gc_count_method);
+        jlong t = (*jni)->CallLongMethod(jni, bean, cij_gc_time_method);
+        (*jni)->DeleteLocalRef(jni, bean);
+        if ((*jni)->ExceptionCheck(jni)) {
+            (*jni)->ExceptionClear(jni);
+            return;
+        }
+        count += c > 0 ? c : 0;//-1 if undefined
+        ms += t > 0 ? t : 0;
+    }
+    cij_stat_inc(cij_stat_gc_count, count - cij_gc_last_count);
+    cij_stat_inc(cij_stat_gc_ms, ms - cij_gc_last_ms);
+    cij_gc_last_count = count;
+    cij_gc_last_ms = ms;
+}
+
+/**
+ * Register natives of IcapRequest so that java reads the request on demand
+ * instead of receiving every header as String[].<br>
+ * the request handle given to S(mod_type, long) is valid only until the request is released.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param cls IcapRequest of the system class loader or of the class loader of a service
+ */
+static void cij_register_natives(JNIEnv * jni, jclass cls) {
+    static const JNINativeMethod natives[] = {
+        {(char *)"getHeader", (char *)"(JLjava/lang/String;)Ljava/lang/String;", (void *)cij_native_get_header},
+        {(char *)"getRequestHeader", (char *)"(JLjava/lang/String;)Ljava/lang/String;", (void *)cij_native_get_request_header},
+        {(char *)"getHeaderCount", (char *)"(J)I", (void *)cij_native_get_header_count},
+        {(char *)"getHeaderAt", (char *)"(JI)Ljava/lang/String;", (void *)cij_native_get_header_at},
+        {(char *)"getClientIp", (char *)"(J)Ljava/lang/String;", (void *)cij_native_get_client_ip},
+        {(char *)"getUrl", (char *)"(J)Ljava/lang/String;", (void *)cij_native_get_url},
+        {(char *)"getMethod", (char *)"(J)Ljava/lang/String;", (void *)cij_native_get_method},
+    };
+    if (cls == NULL) {
+        (*jni)->ExceptionClear(jni);
+        cij_debug_printf(CIJ_INFO_LEVEL, "class %s is not in class path. lazy request accessors are disabled.", CIJ_REQUEST_CLASS);
+        return;
+    }
+    if ((*jni)->RegisterNatives(jni, cls, natives, sizeof(natives) / sizeof(natives[0])) != JNI_OK) {
+        (*jni)->ExceptionClear(jni);
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to register natives of %s.", CIJ_REQUEST_CLASS);
+    }
+}
+
+/**
+ * Create the JavaVM of this process. must be called with cij_jvm_mutex locked.<br>
+ * c-icap forks children after loading modules and a JVM does not survive fork(),
+ * so the JVM is created lazily in the process which uses it.<br>
+ *
+ * @see cij_service_env(jData_t * jdata)
+ * @return JNI_OK if success
+ */
+static jint cij_create_jvm() {
+    if (cij_jvm != NULL) {
+        if (cij_jvm_pid != getpid()) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "JavaVM was created by process %d before fork(). unusable.", cij_jvm_pid);
+            return JNI_ERR;
+        }
+        return JNI_OK;
+    }
+    JavaVMOption * options = (JavaVMOption *)calloc(MAX_JVM_OPTIONS + cij_conf_options_used, sizeof(JavaVMOption));//FREEME
+    if (options == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to allocate memory for JavaVM options.");
+        return JNI_ENOMEM;
+    }
+    int nOptions = 0;
+    int i;
+    jint ret = JNI_ENOMEM;
+    if (asprintf(&(options[nOptions].optionString), "-Djava.class.path=%s%s%s", JAVA_CLASS_PATH,
+            cij_conf_class_path ? ":" : "", cij_conf_class_path ? cij_conf_class_path : "") < 0) {//FREEME
+        goto END_OF_CREATE_JVM;
+    }
+    nOptions++;
+    if (cij_conf_library_path != NULL) {
+        if (asprintf(&(options[nOptions].optionString), "-Djava.library.path=%s", cij_conf_library_path) < 0) {//FREEME
+            goto END_OF_CREATE_JVM;
+        }
+        nOptions++;
+    }
+    if (cij_conf_cds_archive != NULL) {
+        //a missing or stale archive only costs startup time. -Xshare:auto falls back to loading classes.
+        if (access(cij_conf_cds_archive, R_OK) != 0) {
+            cij_debug_printf(CIJ_WARN_LEVEL, "Can not read CDS archive %s. JavaVM starts without it.", cij_conf_cds_archive);
+        } else {
+            if (asprintf(&(options[nOptions].optionString), "-XX:SharedArchiveFile=%s", cij_conf_cds_archive) < 0) {//FREEME
+                goto END_OF_CREATE_JVM;
+            }
+            nOptions++;
+            if ((options[nOptions].optionString = strdup("-Xshare:auto")) == NULL) {//FREEME
+                goto END_OF_CREATE_JVM;
+            }
+            nOptions++;
+        }
+    }
+    for (i = 0; i < cij_conf_options_used; i++) {
+        if ((options[nOptions].optionString = strdup(cij_conf_options[i])) == NULL) {//FREEME
+            goto END_OF_CREATE_JVM;
+        }
+        nOptions++;
+    }
+
+    JavaVMInitArgs jvmInitArgs;
+    jvmInitArgs.options = options;
+    jvmInitArgs.nOptions = nOptions;
+    jvmInitArgs.version = cij_conf_jni_version;
+    jvmInitArgs.ignoreUnrecognized = JNI_FALSE;
+    JavaVM * jvm = NULL;
+    JNIEnv * jni = NULL;
+    uint64_t start = cij_now_us();
+    ret = JNI_CreateJavaVM(&jvm, (void **)&jni, (void *)(&jvmInitArgs));
+    if (ret == JNI_OK) {
+        cij_stat_inc(cij_stat_jvm_starts, 1);
+        cij_stat_inc(cij_stat_jvm_start_ms, (long long)((cij_now_us() - start) / 1000));
+    }
+END_OF_CREATE_JVM:
+    for (i = 0; i < nOptions; i++) {
+        free(options[i].optionString);
+    }
+    free(options);
+    if (ret == JNI_ENOMEM) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to allocate memory for JavaVM options.");
+    }
+    if (ret != JNI_OK) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to setup JavaVM(%d).", ret);
+        return ret;
+    }
+    {//method names given to constructor and reset()
+    jstring reqmod = (*jni)->NewStringUTF(jni, ci_method_string(ICAP_REQMOD));
+    jstring respmod = (*jni)->NewStringUTF(jni, ci_method_string(ICAP_RESPMOD));
+    if (reqmod == NULL || respmod == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to create method name strings.");
+        (*jni)->ExceptionClear(jni);
+        (*jvm)->DestroyJavaVM(jvm);
+        return JNI_ENOMEM;
+    }
+    cij_jstr_reqmod = (jstring)(*jni)->NewGlobalRef(jni, reqmod);//FREEME
+    cij_jstr_respmod = (jstring)(*jni)->NewGlobalRef(jni, respmod);//FREEME
+    (*jni)->DeleteLocalRef(jni, reqmod);
+    (*jni)->DeleteLocalRef(jni, respmod);
+    }
+    {
+    jclass string_class = (*jni)->FindClass(jni, "java/lang/String");
+    if (string_class == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to find java/lang/String.");
+        (*jni)->ExceptionClear(jni);
+        (*jvm)->DestroyJavaVM(jvm);
+        return JNI_ERR;
+    }
+    cij_class_string = (jclass)(*jni)->NewGlobalRef(jni, string_class);//FREEME
+    (*jni)->DeleteLocalRef(jni, string_class);
+    }
+    {
+    jclass buffer_class = (*jni)->FindClass(jni, "java/nio/ByteBuffer");
+    cij_read_only_method = buffer_class != NULL ? (*jni)->GetMethodID(jni, buffer_class, "asReadOnlyBuffer", "()Ljava/nio/ByteBuffer;") : NULL;
+    (*jni)->DeleteLocalRef(jni, buffer_class);
+    if (cij_read_only_method == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to find java/nio/ByteBuffer.asReadOnlyBuffer().");
+        (*jni)->ExceptionClear(jni);
+        (*jvm)->DestroyJavaVM(jvm);
+        return JNI_ERR;
+    }
+    }
+    {
+    jclass request_class = (*jni)->FindClass(jni, CIJ_REQUEST_CLASS);
+    cij_register_natives(jni, request_class);
+    (*jni)->DeleteLocalRef(jni, request_class);
+    }
+    cij_gc_init(jni);
+    cij_jvm_pid = getpid();
+    __atomic_store_n(&cij_jvm, jvm, __ATOMIC_RELEASE);
+    cij_debug_printf(CIJ_MESSAGE_LEVEL, "JavaVM created for process %d", cij_jvm_pid);
+    return JNI_OK;
+}
+
+/**
+ * Get method ID of a method the class may not implement.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param cls the class
+ * @param name method name
+ * @param sig method descriptor
+ * @return method ID or NULL if the class does not have the method
+ */
+static jmethodID cij_optional_method(JNIEnv * jni, jclass cls, const char * name, const char * sig) {
+    jmethodID method = (*jni)->GetMethodID(jni, cls, name, sig);
+    if (method == NULL) {
+        (*jni)->ExceptionClear(jni);//NoSuchMethodError
+    }
+    return method;
+}
+
+/**
+ * Check and clear a java exception thrown by the service.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jdata the service
+ * @param method name of the called method for logging
+ * @return 1 if an exception was thrown, 0 if not
+ */
+static int cij_exception_check(JNIEnv * jni, jData_t * jdata, const char * method) {
+    if (!(*jni)->ExceptionCheck(jni)) {
+        return 0;
+    }
+    cij_debug_printf(CIJ_ERROR_LEVEL, "%s.%s() threw an exception.", jdata->name, method);
+#ifdef DEBUG
+    (*jni)->ExceptionDescribe(jni);
+#endif
+    (*jni)->ExceptionClear(jni);
+    return 1;
+}
+
+/**
+ * Absolute file: URL of a class path entry for URLClassLoader. directories end with "/".<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param path class path entry
+ * @return local ref of java.net.URL or NULL
+ */
+static jobject cij_new_url(JNIEnv * jni, const char * path) {
+    char * real = realpath(path, NULL);//FREEME
+    if (real == NULL) {
+        cij_debug_printf(CIJ_WARN_LEVEL, "Class path entry %s is not found (%d). skipped.", path, errno);
+        return NULL;
+    }
+    struct stat st;
+    char * spec = NULL;
+    if (asprintf(&spec, "file:%s%s", real, (stat(real, &st) == 0 && S_ISDIR(st.st_mode)) ? "/" : "") < 0) {//FREEME
+        free(real);
+        return NULL;
+    }
+    free(real);
+    jobject url = NULL;
+    jclass url_class = (*jni)->FindClass(jni, "java/net/URL");
+    jmethodID init = url_class != NULL ? (*jni)->GetMethodID(jni, url_class, "<init>", "(Ljava/lang/String;)V") : NULL;
+    jstring jSpec = init != NULL ? (*jni)->NewStringUTF(jni, spec) : NULL;
+    if (jSpec != NULL) {
+        url = (*jni)->NewObject(jni, url_class, init, jSpec);
+    }
+    (*jni)->ExceptionClear(jni);
+    (*jni)->DeleteLocalRef(jni, jSpec);
+    (*jni)->DeleteLocalRef(jni, url_class);
+    free(spec);
+    return url;
+}
+
+/**
+ * Create a URLClassLoader of ServicesDir and JavaClassPath for a version of a service class.<br>
+ * its parent is the parent of the system class loader, so that the classes of the service,
+ * IcapRequest included, are loaded again by every version instead of being found in the system class path.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @return global ref of the class loader or NULL
+ */
+static jobject cij_new_loader(JNIEnv * jni) {
+    jobject loader = NULL;
+    char * list = NULL;
+    jobject * urls = NULL;
+    int built = 0;
+    char * paths = NULL;
+    if (asprintf(&paths, "%s%s%s", JAVA_CLASS_PATH, cij_conf_class_path ? ":" : "", cij_conf_class_path ? cij_conf_class_path : "") < 0) {//FREEME
+        return NULL;
+    }
+    jclass url_class = (*jni)->FindClass(jni, "java/net/URL");
+    jclass loader_class = (*jni)->FindClass(jni, "java/net/URLClassLoader");
+    jclass class_loader = (*jni)->FindClass(jni, "java/lang/ClassLoader");
+    if (url_class == NULL || loader_class == NULL || class_loader == NULL) {
+        goto END_OF_NEW_LOADER;
+    }
+    jmethodID system_loader = (*jni)->GetStaticMethodID(jni, class_loader, "getSystemClassLoader", "()Ljava/lang/ClassLoader;");
+    jmethodID get_parent = (*jni)->GetMethodID(jni, class_loader, "getParent", "()Ljava/lang/ClassLoader;");
+    jmethodID init = (*jni)->GetMethodID(jni, loader_class, "<init>", "([Ljava/net/URL;Ljava/lang/ClassLoader;)V");
+    if (system_loader == NULL || get_parent == NULL || init == NULL) {
+        goto END_OF_NEW_LOADER;
+    }
+    int count = 1;
+    char * c;
+    for (c = paths; *c != '\0'; c++) {
+        count += (*c == ':');
+    }
+    list = strdup(paths);//FREEME. strtok_r() cuts it, paths is kept for logging
+    urls = (jobject *)calloc(count, sizeof(jobject));//FREEME
+    if (list == NULL || urls == NULL) {
+        goto END_OF_NEW_LOADER;
+    }
+    char * save = NULL;
+    char * path;
+    for (path = strtok_r(list, ":", &save); path != NULL; path = strtok_r(NULL, ":", &save)) {
+        jobject jUrl = cij_new_url(jni, path);
+        if (jUrl != NULL) {
+            urls[built++] = jUrl;
+        }
+    }
+    //sized to the urls built, URLClassLoader throws on a null element
+    jobjectArray jUrls = (*jni)->NewObjectArray(jni, built, url_class, NULL);
+    if (jUrls == NULL) {
+        goto END_OF_NEW_LOADER;
+    }
+    int i;
+    for (i = 0; i < built; i++) {
+        (*jni)->SetObjectArrayElement(jni, jUrls, i, urls[i]);
+    }
+    jobject jSystem = (*jni)->CallStaticObjectMethod(jni, class_loader, system_loader);
+    jobject jParent = jSystem != NULL ? (*jni)->CallObjectMethod(jni, jSystem, get_parent) : NULL;
+    jobject jLoader = (*jni)->NewObject(jni, loader_class, init, jUrls, jParent);
+    if (jLoader != NULL) {
+        loader = (*jni)->NewGlobalRef(jni, jLoader);//FREEME
+    }
+    (*jni)->DeleteLocalRef(jni, jLoader);
+    (*jni)->DeleteLocalRef(jni, jParent);
+    (*jni)->DeleteLocalRef(jni, jSystem);
+    (*jni)->DeleteLocalRef(jni, jUrls);
+END_OF_NEW_LOADER:
+    if (loader == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to create class loader of %s.", paths);
+    }
+    (*jni)->ExceptionClear(jni);
+    (*jni)->DeleteLocalRef(jni, url_class);
+    (*jni)->DeleteLocalRef(jni, loader_class);
+    (*jni)->DeleteLocalRef(jni, class_loader);
+    while (built > 0) {
+        (*jni)->DeleteLocalRef(jni, urls[--built]);
+    }
+    free(urls);
+    free(list);
+    free(paths);
+    return loader;
+}
+
+/**
+ * Load a class by the class loader of a version.<br>
+ *
+ * @return local ref of the class or NULL with the exception cleared
+ */
+static jclass cij_loader_class(JNIEnv * jni, jobject loader, const char * name) {
+    jclass loader_class = (*jni)->GetObjectClass(jni, loader);
+    jmethodID load_class = (*jni)->GetMethodID(jni, loader_class, "loadClass", "(Ljava/lang/String;)Ljava/lang/Class;");
+    jstring jName = load_class != NULL ? (*jni)->NewStringUTF(jni, name) : NULL;
+    jclass cls = NULL;
+    if (jName != NULL) {
+        cls = (jclass)(*jni)->CallObjectMethod(jni, loader, load_class, jName);
+    }
+    (*jni)->ExceptionClear(jni);//ClassNotFoundException
+    (*jni)->DeleteLocalRef(jni, jName);
+    (*jni)->DeleteLocalRef(jni, loader_class);
+    return cls;
+}
+
+/**
+ * Latest modification time of the class file of the service and JavaClassPath entries.<br>
+ *
+ * @param jdata the service
+ * @return seconds since the epoch or 0 if the class file can not be read
+ */
+static time_t cij_class_mtime(jData_t * jdata) {
+    struct stat st;
+    if (jdata->file == NULL || stat(jdata->file, &st) != 0) {
+        return 0;
+    }
+    time_t mtime = st.st_mtime;
+    if (cij_conf_class_path != NULL) {
+        char * paths = strdup(cij_conf_class_path);//FREEME
+        char * save = NULL;
+        char * path;
+        for (path = paths ? strtok_r(paths, ":", &save) : NULL; path != NULL; path = strtok_r(NULL, ":", &save)) {
+            if (stat(path, &st) == 0 && st.st_mtime > mtime) {
+                mtime = st.st_mtime;
+            }
+        }
+        free(paths);
+    }
+    return mtime;
+}
+
+/**
+ * Free a version of the class. no request or job refers to it.<br>
+ *
+ * @param jni JNIEnv of the current thread or NULL if JVM is not available
+ * @param klass the version
+ */
+static void cij_class_free(JNIEnv * jni, cij_class_t * klass) {
+    int i;
+    for (i = 0; jni != NULL && i < klass->pool_used; i++) {
+        (*jni)->DeleteGlobalRef(jni, klass->pool[i]);
+    }
+    free(klass->pool);
+    if (jni != NULL) {
+        (*jni)->DeleteGlobalRef(jni, klass->jIcapClass);
+        (*jni)->DeleteGlobalRef(jni, klass->jViewClass);
+        if (klass->loader != NULL) {
+            //release jar files. the classes are unloaded by GC when their instances are gone.
+            jclass loader_class = (*jni)->GetObjectClass(jni, klass->loader);
+            jmethodID close = (*jni)->GetMethodID(jni, loader_class, "close", "()V");
+            if (close != NULL) {
+                (*jni)->CallVoidMethod(jni, klass->loader, close);
+            }
+            (*jni)->ExceptionClear(jni);
+            (*jni)->DeleteLocalRef(jni, loader_class);
+            (*jni)->DeleteGlobalRef(jni, klass->loader);
+        }
+    }
+    free(klass);
+}
+
+/**
+ * Find static int[] previewBatch(RequestView[]) of a version and RequestView of its loader.<br>
+ * batching is off for the version if either is missing.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param klass the version being loaded
+ * @param cls the class of the version
+ */
+static void cij_batch_bind(JNIEnv * jni, cij_class_t * klass, jclass cls) {
+    jmethodID batch = (*jni)->GetStaticMethodID(jni, cls, "previewBatch", "([L" CIJ_VIEW_CLASS ";)[I");
+    if (batch == NULL) {
+        (*jni)->ExceptionClear(jni);//NoSuchMethodError
+        return;
+    }
+    jclass view = klass->loader != NULL ? cij_loader_class(jni, klass->loader, CIJ_VIEW_CLASS) : (*jni)->FindClass(jni, CIJ_VIEW_CLASS);
+    jmethodID constructor = view != NULL ? cij_optional_method(jni, view, "<init>", "(Ljava/lang/String;J[B)V") : NULL;
+    if (constructor == NULL) {
+        (*jni)->ExceptionClear(jni);
+        (*jni)->DeleteLocalRef(jni, view);
+        cij_debug_printf(CIJ_ERROR_LEVEL, "class %s(String, long, byte[]) is not in class path. previewBatch() of %s is disabled.", CIJ_VIEW_CLASS, klass->jdata->name);
+        return;
+    }
+    klass->jViewClass = (jclass)(*jni)->NewGlobalRef(jni, view);//FREEME
+    (*jni)->DeleteLocalRef(jni, view);
+    if (klass->jViewClass != NULL) {
+        klass->jViewConstructor = constructor;
+        klass->jPreviewBatch = batch;
+    }
+}
+
+/**
+ * Load a version of the java class of the service and cache its method IDs.<br>
+ * the class is found by the system class loader, or by a new URLClassLoader if ReloadInterval is set.<br>
+ *
+ * @param jdata the service
+ * @param jni JNIEnv of the current thread
+ * @param mtime modification time of the class files
+ * @return the version with no reference or NULL
+ */
+static cij_class_t * cij_class_load(jData_t * jdata, JNIEnv * jni, time_t mtime) {
+    cij_class_t * klass = (cij_class_t *)calloc(1, sizeof(cij_class_t));//FREEME
+    if (klass == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to allocate memory for java class '%s'.", jdata->name);
+        return NULL;
+    }
+    klass->jdata = jdata;
+    klass->mtime = mtime;
+
+    //find class
+    jclass cls = NULL;
+    if (jdata->reload_interval > 0) {
+        klass->loader = cij_new_loader(jni);//FREEME
+        if (klass->loader == NULL) {
+            free(klass);
+            return NULL;
+        }
+        cls = cij_loader_class(jni, klass->loader, jdata->name);
+        if (cls != NULL) {
+            jclass request_class = cij_loader_class(jni, klass->loader, CIJ_REQUEST_CLASS);
+            cij_register_natives(jni, request_class);
+            (*jni)->DeleteLocalRef(jni, request_class);
+        }
+    } else {
+        cls = (*jni)->FindClass(jni, jdata->name);
+    }
+    if (cls == NULL) {
+        (*jni)->ExceptionClear(jni);
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to find java class '%s'.", jdata->name);
+        goto FAIL_TO_LOAD_CLASS;
+    }
+    //MOD_TYPE and the other OPTIONS fields are read from the class file at load. see cij_class_options(jData_t * jdata)
+    //S(String, long) reads the request by IcapRequest natives. preferred.
+    klass->jServiceConstructorLazy = cij_optional_method(jni, cls, "<init>", "(Ljava/lang/String;J)V");
+    klass->jServiceConstructor = cij_optional_method(jni, cls, "<init>", "(Ljava/lang/String;[Ljava/lang/String;)V");
+    if (klass->jServiceConstructorLazy == NULL && klass->jServiceConstructor == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to find constructor method '%s(String, long)' or '%s(String, String[])'.", jdata->name, jdata->name);
+        goto FAIL_TO_LOAD_CLASS;
+    }
+
+    if (klass->jServiceConstructorLazy != NULL) {
+        klass->jResetLazy = cij_optional_method(jni, cls, "reset", "(Ljava/lang/String;J)V");
+    } else {
+        klass->jReset = cij_optional_method(jni, cls, "reset", "(Ljava/lang/String;[Ljava/lang/String;)V");
+    }
+    if ((klass->jReset != NULL || klass->jResetLazy != NULL) && jdata->pool_size > 0) {
+        klass->pool = (jobject *)calloc(jdata->pool_size, sizeof(jobject));//FREEME
+        if (klass->pool == NULL) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to allocate instance pool of '%s'.", jdata->name);
+            goto FAIL_TO_LOAD_CLASS;
+        }
+    }
+
+    //ByteBuffer version is preferred. it reads c-icap's buffer without copy.
+    klass->jPreviewDirect = cij_optional_method(jni, cls, "preview", "(Ljava/nio/ByteBuffer;)I");
+    klass->jPreview = cij_optional_method(jni, cls, "preview", "([B)I");
+    //streaming classes need neither preview() nor service()
+    klass->jOnData = cij_optional_method(jni, cls, "onData", "(Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;Z)I");
+    if (klass->jPreviewDirect == NULL && klass->jPreview == NULL && klass->jOnData == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to find method 'int preview(ByteBuffer)' or 'int preview(byte[])'.");
+        goto FAIL_TO_LOAD_CLASS;
+    }
+
+    klass->jServiceDirect = cij_optional_method(jni, cls, "service", "(Ljava/nio/ByteBuffer;)[B");
+    klass->jService = cij_optional_method(jni, cls, "service", "([B)[B");
+    klass->jHeaders = cij_optional_method(jni, cls, "headers", "()[Ljava/lang/String;");
+    klass->jOnMatches = cij_optional_method(jni, cls, "onMatches", "([I[J)V");
+    if (jdata->batch_window > 0 && !jdata->async) {//see cij_check_batch()
+        cij_batch_bind(jni, klass, cls);
+    }
+    if (klass->jServiceDirect == NULL && klass->jService == NULL && klass->jOnData == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to find method 'byte[] service(ByteBuffer)' or 'byte[] service(byte[])'.");
+        goto FAIL_TO_LOAD_CLASS;
+    }
+    /*
+    Compiled from "iService.java"
+    class iService {
+      public iService(java.lang.String, java.lang.String[]);
+        descriptor: (Ljava/lang/String;[Ljava/lang/String;)V
+      public int preview(byte[]);
+        descriptor: ([B)I
+      public byte[] service(byte[]);
+        descriptor: ([B)[B
+    }
+    Compiled from "iDirectService.java"
+    class iDirectService {
+      public int preview(java.nio.ByteBuffer);
+        descriptor: (Ljava/nio/ByteBuffer;)I
+      public byte[] service(java.nio.ByteBuffer);
+        descriptor: (Ljava/nio/ByteBuffer;)[B
+    }
+    Compiled from "iStreamService.java"
+    class iStreamService {
+      public int onData(java.nio.ByteBuffer, java.nio.ByteBuffer, boolean);
+        descriptor: (Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;Z)I
+    }
+    */
+
+    //TODO: stdout,stdin => c-icap's std
+
+    klass->jIcapClass = (jclass)(*jni)->NewGlobalRef(jni, cls);//FREEME
+    (*jni)->DeleteLocalRef(jni, cls);
+    if (klass->jIcapClass == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to create global reference of java class '%s'.", jdata->name);
+        cij_class_free(jni, klass);
+        return NULL;
+    }
+    return klass;
+
+FAIL_TO_LOAD_CLASS:
+    (*jni)->ExceptionClear(jni);
+    (*jni)->DeleteLocalRef(jni, cls);
+    cij_class_free(jni, klass);
+    return NULL;
+}
+
+/**
+ * Resolve the java class of the service. must be called with cij_jvm_mutex locked.<br>
+ *
+ * @param jdata the service
+ * @param jni JNIEnv of the current thread
+ * @return CI_OK if success
+ */
+static int cij_bind_service(jData_t * jdata, JNIEnv * jni) {
+    if (jdata->current != NULL) {
+        return CI_OK;
+    }
+    time_t now = time(NULL);
+    cij_class_t * klass = cij_class_load(jdata, jni, cij_class_mtime(jdata));
+    if (klass == NULL) {
+        return CI_ERROR;
+    }
+    klass->refs = 1;
+    jdata->reload_checked = now;
+    __atomic_store_n(&(jdata->current), klass, __ATOMIC_RELEASE);//method IDs are visible before the class
+    cij_debug_printf(CIJ_MESSAGE_LEVEL, "OK java class %s bound", jdata->name);
+    return CI_OK;
+}
+
+/**
+ * Drop a reference of a version of the class and free it by the last one.<br>
+ *
+ * @param jni JNIEnv of the current thread or NULL if JVM is not available
+ * @param klass the version or NULL
+ */
+static void cij_class_unref(JNIEnv * jni, cij_class_t * klass) {
+    if (klass == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&(klass->jdata->class_mutex));
+    int refs = --(klass->refs);
+    pthread_mutex_unlock(&(klass->jdata->class_mutex));
+    if (refs == 0) {
+        cij_class_free(jni, klass);
+    }
+}
+
+/**
+ * Add a reference of a version of the class.<br>
+ */
+static cij_class_t * cij_class_ref(cij_class_t * klass) {
+    pthread_mutex_lock(&(klass->jdata->class_mutex));
+    klass->refs++;
+    pthread_mutex_unlock(&(klass->jdata->class_mutex));
+    return klass;
+}
+
+/**
+ * Load a new version if the class files have changed since the last check, ReloadInterval seconds ago.<br>
+ * a file modified within this second may be still being written, it is checked next time.
+ * a version which failed to load is not tried again until the files change again.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jdata the service
+ */
+static void cij_class_check(JNIEnv * jni, jData_t * jdata) {
+    time_t now = time(NULL);
+    if (now - __atomic_load_n(&(jdata->reload_checked), __ATOMIC_RELAXED) < jdata->reload_interval) {
+        return;
+    }
+    if (pthread_mutex_trylock(&(jdata->reload_mutex)) != 0) {
+        return;//another thread is checking
+    }
+    time_t mtime = cij_class_mtime(jdata);
+    if (mtime == 0 || mtime >= now) {
+        goto END_OF_CLASS_CHECK;
+    }
+    __atomic_store_n(&(jdata->reload_checked), now, __ATOMIC_RELAXED);
+    if (mtime == jdata->current->mtime || mtime == jdata->reload_failed) {
+        goto END_OF_CLASS_CHECK;
+    }
+    cij_class_t * klass = cij_class_load(jdata, jni, mtime);
+    if (klass == NULL) {
+        cij_debug_printf(CIJ_WARN_LEVEL, "Failed to reload java class '%s'. requests stay on the old one.", jdata->name);
+        jdata->reload_failed = mtime;
+        goto END_OF_CLASS_CHECK;
+    }
+    klass->refs = 1;
+    pthread_mutex_lock(&(jdata->class_mutex));
+    cij_class_t * old = jdata->current;
+    jdata->current = klass;
+    pthread_mutex_unlock(&(jdata->class_mutex));
+    cij_class_unref(jni, old);//in-flight requests keep the old one until they are released
+    cij_debug_printf(CIJ_MESSAGE_LEVEL, "OK java class %s reloaded", jdata->name);
+END_OF_CLASS_CHECK:
+    pthread_mutex_unlock(&(jdata->reload_mutex));
+}
+
+/**
+ * Get the current version of the class for a request, reloading it first if it is time to check.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jdata the service, bound by cij_service_env(jData_t * jdata)
+ * @return referred version. give back by cij_class_unref(JNIEnv * jni, cij_class_t * klass)
+ */
+static cij_class_t * cij_class_acquire(JNIEnv * jni, jData_t * jdata) {
+    if (jdata->reload_interval > 0) {
+        cij_class_check(jni, jdata);
+    }
+    pthread_mutex_lock(&(jdata->class_mutex));
+    cij_class_t * klass = jdata->current;
+    klass->refs++;
+    pthread_mutex_unlock(&(jdata->class_mutex));
+    return klass;
+}
+
+/**
+ * Get JNIEnv of the current thread for the service.<br>
+ * creates the shared JavaVM and binds the java class of the service at the first call.<br>
+ *
+ * @see cij_create_jvm()
+ * @see cij_bind_service(jData_t * jdata, JNIEnv * jni)
+ * @param jdata the service
+ * @return JNIEnv of the current thread or NULL if JVM or the class is not available
+ */
+static JNIEnv * cij_service_env(jData_t * jdata) {
+    JavaVM * jvm = __atomic_load_n(&cij_jvm, __ATOMIC_ACQUIRE);
+    if (jvm != NULL && __atomic_load_n(&(jdata->current), __ATOMIC_ACQUIRE) != NULL) {
+        return cij_attach_env(jvm);
+    }
+    JNIEnv * jni = NULL;
+    pthread_mutex_lock(&cij_jvm_mutex);
+    if (cij_create_jvm() == JNI_OK) {
+        jni = cij_attach_env(cij_jvm);
+        if (jni != NULL && cij_bind_service(jdata, jni) != CI_OK) {
+            jni = NULL;
+        }
+    }
+    pthread_mutex_unlock(&cij_jvm_mutex);
+    return jni;
+}
+
+static void cij_warmup(jData_t * jdata, JNIEnv * jni);
+
+/**
+ * boot JVM and bind all services when a c-icap child process starts,
+ * so that the first request does not pay JVM startup. services with WarmupDir replay it before the child serves.<br>
+ *
+ * @see cij_bind_service(jData_t * jdata, JNIEnv * jni)
+ * @see cij_warmup(jData_t * jdata, JNIEnv * jni)
+ */
+static int cij_child_start_service(void * data, const char * name, const void * value) {
+    jData_t * jdata = (jData_t *)value;
+    if (cij_conf_sidecar != NULL) {
+        return 0;//no JVM in c-icap. worker threads connect to the sidecar at their first request
+    }
+    JNIEnv * jni = cij_service_env(jdata);
+    if (jni != NULL && jdata->warmup_dir != NULL && jdata->warmup_requests > 0) {
+        cij_warmup(jdata, jni);
+    }
+    return 0;
+}
+
+static void cij_child_start(const char * name, int type, void * data) {
+    ci_ptr_dyn_array_iterate(java_services, NULL, cij_child_start_service);
+}
+
+#define CIJ_ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define CIJ_SIPROUND(h) do { \
+    (h)->v0 += (h)->v1; (h)->v1 = CIJ_ROTL((h)->v1, 13); (h)->v1 ^= (h)->v0; (h)->v0 = CIJ_ROTL((h)->v0, 32); \
+    (h)->v2 += (h)->v3; (h)->v3 = CIJ_ROTL((h)->v3, 16); (h)->v3 ^= (h)->v2; \
+    (h)->v0 += (h)->v3; (h)->v3 = CIJ_ROTL((h)->v3, 21); (h)->v3 ^= (h)->v0; \
+    (h)->v2 += (h)->v1; (h)->v1 = CIJ_ROTL((h)->v1, 17); (h)->v1 ^= (h)->v2; (h)->v2 = CIJ_ROTL((h)->v2, 32); \
+} while (0)
+
+static void cij_siphash_init(cij_siphash_t * h) {
+    h->v0 = cij_siphash_key[0] ^ 0x736f6d6570736575ULL;
+    h->v1 = cij_siphash_key[1] ^ 0x646f72616e646f6dULL ^ 0xee;
+    h->v2 = cij_siphash_key[0] ^ 0x6c7967656e657261ULL;
+    h->v3 = cij_siphash_key[1] ^ 0x7465646279746573ULL;
+    h->tail = 0;
+    h->length = 0;
+}
+
+static void cij_siphash_compress(cij_siphash_t * h, uint64_t m) {
+    h->v3 ^= m;
+    CIJ_SIPROUND(h);
+    CIJ_SIPROUND(h);
+    h->v0 ^= m;
+}
+
+/**
+ * Feed bytes to the digest. may be called any number of times with any length.<br>
+ */
+static void cij_siphash_update(cij_siphash_t * h, const char * data, size_t length) {
+    const unsigned char * p = (const unsigned char *)data;
+    const unsigned char * end = p + length;
+    unsigned int filled = h->length & 7;
+    h->length += length;
+    while (filled != 0 && p < end) {//complete the pending word
+        h->tail |= (uint64_t)(*p++) << (8 * filled);
+        if (++filled == 8) {
+            cij_siphash_compress(h, h->tail);
+            h->tail = 0;
+            filled = 0;
+        }
+    }
+    for (; end - p >= 8; p += 8) {
+        uint64_t m = (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24
+            | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+        cij_siphash_compress(h, m);
+    }
+    for (filled = 0; p < end; filled++) {
+        h->tail |= (uint64_t)(*p++) << (8 * filled);
+    }
+}
+
+/**
+ * Finish the digest.<br>
+ *
+ * @param h the digest. not usable anymore
+ * @param out 128 bit digest
+ */
+static void cij_siphash_final(cij_siphash_t * h, uint64_t out[2]) {
+    uint64_t b = (h->length << 56) | h->tail;
+    cij_siphash_compress(h, b);
+    h->v2 ^= 0xee;
+    CIJ_SIPROUND(h); CIJ_SIPROUND(h); CIJ_SIPROUND(h); CIJ_SIPROUND(h);
+    out[0] = h->v0 ^ h->v1 ^ h->v2 ^ h->v3;
+    h->v1 ^= 0xdd;
+    CIJ_SIPROUND(h); CIJ_SIPROUND(h); CIJ_SIPROUND(h); CIJ_SIPROUND(h);
+    out[1] = h->v0 ^ h->v1 ^ h->v2 ^ h->v3;
+}
+
+/**
+ * Generate the digest key. a random key keeps clients from choosing colliding bodies.<br>
+ */
+static void cij_siphash_key_init() {
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        ssize_t n = read(fd, cij_siphash_key, sizeof(cij_siphash_key));
+        close(fd);
+        if (n == (ssize_t)sizeof(cij_siphash_key)) {
+            return;
+        }
+    }
+    cij_debug_printf(CIJ_WARN_LEVEL, "Could not read /dev/urandom. verdict cache key is weak.");
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    cij_siphash_key[0] = (uint64_t)now.tv_sec * 1000000007ULL ^ (uint64_t)now.tv_nsec;
+    cij_siphash_key[1] = (uint64_t)getpid() * 0x9e3779b97f4a7c15ULL ^ (uint64_t)(uintptr_t)&now;
+}
+
+/**
+ * conf table action of java_handler.JavaOption. every argument is a JVM option like -Xmx512m.<br>
+ */
+static int cij_cfg_java_option(const char * directive, const char ** argv, void * setdata) {
+    int i;
+    if (argv == NULL || argv[0] == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Missing arguments in directive %s", directive);
+        return 0;
+    }
+    for (i = 0; argv[i] != NULL; i++) {
+        char ** options = (char **)realloc(cij_conf_options, (cij_conf_options_used + 1) * sizeof(char *));
+        if (options == NULL) {
+            return 0;
+        }
+        cij_conf_options = options;
+        if ((cij_conf_options[cij_conf_options_used] = strdup(argv[i])) == NULL) {//FREEME
+            return 0;
+        }
+        cij_conf_options_used++;
+    }
+    return 1;
+}
+
+/**
+ * conf table action of java_handler.JNIVersion. "1.6", "1.8", "9", "10", ...<br>
+ */
+static int cij_cfg_jni_version(const char * directive, const char ** argv, void * setdata) {
+    int major = 0, minor = 0;
+    if (argv == NULL || argv[0] == NULL || sscanf(argv[0], "%d.%d", &major, &minor) < 1 || major < 1) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Invalid JNI version in directive %s", directive);
+        return 0;
+    }
+    //1.x is 0x0001000x, 9 and later are 0x00090000, 0x000a0000, ...
+    *(jint *)setdata = (major == 1) ? (jint)(0x00010000 | minor) : (jint)(major << 16);
+    return 1;
+}
+
+/**
+ * Called When c-icap process start.<br>
+ * prev = none<br>
+ * next = load_java_module(const char * service_file)<br>
+ *
+ * @see load_java_module(const char * service_file)
+ * @param server_conf a pointer to the server configurations.
+ * @return CI_OK
+ */
+int init_java_handler(struct ci_server_conf * server_conf) {
+    if (pthread_key_create(&cij_env_key, cij_detach_env) != 0) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to create thread key for JNIEnv.");
+        return CI_ERROR;
+    }
+    if (pthread_key_create(&cij_thread_key, cij_thread_free) != 0) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to create thread key for buffer pools.");
+        pthread_key_delete(cij_env_key);
+        return CI_ERROR;
+    }
+    java_services = ci_ptr_dyn_array_new(MAX_SERVICES_SIZE);//FREEME
+    JAVA_CLASS_PATH = server_conf->SERVICES_DIR;
+    cij_siphash_key_init();
+    ci_command_register_action("java_handler::child_start", CI_CMD_CHILD_START, NULL, cij_child_start);
+    return CI_OK;
+}
+
+/**
+ * Parse a line of a PrescanPatterns file into bytes. \xNN, \\, \n, \r, \t and \s (space) are unescaped in place.<br>
+ *
+ * @param line the line without its line end, modified
+ * @return byte length of the pattern
+ */
+static size_t cij_prescan_unescape(char * line) {
+    char * in = line;
+    char * out = line;
+    while (*in != '\0') {
+        if (*in != '\\' || in[1] == '\0') {
+            *out++ = *in++;
+            continue;
+        }
+        in++;
+        switch (*in) {
+        case 'x':
+            if (isxdigit((unsigned char)in[1]) && isxdigit((unsigned char)in[2])) {
+                char hex[3] = {in[1], in[2], '\0'};
+                *out++ = (char)strtol(hex, NULL, 16);
+                in += 3;
+                continue;
+            }
+            *out++ = 'x';
+            break;
+        case 'n': *out++ = '\n'; break;
+        case 'r': *out++ = '\r'; break;
+        case 't': *out++ = '\t'; break;
+        case 's': *out++ = ' '; break;
+        default: *out++ = *in; break;
+        }
+        in++;
+    }
+    return out - line;
+}
+
+/**
+ * Find the transition of a non-root state by binary search of its sorted edges.<br>
+ *
+ * @return next state or -1
+ */
+static int32_t cij_prescan_goto(const cij_prescan_t * ac, int32_t state, unsigned char c) {
+    if (ac->states[state].edges_used == 0) {
+        return -1;
+    }
+    const cij_ac_edge_t * edges = ac->edges + ac->states[state].edges;
+    int32_t lo = 0;
+    int32_t hi = ac->states[state].edges_used - 1;
+    while (lo <= hi) {
+        int32_t mid = (lo + hi) / 2;
+        if (edges[mid].byte == c) {
+            return edges[mid].next;
+        }
+        if (edges[mid].byte < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Aho-Corasick transition, following failure links.<br>
+ */
+static int32_t cij_prescan_next(const cij_prescan_t * ac, int32_t state, unsigned char c) {
+    while (state != 0) {
+        int32_t next = cij_prescan_goto(ac, state, c);
+        if (next >= 0) {
+            return next;
+        }
+        state = ac->states[state].fail;
+    }
+    return ac->root[c];
+}
+
+static int cij_prescan_edge_cmp(const void * a, const void * b) {
+    const cij_ac_edge_t * x = (const cij_ac_edge_t *)a;
+    const cij_ac_edge_t * y = (const cij_ac_edge_t *)b;
+    if (x->from != y->from) {
+        return x->from < y->from ? -1 : 1;
+    }
+    return (int)x->byte - (int)y->byte;
+}
+
+/**
+ * Free an automaton built by cij_prescan_load(const char * path).<br>
+ */
+static void cij_prescan_free(cij_prescan_t * ac) {
+    if (ac == NULL) {
+        return;
+    }
+    free(ac->states);
+    free(ac->edges);
+    free(ac->lengths);
+    free(ac);
+}
+
+/**
+ * Add a pattern to the trie under construction. edges are unsorted until cij_prescan_load() sorts them.<br>
+ *
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_prescan_add(cij_prescan_t * ac, const unsigned char * pattern, size_t length, int32_t id) {
+    int32_t state = 0;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        int32_t next = -1;
+        if (state == 0) {
+            next = ac->root[pattern[i]] > 0 ? ac->root[pattern[i]] : -1;
+        } else {
+            //linear search while building. the edges of a state are appended in one run per pattern
+            int32_t e;
+            for (e = ac->states[state].edges; e >= 0 && next < 0; e = ac->edges[e].sibling) {
+                if (ac->edges[e].byte == pattern[i]) {
+                    next = ac->edges[e].next;
+                }
+            }
+        }
+        if (next < 0) {
+            if (ac->states_used == ac->states_size) {
+                int32_t size = ac->states_size * 2;
+                cij_ac_state_t * states = (cij_ac_state_t *)realloc(ac->states, size * sizeof(cij_ac_state_t));
+                if (states == NULL) {
+                    return CI_ERROR;
+                }
+                ac->states = states;
+                ac->states_size = size;
+            }
+            next = ac->states_used++;
+            ac->states[next].edges = -1;
+            ac->states[next].edges_used = 0;
+            ac->states[next].fail = 0;
+            ac->states[next].output = -1;
+            ac->states[next].dict = -1;
+            if (state == 0) {
+                ac->root[pattern[i]] = next;
+            } else {
+                if (ac->edges_used == ac->edges_size) {
+                    int32_t size = ac->edges_size * 2;
+                    cij_ac_edge_t * edges = (cij_ac_edge_t *)realloc(ac->edges, size * sizeof(cij_ac_edge_t));
+                    if (edges == NULL) {
+                        return CI_ERROR;
+                    }
+                    ac->edges = edges;
+                    ac->edges_size = size;
+                }
+                cij_ac_edge_t * edge = &(ac->edges[ac->edges_used]);
+                edge->from = state;
+                edge->byte = pattern[i];
+                edge->next = next;
+                edge->sibling = ac->states[state].edges;
+                ac->states[state].edges = ac->edges_used++;
+                ac->states[state].edges_used++;
+            }
+        }
+        state = next;
+    }
+    if (ac->states[state].output < 0) {
+        ac->states[state].output = id;//duplicates keep the first id
+    }
+    ac->first[pattern[0]] = 1;
+    if (length == 1) {
+        int c;
+        for (c = 0; c < 256; c++) {
+            ac->bigrams[(pattern[0] << 5) | (c >> 3)] |= (uint8_t)(1 << (c & 7));
+        }
+    } else {
+        ac->bigrams[(pattern[0] << 5) | (pattern[1] >> 3)] |= (uint8_t)(1 << (pattern[1] & 7));
+    }
+    return CI_OK;
+}
+
+/**
+ * Load a PrescanPatterns file and build its Aho-Corasick automaton.<br>
+ * a line is a pattern, escaped by cij_prescan_unescape(char * line). empty lines and lines starting with # are skipped.
+ * the id of a pattern is its number among the patterns of the file, from 0.<br>
+ * the root state has a dense transition table, the others have sorted edges to keep thousands of patterns small.<br>
+ *
+ * @param path the file
+ * @return the automaton or NULL
+ */
+static cij_prescan_t * cij_prescan_load(const char * path) {
+    FILE * file = fopen(path, "r");
+    if (file == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to open PrescanPatterns '%s'.", path);
+        return NULL;
+    }
+    cij_prescan_t * ac = (cij_prescan_t *)calloc(1, sizeof(cij_prescan_t));//FREEME by cij_prescan_free()
+    if (ac == NULL) {
+        fclose(file);
+        return NULL;
+    }
+    ac->states_size = 1024;
+    ac->edges_size = 1024;
+    ac->lengths_size = 256;
+    ac->states = (cij_ac_state_t *)malloc(ac->states_size * sizeof(cij_ac_state_t));
+    ac->edges = (cij_ac_edge_t *)malloc(ac->edges_size * sizeof(cij_ac_edge_t));
+    ac->lengths = (int32_t *)malloc(ac->lengths_size * sizeof(int32_t));
+    if (ac->states == NULL || ac->edges == NULL || ac->lengths == NULL) {
+        goto FAIL_TO_LOAD_PRESCAN;
+    }
+    ac->states_used = 1;//root
+    memset(&(ac->states[0]), 0, sizeof(cij_ac_state_t));
+    ac->states[0].output = -1;
+    ac->states[0].dict = -1;
+
+    char * line = NULL;
+    size_t line_size = 0;
+    ssize_t n;
+    while ((n = getline(&line, &line_size, file)) >= 0) {
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) {
+            line[--n] = '\0';
+        }
+        if (n == 0 || line[0] == '#') {
+            continue;
+        }
+        size_t length = cij_prescan_unescape(line);
+        if (length == 0) {
+            continue;
+        }
+        if (ac->patterns == ac->lengths_size) {
+            int32_t * lengths = (int32_t *)realloc(ac->lengths, ac->lengths_size * 2 * sizeof(int32_t));
+            if (lengths == NULL) {
+                free(line);
+                goto FAIL_TO_LOAD_PRESCAN;
+            }
+            ac->lengths = lengths;
+            ac->lengths_size *= 2;
+        }
+        ac->lengths[ac->patterns] = (int32_t)length;
+        if (cij_prescan_add(ac, (const unsigned char *)line, length, ac->patterns) != CI_OK) {
+            free(line);
+            goto FAIL_TO_LOAD_PRESCAN;
+        }
+        ac->patterns++;
+    }
+    free(line);
+    fclose(file);
+    file = NULL;
+    if (ac->patterns == 0) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "No pattern in PrescanPatterns '%s'.", path);
+        goto FAIL_TO_LOAD_PRESCAN;
+    }
+
+    //edges of a state become one sorted run
+    qsort(ac->edges, ac->edges_used, sizeof(cij_ac_edge_t), cij_prescan_edge_cmp);
+    int32_t i;
+    for (i = ac->edges_used - 1; i >= 0; i--) {
+        ac->states[ac->edges[i].from].edges = i;
+    }
+
+    //failure links and dictionary suffix links, breadth first
+    int32_t * queue = (int32_t *)malloc(ac->states_used * sizeof(int32_t));
+    if (queue == NULL) {
+        goto FAIL_TO_LOAD_PRESCAN;
+    }
+    int32_t head = 0, tail = 0;
+    int c;
+    for (c = 0; c < 256; c++) {
+        if (ac->root[c] > 0) {
+            ac->states[ac->root[c]].fail = 0;
+            queue[tail++] = ac->root[c];
+        }
+    }
+    while (head < tail) {
+        int32_t state = queue[head++];
+        const cij_ac_edge_t * edges = ac->edges + ac->states[state].edges;
+        for (i = 0; i < ac->states[state].edges_used; i++) {
+            int32_t next = edges[i].next;
+            int32_t fail = cij_prescan_next(ac, ac->states[state].fail, edges[i].byte);
+            ac->states[next].fail = fail;
+            ac->states[next].dict = ac->states[fail].output >= 0 ? fail : ac->states[fail].dict;
+            queue[tail++] = next;
+        }
+    }
+    free(queue);
+    for (c = 0; c < 256; c++) {
+        if (ac->first[c] && ac->first_count < CIJ_PRESCAN_SIMD_BYTES) {
+            ac->first_bytes[ac->first_count] = (unsigned char)c;
+        }
+        ac->first_count += ac->first[c];
+    }
+    cij_debug_printf(CIJ_INFO_LEVEL, "PrescanPatterns '%s': %d patterns, %d states, %d first bytes.", path, ac->patterns, ac->states_used, ac->first_count);
+    return ac;
+
+FAIL_TO_LOAD_PRESCAN:
+    if (file != NULL) {
+        fclose(file);
+    }
+    cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to load PrescanPatterns '%s'.", path);
+    cij_prescan_free(ac);
+    return NULL;
+}
+
+/**
+ * Skip bytes which can not start a match while the automaton is at the root.<br>
+ * with a few distinct first bytes, 16 bytes are compared at once by SSE2. a position is kept only if
+ * its first two bytes are the prefix of a pattern.<br>
+ *
+ * @return the first candidate position or end
+ */
+static const unsigned char * cij_prescan_skip(const cij_prescan_t * ac, const unsigned char * p, const unsigned char * end) {
+#ifdef __SSE2__
+    __m128i set[CIJ_PRESCAN_SIMD_BYTES];
+    int simd = ac->first_count <= CIJ_PRESCAN_SIMD_BYTES;
+    int k;
+    for (k = 0; simd && k < ac->first_count; k++) {
+        set[k] = _mm_set1_epi8((char)ac->first_bytes[k]);
+    }
+#endif
+    for (;;) {
+#ifdef __SSE2__
+        while (simd && end - p >= 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            __m128i hit = _mm_cmpeq_epi8(v, set[0]);
+            for (k = 1; k < ac->first_count; k++) {
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, set[k]));
+            }
+            int mask = _mm_movemask_epi8(hit);
+            if (mask != 0) {
+                p += __builtin_ctz(mask);
+                break;
+            }
+            p += 16;
+        }
+#endif
+        while (p < end && !ac->first[*p]) {
+            p++;
+        }
+        if (p + 1 >= end || (ac->bigrams[(p[0] << 5) | (p[1] >> 3)] & (1 << (p[1] & 7)))) {
+            return p;//the next byte may be in the next chunk
+        }
+        p++;
+    }
+}
+
+/**
+ * Run the prescan automaton over the next bytes of the body java sees, continuing the state of the previous chunk.<br>
+ * matches are kept in the arena of the request, up to CIJ_PRESCAN_MAX_MATCHES.<br>
+ *
+ * @param jServiceData service data of the request
+ * @param data the next bytes
+ * @param length data byte length
+ */
+static void cij_prescan_feed(jServiceData_t * jServiceData, const char * data, size_t length) {
+    const cij_prescan_t * ac = jServiceData->jdata->prescan;
+    if (ac == NULL || length == 0) {
+        return;
+    }
+    const unsigned char * start = (const unsigned char *)data;
+    const unsigned char * p = start;
+    const unsigned char * end = start + length;
+    int32_t state = jServiceData->prescan_state;
+    while (p < end) {
+        if (state == 0) {
+            p = cij_prescan_skip(ac, p, end);
+            if (p == end) {
+                break;
+            }
+        }
+        state = cij_prescan_next(ac, state, *p);
+        int32_t out = ac->states[state].output >= 0 ? state : ac->states[state].dict;
+        for (; out >= 0; out = ac->states[out].dict) {
+            int32_t id = ac->states[out].output;
+            if (jServiceData->prescan_matches == NULL) {
+                jServiceData->prescan_matches = (cij_match_t *)cij_arena_calloc(jServiceData->arena, CIJ_PRESCAN_MAX_MATCHES * sizeof(cij_match_t));
+            }
+            if (jServiceData->prescan_matches != NULL && jServiceData->prescan_used < CIJ_PRESCAN_MAX_MATCHES) {
+                cij_match_t * match = &(jServiceData->prescan_matches[jServiceData->prescan_used++]);
+                match->id = id;
+                match->offset = jServiceData->prescan_offset + (p - start) + 1 - ac->lengths[id];
+            }
+            jServiceData->prescan_total++;
+        }
+        p++;
+    }
+    jServiceData->prescan_state = state;
+    jServiceData->prescan_offset += length;
+}
+
+/**
+ * Register the statistics of a service, shown in "Service <name>" of the info service.
+ * registered in the parent so that the counters of all children are summed up.<br>
+ * JAVA <CALL> US counts microseconds spent in the call, the buckets below count calls by latency.
+ */
+static int cij_register_stats(void * data, const char * name, const void * value) {
+    static const char * calls[CIJ_CALLS] = {"CONSTRUCTOR", "PREVIEW", "SERVICE", "ONDATA"};
+    static const char * buckets[CIJ_HIST_BUCKETS] = {"<100US", "<1MS", "<10MS", "<100MS", ">=100MS"};
+    jData_t * jdata = (jData_t *)value;
+    if (asprintf(&(jdata->stat_group), "Service %s", jdata->name) < 0) {//FREEME
+        jdata->stat_group = NULL;
+        return 0;
+    }
+    const char * group = jdata->stat_group;
+    jdata->stat_requests = ci_stat_entry_register("JAVA REQUESTS", STAT_INT64_T, group);
+    jdata->stat_allow204 = ci_stat_entry_register("JAVA ALLOW 204", STAT_INT64_T, group);
+    jdata->stat_errors = ci_stat_entry_register("JAVA ERRORS", STAT_INT64_T, group);
+    jdata->stat_bypass = ci_stat_entry_register("JAVA BYPASSED", STAT_INT64_T, group);
+    jdata->stat_cache_hit = ci_stat_entry_register("JAVA VERDICT CACHE HITS", STAT_INT64_T, group);
+    jdata->stat_cache_miss = ci_stat_entry_register("JAVA VERDICT CACHE MISSES", STAT_INT64_T, group);
+    jdata->stat_saturated = ci_stat_entry_register("JAVA SATURATED", STAT_INT64_T, group);
+    jdata->stat_late = ci_stat_entry_register("JAVA DEADLINE MISSED", STAT_INT64_T, group);
+    jdata->stat_sidecar_errors = ci_stat_entry_register("JAVA SIDECAR ERRORS", STAT_INT64_T, group);
+    jdata->stat_bytes_in = ci_stat_entry_register("JAVA BODY BYTES IN", STAT_KBS_T, group);
+    jdata->stat_bytes_out = ci_stat_entry_register("JAVA BODY BYTES OUT", STAT_KBS_T, group);
+    jdata->stat_prescan_clean = ci_stat_entry_register("JAVA PRESCAN CLEAN", STAT_INT64_T, group);
+    jdata->stat_batches = ci_stat_entry_register("JAVA PREVIEW BATCHES", STAT_INT64_T, group);
+    jdata->stat_warmup_calls = ci_stat_entry_register("JAVA WARMUP CALLS", STAT_INT64_T, group);
+    int i, j;
+    for (i = 0; i < CIJ_CALLS; i++) {
+        char label[64];
+        snprintf(label, sizeof(label), "JAVA %s CALLS", calls[i]);
+        jdata->stat_calls[i] = ci_stat_entry_register(label, STAT_INT64_T, group);
+        snprintf(label, sizeof(label), "JAVA %s US", calls[i]);
+        jdata->stat_call_us[i] = ci_stat_entry_register(label, STAT_INT64_T, group);
+        for (j = 0; j < CIJ_HIST_BUCKETS; j++) {
+            snprintf(label, sizeof(label), "JAVA %s %s", calls[i], buckets[j]);
+            jdata->stat_call_hist[i][j] = ci_stat_entry_register(label, STAT_INT64_T, group);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Build the verdict cache of a service if VerdictCache is on.
+ * built before children are forked, so that a "shared" cache is shared by them.<br>
+ */
+static int cij_build_cache(void * data, const char * name, const void * value) {
+    jData_t * jdata = (jData_t *)value;
+    if (!jdata->cache_enable) {
+        return 0;
+    }
+    char cache_name[MAX_SERVICE_NAME + 6];
+    snprintf(cache_name, sizeof(cache_name), "java_%s", jdata->name);
+    jdata->cache = ci_cache_build(cache_name, jdata->cache_type, jdata->cache_size, jdata->cache_max_object, jdata->cache_ttl, &ci_str_ops);//FREEME
+    if (jdata->cache == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to build %s verdict cache of %s. disabled.", jdata->cache_type, jdata->name);
+    }
+    return 0;
+}
+
+/**
+ * Build the automaton of PrescanPatterns of a service.
+ * built before children are forked, so that they share its pages. the service runs without the prescan if it fails.<br>
+ */
+static int cij_build_prescan(void * data, const char * name, const void * value) {
+    jData_t * jdata = (jData_t *)value;
+    if (jdata->prescan_file == NULL || jdata->prescan_file[0] == '\0') {
+        return 0;
+    }
+    jdata->prescan = cij_prescan_load(jdata->prescan_file);//FREEME
+    if (jdata->prescan == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "PrescanPatterns of %s is disabled. java sees every body.", jdata->name);
+    }
+    return 0;
+}
+
+/**
+ * Refuse BatchWindow of a service with Async on. a batch is called on a worker thread and its requests wait for it
+ * without Deadline and FailOpen, so batching is disabled there.<br>
+ */
+static int cij_check_batch(void * data, const char * name, const void * value) {
+    jData_t * jdata = (jData_t *)value;
+    if (jdata->batch_window > 0 && jdata->async) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "BatchWindow of %s can not be used with Async. batching is disabled.", jdata->name);
+        jdata->batch_window = 0;
+    }
+    return 0;
+}
+
+/**
+ * Called When all c-icap-java services's "java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)" has called.<br>
+ * prev = java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)<br>
+ * next = java_post_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)<br>
+ *
+ * @see java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)
+ * @see java_post_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)
+ * @param server_conf a pointer to the server configurations.
+ * @return CI_OK
+ */
+int post_init_java_handler(struct ci_server_conf * server_conf) {
+    cij_stat_jvm_starts = ci_stat_entry_register("JVM STARTS", STAT_INT64_T, "java_handler");
+    cij_stat_jvm_start_ms = ci_stat_entry_register("JVM START TIME MS", STAT_INT64_T, "java_handler");
+    cij_stat_gc_count = ci_stat_entry_register("JVM GC COUNT", STAT_INT64_T, "java_handler");
+    cij_stat_gc_ms = ci_stat_entry_register("JVM GC TIME MS", STAT_INT64_T, "java_handler");
+    ci_ptr_dyn_array_iterate(java_services, NULL, cij_register_stats);
+    ci_ptr_dyn_array_iterate(java_services, NULL, cij_build_cache);
+    ci_ptr_dyn_array_iterate(java_services, NULL, cij_build_prescan);
+    ci_ptr_dyn_array_iterate(java_services, NULL, cij_check_batch);
+    return CI_OK;
+}
+
+/**
+ * Compile a pattern for the list.<br>
+ *
+ * @param list the list
+ * @param text the pattern
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_patterns_add(cij_patterns_t * list, const char * text) {
+    if (list->used == list->size) {
+        int size = list->size ? list->size * 2 : 8;
+        cij_pattern_t * items = (cij_pattern_t *)realloc(list->items, size * sizeof(cij_pattern_t));
+        if (items == NULL) {
+            return CI_ERROR;
+        }
+        list->items = items;
+        list->size = size;
+    }
+    cij_pattern_t * pattern = &(list->items[list->used]);
+    size_t length = strlen(text);
+    pattern->kind = CIJ_MATCH_EXACT;
+    if (list->mode == CIJ_PATTERNS_PREFIX) {
+        pattern->kind = CIJ_MATCH_PREFIX;
+    } else if (list->mode == CIJ_PATTERNS_HOST) {
+        pattern->kind = (text[0] == '.') ? CIJ_MATCH_SUFFIX : CIJ_MATCH_EXACT;
+    } else if (list->mode == CIJ_PATTERNS_GLOB && strpbrk(text, "*?[") != NULL) {
+        const char * wild = strpbrk(text + 1, "*?[");
+        if (length > 1 && text[length - 1] == '*' && wild == text + length - 1) {
+            pattern->kind = CIJ_MATCH_PREFIX;
+            length--;
+        } else if (length > 1 && text[0] == '*' && wild == NULL) {
+            pattern->kind = CIJ_MATCH_SUFFIX;
+            text++;
+            length--;
+        } else {
+            pattern->kind = CIJ_MATCH_GLOB;
+        }
+    }
+    pattern->text = strndup(text, length);//FREEME
+    if (pattern->text == NULL) {
+        return CI_ERROR;
+    }
+    pattern->length = length;
+    list->used++;
+    return CI_OK;
+}
+
+static void cij_patterns_free(cij_patterns_t * list) {
+    int i;
+    for (i = 0; i < list->used; i++) {
+        free(list->items[i].text);
+    }
+    free(list->items);
+    list->items = NULL;
+    list->used = list->size = 0;
+}
+
+/**
+ * Match a value against the list. case insensitive except url prefixes.<br>
+ *
+ * @param list the list
+ * @param value the value
+ * @param length value byte length
+ * @return 1 if any pattern matches
+ */
+static int cij_patterns_match(const cij_patterns_t * list, const char * value, size_t length) {
+    int i;
+    int fold = (list->mode != CIJ_PATTERNS_PREFIX);
+    for (i = 0; i < list->used; i++) {
+        const cij_pattern_t * pattern = &(list->items[i]);
+        switch (pattern->kind) {
+        case CIJ_MATCH_EXACT:
+            if (length == pattern->length && strncasecmp(value, pattern->text, length) == 0) {
+                return 1;
+            }
+            break;
+        case CIJ_MATCH_PREFIX:
+            if (length >= pattern->length && (fold ? strncasecmp(value, pattern->text, pattern->length) : strncmp(value, pattern->text, pattern->length)) == 0) {
+                return 1;
+            }
+            break;
+        case CIJ_MATCH_SUFFIX:
+            if (length >= pattern->length && strncasecmp(value + length - pattern->length, pattern->text, pattern->length) == 0) {
+                return 1;
+            }
+            if (list->mode == CIJ_PATTERNS_HOST && length == pattern->length - 1 && strncasecmp(value, pattern->text + 1, length) == 0) {
+                return 1;//".example.com" matches "example.com" too
+            }
+            break;
+        case CIJ_MATCH_GLOB: {
+            char buf[256];
+            if (length >= sizeof(buf)) {
+                break;
+            }
+            memcpy(buf, value, length);
+            buf[length] = '\0';
+            if (fnmatch(pattern->text, buf, FNM_CASEFOLD) == 0) {
+                return 1;
+            }
+            break;
+        }
+        }
+    }
+    return 0;
+}
+
+/**
+ * conf table action of Bypass* pattern lists. every argument is a pattern.<br>
+ */
+static int cij_cfg_patterns(const char * directive, const char ** argv, void * setdata) {
+    cij_patterns_t * list = (cij_patterns_t *)setdata;
+    int i;
+    if (argv == NULL || argv[0] == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Missing arguments in directive %s", directive);
+        return 0;
+    }
+    for (i = 0; argv[i] != NULL; i++) {
+        if (cij_patterns_add(list, argv[i]) != CI_OK) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to allocate memory for directive %s", directive);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Build the per service conf table, "ServiceName.Directive value" in c-icap.conf.<br>
+ * every service needs its own table because entries point to the fields of its jData_t.<br>
+ *
+ * @param jdata the service
+ * @return conf table or NULL if failed to allocate
+ */
+static struct ci_conf_entry * cij_service_conf_table(jData_t * jdata) {
+    const struct ci_conf_entry conf_table[] = {
+        {"BodyMaxMem", &(jdata->body_max_mem), ci_cfg_size_off, NULL},
+        {"InstancePool", &(jdata->pool_size), ci_cfg_set_int, NULL},
+        {"ReloadInterval", &(jdata->reload_interval), ci_cfg_set_int, NULL},
+        {"Async", &(jdata->async), ci_cfg_onoff, NULL},
+        {"Deadline", &(jdata->deadline), ci_cfg_set_int, NULL},
+        {"Concurrency", &(jdata->concurrency), ci_cfg_set_int, NULL},
+        {"FailOpen", &(jdata->fail_open), ci_cfg_onoff, NULL},
+        {"VerdictCache", &(jdata->cache_enable), ci_cfg_onoff, NULL},
+        {"VerdictCacheType", &(jdata->cache_type), ci_cfg_set_str, NULL},
+        {"VerdictCacheSize", &(jdata->cache_size), ci_cfg_size_off, NULL},
+        {"VerdictCacheMaxObject", &(jdata->cache_max_object), ci_cfg_size_off, NULL},
+        {"VerdictCacheTTL", &(jdata->cache_ttl), ci_cfg_set_int, NULL},
+        {"BypassContentType", &(jdata->bypass_content_type), cij_cfg_patterns, NULL},
+        {"BypassUrlPrefix", &(jdata->bypass_url), cij_cfg_patterns, NULL},
+        {"BypassHost", &(jdata->bypass_host), cij_cfg_patterns, NULL},
+        {"BypassMethod", &(jdata->bypass_method), cij_cfg_patterns, NULL},
+        {"BypassMaxContentLength", &(jdata->bypass_max_length), ci_cfg_size_off, NULL},
+        {"BypassMinContentLength", &(jdata->bypass_min_length), ci_cfg_size_off, NULL},
+        {"DecodeBody", &(jdata->decode), ci_cfg_onoff, NULL},
+        {"DecodeMaxRatio", &(jdata->decode_max_ratio), ci_cfg_set_int, NULL},
+        {"DecodeMaxSize", &(jdata->decode_max_size), ci_cfg_size_off, NULL},
+        {"WarmupDir", &(jdata->warmup_dir), ci_cfg_set_str, NULL},
+        {"WarmupRequests", &(jdata->warmup_requests), ci_cfg_set_int, NULL},
+        {"WarmupTime", &(jdata->warmup_time), ci_cfg_set_int, NULL},
+        {"PrescanPatterns", &(jdata->prescan_file), ci_cfg_set_str, NULL},
+        {"BatchWindow", &(jdata->batch_window), ci_cfg_set_int, NULL},
+        {"BatchSize", &(jdata->batch_size), ci_cfg_set_int, NULL},
+        {"BatchMaxBody", &(jdata->batch_max_body), ci_cfg_size_off, NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+    struct ci_conf_entry * table = (struct ci_conf_entry *)malloc(sizeof(conf_table));//FREEME
+    if (table != NULL) {
+        memcpy(table, conf_table, sizeof(conf_table));
+    }
+    return table;
+}
+
+/**
+ * a read cursor over a .class file. reads past the end set the cursor broken instead of failing each call.<br>
+ */
+typedef struct cijClassFileStruct {
+    const unsigned char * data;
+    size_t size;
+    size_t pos;
+    int broken;
+} cij_class_file_t;
+
+static unsigned int cij_cf_u1(cij_class_file_t * cf) {
+    if (cf->broken || cf->pos + 1 > cf->size) {
+        cf->broken = 1;
+        return 0;
+    }
+    return cf->data[cf->pos++];
+}
+
+static unsigned int cij_cf_u2(cij_class_file_t * cf) {
+    unsigned int hi = cij_cf_u1(cf);
+    return (hi << 8) | cij_cf_u1(cf);
+}
+
+static uint32_t cij_cf_u4(cij_class_file_t * cf) {
+    uint32_t hi = cij_cf_u2(cf);
+    return (hi << 16) | cij_cf_u2(cf);
+}
+
+static void cij_cf_skip(cij_class_file_t * cf, size_t length) {
+    if (cf->broken || length > cf->size - cf->pos) {
+        cf->broken = 1;
+        return;
+    }
+    cf->pos += length;
+}
+
+/**
+ * Find a CONSTANT_Utf8 of the constant pool.<br>
+ *
+ * @param cf the class file
+ * @param pool offsets of the constant pool entries, 0 for unusable slots
+ * @param pool_count constant_pool_count
+ * @param index index in the constant pool
+ * @param length length of the string in bytes
+ * @return the string, not terminated, or NULL if index is not a Utf8 entry
+ */
+static const char * cij_cf_utf8(cij_class_file_t * cf, size_t * pool, unsigned int pool_count, unsigned int index, unsigned int * length) {
+    if (index == 0 || index >= pool_count || pool[index] == 0 || cf->data[pool[index]] != CIJ_CF_UTF8) {
+        return NULL;
+    }
+    *length = (cf->data[pool[index] + 1] << 8) | cf->data[pool[index] + 2];
+    return (const char *)(cf->data + pool[index] + 3);
+}
+
+/**
+ * Apply a constant of a static final field to the OPTIONS metadata of the service.<br>
+ * unknown fields and fields of other types are ignored.<br>
+ *
+ * @param jdata the service
+ * @param cf the class file
+ * @param pool offsets of the constant pool entries
+ * @param pool_count constant_pool_count
+ * @param name name of the field, not terminated
+ * @param name_len length of name
+ * @param value index of the ConstantValue in the constant pool
+ */
+static void cij_class_option(jData_t * jdata, cij_class_file_t * cf, size_t * pool, unsigned int pool_count, const char * name, unsigned int name_len, unsigned int value) {
+    static const char * string_fields[] = {CIJ_CLASS_TRANSFER_PREVIEW, CIJ_CLASS_TRANSFER_IGNORE, CIJ_CLASS_TRANSFER_COMPLETE, CIJ_CLASS_ISTAG, CIJ_CLASS_MOD_TYPE};
+    char ** string_values[] = {&(jdata->transfer_preview), &(jdata->transfer_ignore), &(jdata->transfer_complete), &(jdata->istag), NULL};
+    if (value == 0 || value >= pool_count || pool[value] == 0) {
+        return;
+    }
+    const unsigned char * entry = cf->data + pool[value];
+    if (entry[0] == CIJ_CF_INTEGER) {
+        int32_t number = (int32_t)(((uint32_t)entry[1] << 24) | ((uint32_t)entry[2] << 16) | ((uint32_t)entry[3] << 8) | entry[4]);
+        if (name_len == strlen(CIJ_CLASS_PREVIEW_SIZE) && memcmp(name, CIJ_CLASS_PREVIEW_SIZE, name_len) == 0) {
+            jdata->preview_size = number;
+        } else if (name_len == strlen(CIJ_CLASS_OPTIONS_TTL) && memcmp(name, CIJ_CLASS_OPTIONS_TTL, name_len) == 0) {
+            jdata->options_ttl = number;
+        }
+        return;
+    }
+    if (entry[0] != CIJ_CF_STRING) {
+        return;
+    }
+    unsigned int length = 0;
+    const char * string = cij_cf_utf8(cf, pool, pool_count, (entry[1] << 8) | entry[2], &length);
+    if (string == NULL) {
+        return;
+    }
+    size_t i;
+    for (i = 0; i < sizeof(string_fields) / sizeof(string_fields[0]); i++) {
+        if (name_len != strlen(string_fields[i]) || memcmp(name, string_fields[i], name_len) != 0) {
+            continue;
+        }
+        char * copy = strndup(string, length);//FREEME
+        if (copy == NULL) {
+            return;
+        }
+        if (string_values[i] != NULL) {
+            free(*(string_values[i]));
+            *(string_values[i]) = copy;
+            return;
+        }
+        //MOD_TYPE: "REQMOD", "RESPMOD" or both
+        int mod_type = 0;
+        char * save = NULL;
+        char * word;
+        for (word = strtok_r(copy, " ,|", &save); word != NULL; word = strtok_r(NULL, " ,|", &save)) {
+            if (strcasecmp(word, "REQMOD") == 0) {
+                mod_type |= ICAP_REQMOD;
+            } else if (strcasecmp(word, "RESPMOD") == 0) {
+                mod_type |= ICAP_RESPMOD;
+            } else {
+                cij_debug_printf(CIJ_ERROR_LEVEL, "Unknown %s '%s' of service '%s'. ignoring...", CIJ_CLASS_MOD_TYPE, word, jdata->name);
+            }
+        }
+        if (mod_type != 0) {
+            jdata->mod_type = mod_type;
+        }
+        free(copy);
+        return;
+    }
+}
+
+/**
+ * Read the OPTIONS metadata of the service from the static final fields of its .class file.<br>
+ * the JVM does not exist yet when services are loaded (it is created per child), so the constants are
+ * read from the class file itself. only fields initialized by a compile-time constant have a ConstantValue.<br>
+ * <pre>
+ * static final int PREVIEW_SIZE = 4096;
+ * static final String TRANSFER_PREVIEW = "*";
+ * static final String TRANSFER_IGNORE = "jpg, png, mp4";
+ * static final String TRANSFER_COMPLETE = "exe, zip";
+ * static final String ISTAG = "v42";
+ * static final String MOD_TYPE = "RESPMOD";
+ * static final int OPTIONS_TTL = 3600;
+ * </pre>
+ *
+ * @see java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)
+ * @param jdata the service
+ * @return CI_OK, or CI_ERROR if the file is not a readable class file. the defaults are kept then.
+ */
+static int cij_class_options(jData_t * jdata) {
+    int ret = CI_ERROR;
+    unsigned char * data = NULL;
+    size_t * pool = NULL;
+    struct stat st;
+    int fd = open(jdata->file, O_RDONLY);
+    if (fd < 0) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to open class file '%s'.", jdata->file);
+        return CI_ERROR;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size > CIJ_MAX_CLASS_FILE) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Unexpected size of class file '%s'.", jdata->file);
+        goto END_OF_CLASS_OPTIONS;
+    }
+    data = (unsigned char *)malloc(st.st_size);//FREEME
+    if (data == NULL || read(fd, data, st.st_size) != st.st_size) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to read class file '%s'.", jdata->file);
+        goto END_OF_CLASS_OPTIONS;
+    }
+
+    cij_class_file_t cf = {data, (size_t)st.st_size, 0, 0};
+    if (cij_cf_u4(&cf) != CIJ_CF_MAGIC) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "'%s' is not a class file.", jdata->file);
+        goto END_OF_CLASS_OPTIONS;
+    }
+    cij_cf_skip(&cf, 4);//minor_version, major_version
+    unsigned int pool_count = cij_cf_u2(&cf);
+    pool = (size_t *)calloc(pool_count + 1, sizeof(size_t));//FREEME
+    if (pool == NULL) {
+        goto END_OF_CLASS_OPTIONS;
+    }
+    unsigned int i;
+    for (i = 1; i < pool_count && !cf.broken; i++) {
+        pool[i] = cf.pos;
+        switch (cij_cf_u1(&cf)) {
+        case CIJ_CF_UTF8:
+            cij_cf_skip(&cf, cij_cf_u2(&cf));
+            break;
+        case CIJ_CF_INTEGER:
+        case CIJ_CF_FLOAT:
+        case CIJ_CF_FIELDREF:
+        case CIJ_CF_METHODREF:
+        case CIJ_CF_INTERFACE_METHODREF:
+        case CIJ_CF_NAME_AND_TYPE:
+        case CIJ_CF_DYNAMIC:
+        case CIJ_CF_INVOKE_DYNAMIC:
+            cij_cf_skip(&cf, 4);
+            break;
+        case CIJ_CF_LONG:
+        case CIJ_CF_DOUBLE:
+            cij_cf_skip(&cf, 8);
+            i++;//takes two slots
+            break;
+        case CIJ_CF_CLASS:
+        case CIJ_CF_STRING:
+        case CIJ_CF_METHOD_TYPE:
+        case CIJ_CF_MODULE:
+        case CIJ_CF_PACKAGE:
+            cij_cf_skip(&cf, 2);
+            break;
+        case CIJ_CF_METHOD_HANDLE:
+            cij_cf_skip(&cf, 3);
+            break;
+        default:
+            cf.broken = 1;
+            break;
+        }
+    }
+    cij_cf_skip(&cf, 6);//access_flags, this_class, super_class
+    cij_cf_skip(&cf, 2 * cij_cf_u2(&cf));//interfaces
+    unsigned int fields_count = cij_cf_u2(&cf);
+    for (i = 0; i < fields_count && !cf.broken; i++) {
+        unsigned int access = cij_cf_u2(&cf);
+        unsigned int name_index = cij_cf_u2(&cf);
+        cij_cf_skip(&cf, 2);//descriptor_index
+        unsigned int attributes_count = cij_cf_u2(&cf);
+        unsigned int name_len = 0;
+        const char * name = cij_cf_utf8(&cf, pool, pool_count, name_index, &name_len);
+        unsigned int a;
+        for (a = 0; a < attributes_count && !cf.broken; a++) {
+            unsigned int attr_len = 0;
+            const char * attr = cij_cf_utf8(&cf, pool, pool_count, cij_cf_u2(&cf), &attr_len);
+            uint32_t length = cij_cf_u4(&cf);
+            if (name != NULL && (access & CIJ_CF_ACC_STATIC) && length == 2 && attr != NULL
+                && attr_len == strlen("ConstantValue") && memcmp(attr, "ConstantValue", attr_len) == 0) {
+                cij_class_option(jdata, &cf, pool, pool_count, name, name_len, cij_cf_u2(&cf));
+            } else {
+                cij_cf_skip(&cf, length);
+            }
+        }
+    }
+    if (cf.broken) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Truncated or unknown class file '%s'.", jdata->file);
+        goto END_OF_CLASS_OPTIONS;
+    }
+    ret = CI_OK;
+
+END_OF_CLASS_OPTIONS:
+    free(pool);
+    free(data);
+    close(fd);
+    return ret;
+}
+
+/**
+ * Called by each service scripts. registers the java class as a service.<br>
+ * JVM is not created here. see cij_service_env(jData_t * jdata).<br>
+ * prev = init_java_handler(struct ci_server_conf * server_conf)<br>
+ * next = java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)<br>
+ *
+ * @see init_java_handler(struct ci_server_conf * server_conf)
+ * @see java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf)
+ * @param service_file not to 'free'? idk...
+ * @return
+ */
+ci_service_module_t * load_java_module(const char * service_file) {
+    ci_service_module_t * service = NULL;
+    jData_t * jdata = NULL;
+    if (access(service_file, R_OK) != 0) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Can not read service file %s", service_file);
+        return NULL;
+    }
+    service = (ci_service_module_t *)malloc(sizeof(ci_service_module_t));//FREEME
+    if (service == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL,"Failed to allocate memory for service %s",service_file);
+        return NULL;
+    }
+    jdata = (jData_t *)calloc(1, sizeof(jData_t));//FREEME
+    if (jdata == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL,"Failed to allocate memory for service %s",service_file);
+        free(service);
+        return NULL;
+    }
+
+    {//set service file name to SERVICE NAME
+    const char * service_file_name = basename(service_file);// increase pointer to the next of last "/"(in *nixOS) or "\"(in windowsOS)
+    char * name = strndup(service_file_name, MAX_SERVICE_NAME);//duplicate filename string
+    if (name == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL,"Failed to allocate memory for service %s",service_file);
+        free(service);
+        free(jdata);
+        return NULL;
+    }
+    name[strnlen(name, MAX_SERVICE_NAME)-strnlen(".class", MAX_SERVICE_NAME)] = '\0';//strip ".class" from the file
+    jdata->name = name;//FREEME
+    jdata->file = strdup(service_file);//FREEME. NULL only disables ReloadInterval
+    }
+
+    jdata->body_max_mem = CI_BODY_MAX_MEM;
+    jdata->pool_size = CIJ_DEFAULT_POOL_SIZE;
+    pthread_mutex_init(&(jdata->pool_mutex), NULL);
+    pthread_mutex_init(&(jdata->class_mutex), NULL);
+    pthread_mutex_init(&(jdata->reload_mutex), NULL);
+    jdata->deadline = CIJ_DEFAULT_DEADLINE;
+    jdata->concurrency = CIJ_DEFAULT_CONCURRENCY;
+    jdata->fail_open = 1;
+    pthread_mutex_init(&(jdata->exec_mutex), NULL);
+    pthread_cond_init(&(jdata->exec_cond), NULL);
+    jdata->batch_size = CIJ_DEFAULT_BATCH_SIZE;
+    jdata->batch_max_body = CIJ_DEFAULT_BATCH_MAX_BODY;
+    pthread_mutex_init(&(jdata->batch_mutex), NULL);
+    pthread_cond_init(&(jdata->batch_cond), NULL);
+    jdata->decode_max_ratio = CIJ_DEFAULT_DECODE_MAX_RATIO;
+    jdata->decode_max_size = CIJ_DEFAULT_DECODE_MAX_SIZE;
+    jdata->warmup_requests = CIJ_DEFAULT_WARMUP_REQUESTS;
+    jdata->warmup_time = CIJ_DEFAULT_WARMUP_TIME;
+    jdata->cache_type = "shared";
+    jdata->cache_size = CIJ_DEFAULT_CACHE_SIZE;
+    jdata->cache_max_object = CIJ_DEFAULT_CACHE_MAX_OBJECT;
+    jdata->cache_ttl = CIJ_DEFAULT_CACHE_TTL;
+    jdata->bypass_content_type.mode = CIJ_PATTERNS_GLOB;
+    jdata->bypass_url.mode = CIJ_PATTERNS_PREFIX;
+    jdata->bypass_host.mode = CIJ_PATTERNS_HOST;
+    jdata->bypass_method.mode = CIJ_PATTERNS_WORD;
+    jdata->conf_table = cij_service_conf_table(jdata);
+    if (jdata->conf_table == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL,"Failed to allocate memory for service %s",service_file);
+        goto FAIL_TO_LOAD_SERVICE;
+    }
+    jdata->preview_size = CIJ_DEFAULT_PREVIEW_SIZE;
+    jdata->mod_type = ICAP_REQMOD | ICAP_RESPMOD;
+    jdata->transfer_preview = strdup("*");//FREEME
+    if (jdata->transfer_preview == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL,"Failed to allocate memory for service %s",service_file);
+        goto FAIL_TO_LOAD_SERVICE;
+    }
+    cij_class_options(jdata);//keeps the defaults on failure. the JVM reports a broken class later
+
+    service->mod_data = (void *)jdata;
+    service->mod_conf_table = jdata->conf_table;
+    service->mod_init_service = java_init_service;
+    service->mod_post_init_service = java_post_init_service;
+    service->mod_close_service = java_close_service;
+    service->mod_init_request_data = java_init_request_data;
+    service->mod_release_request_data = java_release_request_data;
+    service->mod_check_preview_handler = java_check_preview_handler;
+    service->mod_end_of_data_handler = java_end_of_data_handler;
+    service->mod_service_io = java_service_io;
+    service->mod_name = jdata->name;
+    service->mod_type = jdata->mod_type;
+    if (ci_ptr_dyn_array_add(java_services, jdata->name, jdata) == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed adding service '%s' to dyn-array.", jdata->name);
+        goto FAIL_TO_LOAD_SERVICE;
+    }
+    cij_loading = jdata;
+    cij_debug_printf(CIJ_MESSAGE_LEVEL, "OK service %s loaded\n", service_file);
+    return service;
+
+FAIL_TO_LOAD_SERVICE:
+    pthread_mutex_destroy(&(jdata->pool_mutex));
+    pthread_mutex_destroy(&(jdata->class_mutex));
+    pthread_mutex_destroy(&(jdata->reload_mutex));
+    pthread_mutex_destroy(&(jdata->batch_mutex));
+    pthread_cond_destroy(&(jdata->batch_cond));
+    pthread_mutex_destroy(&(jdata->exec_mutex));
+    pthread_cond_destroy(&(jdata->exec_cond));
+    free(jdata->conf_table);
+    free(jdata->transfer_preview);
+    free(jdata->transfer_ignore);
+    free(jdata->transfer_complete);
+    free(jdata->istag);
+    free(jdata->file);
+    free(jdata->name);
+    free(service);
+    free(jdata);
+    cij_debug_printf(CIJ_ERROR_LEVEL, "Fail at loading service '%s'",service_file);
+    return NULL;
+}
+
+static int cij_executor_stop(jData_t * jdata);
+
+/**
+ * releases a service. used at release_java_handler() .<br>
+ *
+ * @see release_java_handler()
+ * @param data JNIEnv of the current thread or NULL if JVM is not available
+ * @param name
+ * @param value
+ * @return 0 to continue iteration
+ */
+static int cij_release_service(void *data, const char *name, const void * value) {
+    jData_t * jdata = (jData_t *)value;
+    JNIEnv * jni = (JNIEnv *)data;
+    if (!cij_executor_stop(jdata)) {
+        //the executor threads still use jdata and the classes. the process exits anyway
+        cij_debug_printf(CIJ_WARN_LEVEL, "executor threads of %s are still in java. the service is left allocated.", jdata->name);
+        return 0;
+    }
+    cij_class_unref(jni, jdata->current);
+    pthread_mutex_destroy(&(jdata->pool_mutex));
+    pthread_mutex_destroy(&(jdata->class_mutex));
+    pthread_mutex_destroy(&(jdata->reload_mutex));
+    pthread_mutex_destroy(&(jdata->batch_mutex));
+    pthread_cond_destroy(&(jdata->batch_cond));
+    pthread_mutex_destroy(&(jdata->exec_mutex));
+    pthread_cond_destroy(&(jdata->exec_cond));
+    if (jdata->cache != NULL) {
+        ci_cache_destroy(jdata->cache);
+    }
+    cij_patterns_free(&(jdata->bypass_content_type));
+    cij_patterns_free(&(jdata->bypass_url));
+    cij_patterns_free(&(jdata->bypass_host));
+    cij_patterns_free(&(jdata->bypass_method));
+    cij_prescan_free(jdata->prescan);
+    free(jdata->conf_table);
+    free(jdata->stat_group);
+    free(jdata->transfer_preview);
+    free(jdata->transfer_ignore);
+    free(jdata->transfer_complete);
+    free(jdata->istag);
+    free(jdata->file);
+    free(jdata->name);
+    free(jdata);
+    return 0;
+}
+
+/**
+ * Release all services and destroy the JavaVM of this process.<br>
+ * prev = java_close_service()<br>
+ * next = none.<br>
+ *
+ * @see java_close_service()
+ */
+void release_java_handler() {
+    JNIEnv * jni = NULL;
+    JavaVM * jvm = cij_jvm;
+    if (jvm != NULL && cij_jvm_pid == getpid()) {
+        jni = cij_attach_env(jvm);
+    }
+    ci_ptr_dyn_array_iterate(java_services, jni, cij_release_service);
+    ci_ptr_dyn_array_destroy(java_services);
+
+    if (jni != NULL) {
+        (*jni)->DeleteGlobalRef(jni, cij_jstr_reqmod);
+        (*jni)->DeleteGlobalRef(jni, cij_jstr_respmod);
+        (*jni)->DeleteGlobalRef(jni, cij_class_string);
+        (*jni)->DeleteGlobalRef(jni, cij_gc_beans);
+        __atomic_store_n(&cij_jvm, NULL, __ATOMIC_RELEASE);
+        jint ret = (*jvm)->DestroyJavaVM(jvm);
+        if (ret != JNI_OK) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to destroy JavaVM(%d).", ret);
+        }
+    }
+    pthread_key_delete(cij_env_key);
+    pthread_key_delete(cij_thread_key);
+    int i;
+    for (i = 0; i < cij_conf_options_used; i++) {
+        free(cij_conf_options[i]);
+    }
+    free(cij_conf_options);
+    cij_conf_options = NULL;
+    cij_conf_options_used = 0;
+    return;
+}
+
+/**
+ * Called after load_java_module(char * service_file) .<br>
+ * initialize service OPTIONS parameter from the static fields of the class. see cij_class_options(jData_t * jdata)<br>
+ * prev = load_java_module(const char * service_file)<br>
+ * next = post_init_java_handler(struct ci_server_conf * server_conf)<br>
+ *
+ * @param srv_xdata a pointer holds service parameter.
+ * @param server_conf a pointer of server config.
+ * @return CI_SERVICE_OK
+ */
+int java_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf) {
+    jData_t * jdata = cij_loading;
+    cij_loading = NULL;
+    if (jdata == NULL) {
+        ci_service_set_preview(srv_xdata, CIJ_DEFAULT_PREVIEW_SIZE);
+        ci_service_enable_204(srv_xdata);
+        ci_service_set_transfer_preview(srv_xdata, "*");
+        return CI_SERVICE_OK;
+    }
+    ci_service_set_preview(srv_xdata, jdata->preview_size);
+    ci_service_enable_204(srv_xdata);
+    if (jdata->transfer_preview != NULL && jdata->transfer_preview[0] != '\0') {
+        ci_service_set_transfer_preview(srv_xdata, jdata->transfer_preview);
+    }
+    if (jdata->transfer_ignore != NULL && jdata->transfer_ignore[0] != '\0') {
+        ci_service_set_transfer_ignore(srv_xdata, jdata->transfer_ignore);
+    }
+    if (jdata->transfer_complete != NULL && jdata->transfer_complete[0] != '\0') {
+        ci_service_set_transfer_complete(srv_xdata, jdata->transfer_complete);
+    }
+    if (jdata->istag != NULL && jdata->istag[0] != '\0') {
+        ci_service_set_istag(srv_xdata, jdata->istag);
+    }
+    if (jdata->options_ttl > 0) {
+        ci_service_set_options_ttl(srv_xdata, jdata->options_ttl);
+    }
+    cij_debug_printf(CIJ_INFO_LEVEL, "service '%s': Preview %d, Transfer-Preview '%s', Transfer-Ignore '%s', Transfer-Complete '%s'",
+        jdata->name, jdata->preview_size,
+        jdata->transfer_preview ? jdata->transfer_preview : "", jdata->transfer_ignore ? jdata->transfer_ignore : "",
+        jdata->transfer_complete ? jdata->transfer_complete : "");
+    return CI_SERVICE_OK;
+}
+
+/**
+ * initialize service OPTIONS parameter after post_init_java_handler(struct ci_server_conf * server_conf) called.<br>
+ * prev = post_init_java_handler(struct ci_server_conf * server_conf)<br>
+ * next = SERVICE IN<br>
+ *
+ * @see post_init_java_handler(struct ci_server_conf * server_conf)
+ * @param srv_xdata a pointer holds service parameter.
+ * @param server_conf a pointer of server configuration.
+ * @return CI_SERVICE_OK
+ */
+int java_post_init_service(ci_service_xdata_t * srv_xdata, struct ci_server_conf * server_conf) {
+    return 0;
+}
+
+/**
+ * Create a body store of the service.<br>
+ * it is kept in memory up to BodyMaxMem (capped by c-icap's MaxMemObject) and spilled to a temporary file above.<br>
+ *
+ * @param jdata the service
+ * @return a new cached file or NULL
+ */
+static ci_cached_file_t * cij_body_new(jData_t * jdata) {
+    ci_off_t size = jdata->body_max_mem;
+    if (size <= 0 || size > CI_BODY_MAX_MEM) {
+        size = CI_BODY_MAX_MEM;
+    }
+    return ci_cached_file_new((int)size);
+}
+
+/**
+ * Get the stored http body as one memory region for java.<br>
+ * a body in memory is returned as is, a spilled body is mmap()ed read only.<br>
+ *
+ * @see cij_body_unmap(char * data, size_t length, int mapped)
+ * @param body the body store
+ * @param data start of the body
+ * @param length body byte length
+ * @param mapped 1 if data must be unmapped by cij_body_unmap
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_body_map(ci_cached_file_t * body, char ** data, size_t * length, int * mapped) {
+    ci_off_t size = ci_cached_file_size(body);
+    *mapped = 0;
+    if (size > INT_MAX) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "http body (%lld bytes) is too large for java.", (long long)size);
+        return CI_ERROR;
+    }
+    *length = (size_t)size;
+    if (size == 0) {
+        *data = cij_empty;
+        return CI_OK;
+    }
+    if (body->fd < 0) {
+        *data = body->buf;
+        return CI_OK;
+    }
+    void * addr = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, body->fd, 0);
+    if (addr == MAP_FAILED) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not mmap http body file %s (%d).", body->filename, errno);
+        return CI_ERROR;
+    }
+    *data = (char *)addr;
+    *mapped = 1;
+    return CI_OK;
+}
+
+/**
+ * Release memory got by cij_body_map().<br>
+ *
+ * @see cij_body_map(ci_cached_file_t * body, char ** data, size_t * length, int * mapped)
+ */
+static void cij_body_unmap(char * data, size_t length, int mapped) {
+    if (mapped) {
+        munmap(data, length);
+    }
+}
+
+/**
+ * Content-Encoding of the encapsulated http message that DecodeBody can inflate.<br>
+ *
+ * @param req a pointer of request data.
+ * @return CIJ_ENCODING_GZIP, CIJ_ENCODING_DEFLATE or 0 for identity and the others (br, stacked encodings, ...)
+ */
+static int cij_content_encoding(ci_request_t * req) {
+    ci_headers_list_t * hdrs = cij_service_headers(req);
+    const char * value = hdrs != NULL ? ci_headers_value(hdrs, "Content-Encoding") : NULL;
+    if (value == NULL) {
+        return 0;
+    }
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    size_t length = strcspn(value, " \t\r\n");
+    if (value[length + strspn(value + length, " \t\r\n")] != '\0') {
+        return 0;
+    }
+    if ((length == 4 && strncasecmp(value, "gzip", 4) == 0) || (length == 6 && strncasecmp(value, "x-gzip", 6) == 0)) {
+        return CIJ_ENCODING_GZIP;
+    }
+    if (length == 7 && strncasecmp(value, "deflate", 7) == 0) {
+        return CIJ_ENCODING_DEFLATE;
+    }
+    return 0;
+}
+
+/**
+ * Create a zlib stream.<br>
+ * a deflater is ready to use, an inflater is initialized by the first bytes in cij_decode().<br>
+ *
+ * @param arena the arena of the request
+ * @param encoding CIJ_ENCODING_GZIP or CIJ_ENCODING_DEFLATE
+ * @param deflater 1 to compress, 0 to decompress
+ * @return a new codec or NULL
+ */
+static cij_codec_t * cij_codec_new(cij_arena_t * arena, int encoding, int deflater) {
+    cij_codec_t * codec = (cij_codec_t *)cij_arena_calloc(arena, sizeof(cij_codec_t));
+    if (codec == NULL) {
+        return NULL;
+    }
+    codec->encoding = encoding;
+    codec->deflater = deflater;
+    if (deflater) {
+        //modified bodies are compressed on the way out. speed over ratio.
+        int bits = encoding == CIJ_ENCODING_GZIP ? 15 + 16 : 15;
+        if (deflateInit2(&(codec->z), Z_BEST_SPEED, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return NULL;
+        }
+        codec->started = 1;
+    }
+    return codec;
+}
+
+/**
+ * End the zlib stream of a codec created by cij_codec_new(). its memory goes with the arena.<br>
+ */
+static void cij_codec_free(cij_codec_t * codec) {
+    if (codec == NULL) {
+        return;
+    }
+    if (codec->started) {
+        if (codec->deflater) {
+            deflateEnd(&(codec->z));
+        } else {
+            inflateEnd(&(codec->z));
+        }
+    }
+}
+
+/**
+ * Give up decoding a body which zlib can't inflate: a wrong Content-Encoding, a corrupt stream or an unknown format.
+ * java sees the http body as is, like without DecodeBody, and the prescan starts over on it.<br>
+ *
+ * @param jServiceData service data of the request
+ * @param ret zlib error
+ * @return CI_OK or CI_ERROR if the http body can't be read
+ */
+static int cij_decode_fail(jServiceData_t * jServiceData, int ret) {
+    cij_codec_t * codec = jServiceData->decoder;
+    cij_debug_printf(CIJ_WARN_LEVEL, "Could not inflate http body for %s (%d). passed as is.", jServiceData->jdata->name, ret);
+    codec->failed = 1;
+    if (jServiceData->jdata->prescan == NULL) {
+        return CI_OK;
+    }
+    jServiceData->prescan_state = 0;
+    jServiceData->prescan_offset = 0;
+    jServiceData->prescan_used = 0;
+    jServiceData->prescan_total = 0;
+    jServiceData->prescan_delivered = 0;
+    char * data;
+    size_t length;
+    int mapped;
+    if (cij_body_map(jServiceData->buffer, &data, &length, &mapped) != CI_OK) {
+        return CI_ERROR;
+    }
+    cij_prescan_feed(jServiceData, data, length);
+    cij_body_unmap(data, length, mapped);
+    return CI_OK;
+}
+
+/**
+ * Inflate a chunk of the http body as it arrives and append it to the decoded body.<br>
+ * "deflate" is zlib framed by the RFC but raw deflate by some servers, told apart by the first two bytes.<br>
+ * bodies inflating above DecodeMaxSize, or above DecodeMaxRatio times the encoded size, are rejected.<br>
+ * a truncated stream ends the decoded body where it stops, as browsers do. other zlib errors fall back
+ * to the http body. see cij_decode_fail(jServiceData_t * jServiceData, int ret)<br>
+ *
+ * @param jServiceData service data of the request
+ * @param data encoded chunk
+ * @param length chunk byte length
+ * @param eof end of the http body
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_decode(jServiceData_t * jServiceData, const char * data, int length, int eof) {
+    jData_t * jdata = jServiceData->jdata;
+    cij_codec_t * codec = jServiceData->decoder;
+    if (codec->failed) {
+        cij_prescan_feed(jServiceData, data, length > 0 ? length : 0);
+        return CI_OK;
+    }
+    if (!codec->started && length > 0) {
+        int bits = 15 + 32;//gzip or zlib
+        if (codec->encoding == CIJ_ENCODING_DEFLATE && length >= 2) {
+            unsigned int cmf = (unsigned char)data[0];
+            unsigned int flg = (unsigned char)data[1];
+            if ((cmf & 0x0f) != Z_DEFLATED || ((cmf << 8) | flg) % 31 != 0) {
+                bits = -15;//raw
+            }
+        }
+        int ret = inflateInit2(&(codec->z), bits);
+        if (ret != Z_OK) {
+            return cij_decode_fail(jServiceData, ret);
+        }
+        codec->started = 1;
+    }
+    if (codec->started && !codec->finished && length > 0) {
+        codec->z.next_in = (Bytef *)data;
+        codec->z.avail_in = length;
+        do {
+            codec->z.next_out = (Bytef *)codec->buf;
+            codec->z.avail_out = sizeof(codec->buf);
+            int ret = inflate(&(codec->z), Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                return cij_decode_fail(jServiceData, ret);
+            }
+            int n = sizeof(codec->buf) - codec->z.avail_out;
+            uLong total_out = codec->z.total_out;
+            if ((jdata->decode_max_size > 0 && (ci_off_t)total_out > jdata->decode_max_size)
+                || (jdata->decode_max_ratio > 0 && total_out > CIJ_DECODE_RATIO_FLOOR && total_out / (codec->z.total_in + 1) >= (uLong)jdata->decode_max_ratio)) {
+                cij_debug_printf(CIJ_WARN_LEVEL, "http body for %s inflates %lu bytes from %lu bytes. rejected as a decompression bomb.", jdata->name, total_out, codec->z.total_in);
+                return CI_ERROR;
+            }
+            if (n > 0 && ci_cached_file_write(jServiceData->decoded, codec->buf, n, 0) < 0) {
+                cij_debug_printf(CIJ_ERROR_LEVEL, "Could not store decoded http body.");
+                return CI_ERROR;
+            }
+            cij_prescan_feed(jServiceData, codec->buf, n);
+            if (ret == Z_STREAM_END) {
+                codec->finished = 1;//trailing bytes are ignored
+                break;
+            }
+            if (ret == Z_BUF_ERROR && n == 0) {
+                break;
+            }
+        } while (codec->z.avail_in > 0 || codec->z.avail_out == 0);
+    }
+    if (eof) {
+        if (!codec->finished && codec->z.total_in > 0) {
+            cij_debug_printf(CIJ_DEBUG_LEVEL, "http body for %s ends in the middle of the compressed stream.", jdata->name);
+        }
+        if (ci_cached_file_write(jServiceData->decoded, NULL, 0, 1) < 0) {
+            return CI_ERROR;
+        }
+    }
+    return CI_OK;
+}
+
+/**
+ * the body java sees: the decoded body if DecodeBody inflated it, otherwise the http body.<br>
+ */
+static ci_cached_file_t * cij_java_body(jServiceData_t * jServiceData) {
+    return jServiceData->decoded != NULL && !jServiceData->decoder->failed ? jServiceData->decoded : jServiceData->buffer;
+}
+
+/**
+ * Create java String[] of http headers.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param hdrs http headers
+ * @return local ref of String[] or NULL
+ */
+static jobjectArray cij_new_headers(JNIEnv * jni, ci_headers_list_t * hdrs) {
+    jobjectArray jHeaders = (*jni)->NewObjectArray(jni, hdrs != NULL ? hdrs->used : 0, cij_class_string, NULL);
+    if (jHeaders == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not allocate memory for http headers. ignoring...");
+        (*jni)->ExceptionClear(jni);
+        return NULL;
+    }
+    int i;
+    for(i=0;hdrs != NULL && i<hdrs->used;i++) {
+        jstring buf = (*jni)->NewStringUTF(jni, hdrs->headers[i]);
+        if (buf == NULL) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "Could not allocate memory for http headers string. ignoring...");
+            (*jni)->ExceptionClear(jni);
+            (*jni)->DeleteLocalRef(jni, jHeaders);
+            return NULL;
+        }
+        (*jni)->SetObjectArrayElement(jni, jHeaders, i, buf);
+        (*jni)->DeleteLocalRef(jni, buf);
+    }
+    return jHeaders;
+}
+
+/**
+ * Give back a service instance got by cij_instance_acquire().<br>
+ * it goes to the pool if the class has reset() and the pool has room, otherwise it is dropped.<br>
+ *
+ * @see cij_instance_acquire(JNIEnv * jni, jServiceData_t * jServiceData, ci_headers_list_t * hdrs)
+ * @param jni JNIEnv of the current thread
+ * @param klass the version of the class the instance belongs to
+ * @param jInstance global ref of the instance
+ * @param reusable 0 if the instance must not be reused
+ */
+static void cij_instance_release(JNIEnv * jni, cij_class_t * klass, jobject jInstance, int reusable) {
+    jData_t * jdata = klass->jdata;
+    if (reusable && klass->pool != NULL) {
+        pthread_mutex_lock(&(jdata->pool_mutex));
+        if (klass->pool_used < jdata->pool_size) {
+            klass->pool[(klass->pool_used)++] = jInstance;
+            jInstance = NULL;
+        }
+        pthread_mutex_unlock(&(jdata->pool_mutex));
+    }
+    if (jInstance != NULL) {
+        (*jni)->DeleteGlobalRef(jni, jInstance);
+    }
+}
+
+/**
+ * Get a service instance for a request.<br>
+ * an idle instance of the pool is reset by reset(mod_type, ...) if the class has it,
+ * otherwise a new instance is constructed by S(mod_type, ...).<br>
+ * classes with S(mod_type, long request) get the request handle for IcapRequest natives,
+ * the others get every http header as String[].<br>
+ *
+ * @see cij_instance_release(JNIEnv * jni, cij_class_t * klass, jobject jInstance, int reusable)
+ * @param jni JNIEnv of the current thread
+ * @param klass the version of the class
+ * @param mod_type ICAP_REQMOD or ICAP_RESPMOD
+ * @param jRequest request handle for IcapRequest natives. 0 in warm-up
+ * @param hdrs http headers or NULL
+ * @return global ref of the instance or NULL
+ */
+static jobject cij_instance_take(JNIEnv * jni, cij_class_t * klass, int mod_type, jlong jRequest, ci_headers_list_t * hdrs) {
+    jData_t * jdata = klass->jdata;
+    jobject jInstance = NULL;
+    if (klass->pool != NULL) {
+        pthread_mutex_lock(&(jdata->pool_mutex));
+        if (klass->pool_used > 0) {
+            jInstance = klass->pool[--(klass->pool_used)];
+        }
+        pthread_mutex_unlock(&(jdata->pool_mutex));
+    }
+
+    jstring jModType = (mod_type == ICAP_REQMOD) ? cij_jstr_reqmod : cij_jstr_respmod;
+    jobjectArray jHeaders = NULL;
+    if (klass->jServiceConstructorLazy == NULL) {
+        jHeaders = cij_new_headers(jni, hdrs);
+        if (jHeaders == NULL) {
+            if (jInstance != NULL) {
+                cij_instance_release(jni, klass, jInstance, 1);
+            }
+            return NULL;
+        }
+    }
+
+    uint64_t start = cij_now_us();
+    if (jInstance != NULL) {
+        if (klass->jResetLazy != NULL) {
+            (*jni)->CallVoidMethod(jni, jInstance, klass->jResetLazy, jModType, jRequest);
+        } else {
+            (*jni)->CallVoidMethod(jni, jInstance, klass->jReset, jModType, jHeaders);
+        }
+        if (cij_exception_check(jni, jdata, "reset")) {
+            (*jni)->DeleteGlobalRef(jni, jInstance);
+            jInstance = NULL;
+        }
+    }
+    if (jInstance == NULL) {
+        jobject jLocal;
+        if (klass->jServiceConstructorLazy != NULL) {
+            jLocal = (*jni)->NewObject(jni, klass->jIcapClass, klass->jServiceConstructorLazy, jModType, jRequest);
+        } else {
+            jLocal = (*jni)->NewObject(jni, klass->jIcapClass, klass->jServiceConstructor, jModType, jHeaders);
+        }
+        if (cij_exception_check(jni, jdata, "<init>") == 0 && jLocal != NULL) {
+            jInstance = (*jni)->NewGlobalRef(jni, jLocal);//FREEME
+        }
+        (*jni)->DeleteLocalRef(jni, jLocal);
+    }
+    cij_stat_call(jdata, CIJ_CALL_CONSTRUCTOR, start);
+    (*jni)->DeleteLocalRef(jni, jHeaders);
+    return jInstance;
+}
+
+/**
+ * Get a service instance for a request of c-icap, on the version of the class the request runs on.<br>
+ *
+ * @see cij_instance_take(JNIEnv * jni, cij_class_t * klass, int mod_type, jlong jRequest, ci_headers_list_t * hdrs)
+ */
+static jobject cij_instance_acquire(JNIEnv * jni, jServiceData_t * jServiceData, ci_headers_list_t * hdrs) {
+    return cij_instance_take(jni, jServiceData->klass, ci_req_type(jServiceData->req), cij_request_handle(jServiceData), hdrs);
+}
+
+/**
+ * Evaluate Bypass* rules of the service. runs before any java call.<br>
+ * Content-Type and Content-Length are of the request for REQMOD, of the response for RESPMOD.<br>
+ *
+ * @param jdata the service
+ * @param req a pointer of request data.
+ * @return 1 if the request should not be scanned
+ */
+static int cij_bypass(jData_t * jdata, ci_request_t * req) {
+    if (jdata->bypass_max_length > 0 || jdata->bypass_min_length > 0) {
+        ci_off_t length = ci_http_content_length(req);
+        if (length >= 0 && ((jdata->bypass_max_length > 0 && length > jdata->bypass_max_length)
+                || (jdata->bypass_min_length > 0 && length < jdata->bypass_min_length))) {
+            return 1;
+        }
+    }
+    if (jdata->bypass_content_type.used > 0) {
+        ci_headers_list_t * hdrs = cij_service_headers(req);
+        const char * type = hdrs ? ci_headers_value(hdrs, "Content-Type") : NULL;
+        if (type != NULL) {
+            size_t length = strcspn(type, ";");//drop parameters
+            while (length > 0 && isspace((unsigned char)type[length - 1])) {
+                length--;
+            }
+            if (cij_patterns_match(&(jdata->bypass_content_type), type, length)) {
+                return 1;
+            }
+        }
+    }
+    if (jdata->bypass_method.used > 0) {
+        const char * line = ci_http_request(req);
+        if (line != NULL && cij_patterns_match(&(jdata->bypass_method), line, strcspn(line, " "))) {
+            return 1;
+        }
+    }
+    if (jdata->bypass_host.used > 0) {
+        const char * host = ci_http_request_get_header(req, "Host");
+        if (host != NULL && cij_patterns_match(&(jdata->bypass_host), host, strcspn(host, ":"))) {
+            return 1;
+        }
+    }
+    if (jdata->bypass_url.used > 0) {
+        char url[CIJ_MAX_URL];
+        if (ci_http_request_url(req, url, sizeof(url)) > 0 && cij_patterns_match(&(jdata->bypass_url), url, strnlen(url, sizeof(url)))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Open a local frame for the JNI calls of a handler.<br>
+ * worker threads stay attached, so local refs left by any path (failures included) would pile up until the thread exits.
+ * popping the frame releases them at once.<br>
+ *
+ * @see cij_frame_pop(JNIEnv * jni)
+ * @param jServiceData service data of the request
+ * @return JNIEnv to pop the frame with, or NULL if bypassed or no frame was opened
+ */
+static JNIEnv * cij_frame_push(jServiceData_t * jServiceData) {
+    if (jServiceData == NULL || jServiceData->klass == NULL) {
+        return NULL;
+    }
+    JNIEnv * jni = cij_service_env(jServiceData->jdata);
+    if (jni == NULL || (*jni)->PushLocalFrame(jni, CIJ_LOCAL_FRAME) != 0) {
+        if (jni != NULL) {
+            (*jni)->ExceptionClear(jni);
+        }
+        return NULL;
+    }
+    return jni;
+}
+
+/**
+ * Close a local frame opened by cij_frame_push().<br>
+ */
+static void cij_frame_pop(JNIEnv * jni) {
+    if (jni != NULL) {
+        (*jni)->PopLocalFrame(jni, NULL);
+    }
+}
+
+/**
+ * initialize ICAP Request.<br>
+ * prev = recv Request<br>
+ * next = java_check_preview_handler(char * preview_data, int preview_data_len, ci_request_t * req)<br>
+ *
+ * @see java_check_preview_handler(char * preview_data, int preview_data_len, ci_request_t * req)
+ * @param req a pointer of request data.
+ * @return service_data instance if OK else returns NULL(pass)
+ */
+void * java_init_request_data(ci_request_t * req) {
     const int REQ_TYPE = ci_req_type(req);
     const char * METHOD_TYPE = ci_method_string(REQ_TYPE);//Don't free!
 
-    ci_headers_list_t *hdrs = NULL;
+    ci_headers_list_t *hdrs = NULL;
+
+    //identify reqmod or respmod or else
+    if (REQ_TYPE == ICAP_REQMOD || REQ_TYPE == ICAP_RESPMOD) {
+        hdrs = cij_service_headers(req);
+    } else if (REQ_TYPE == ICAP_OPTIONS){
+        cij_debug_printf(CIJ_INFO_LEVEL, "ICAP OPTIONS comes. ignoring...");
+        return NULL;//pass
+    } else {
+        //UNKNOWN ICAP METHOD
+        cij_debug_printf(CIJ_INFO_LEVEL, "INVALID ICAP METHOD (NO. %d) has come. ignoring...", REQ_TYPE);
+        return NULL;//pass
+    }
+
+    //Create service_data. everything native of the request is released with its arena
+    jServiceData_t * jServiceData = NULL;
+    cij_arena_t * arena = cij_arena_new();
+    jServiceData = arena != NULL ? (jServiceData_t *)cij_arena_calloc(arena, sizeof(jServiceData_t)) : NULL;
+    if (jServiceData == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Unable to allocate memory for jServiceData_t !");
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Dropping request...");
+        if (arena != NULL) {
+            cij_arena_release(arena);
+        }
+        return NULL;
+    }
+    jServiceData->arena = arena;
+
+    //Get Java service of the request
+    const char * mod_name = (req->current_service_mod)->mod_name;
+    jData_t * jdata = (jData_t *)(req->current_service_mod)->mod_data;
+
+    jServiceData->jdata = jdata;
+    jServiceData->req = req;
+    cij_stat_inc(jdata->stat_requests, 1);
+    if (cij_bypass(jdata, req)) {
+        cij_stat_inc(jdata->stat_bypass, 1);
+        //no JVM at all. the body is held and sent back as is unless 204 is allowed
+        cij_debug_printf(CIJ_DEBUG_LEVEL, "request bypasses service '%s'.", mod_name);
+        jServiceData->bypass = 1;
+        jServiceData->buffer = cij_body_new(jdata);//FREEME
+        if (jServiceData->buffer == NULL) {
+            java_release_request_data(jServiceData);
+            return NULL;
+        }
+        return (void *)jServiceData;
+    }
+
+    if (cij_conf_sidecar != NULL) {
+        //java runs in the sidecar process. the body is buffered like a class without onData()
+        jServiceData->sidecar = 1;
+    } else {
+        //Attach service instance to JVM
+        JNIEnv * jni = cij_service_env(jdata);
+        if (jni == NULL) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "JavaVM is not available for service '%s'. ignoring...", mod_name);
+            java_release_request_data(jServiceData);
+            return NULL;
+        }
+
+        cij_class_t * klass = cij_class_acquire(jni, jdata);
+        jServiceData->klass = klass;
+        if ((jdata->cache == NULL && jdata->prescan == NULL && klass->jPreviewBatch == NULL) || klass->jOnData != NULL) {
+            //the instance is constructed at the first java call if the verdict may come from the cache, the prescan or a batch
+            JNIEnv * frame = cij_frame_push(jServiceData);
+            jServiceData->instance = cij_instance_acquire(jni, jServiceData, hdrs);
+            cij_frame_pop(frame);
+            if (jServiceData->instance == NULL) {
+                cij_debug_printf(CIJ_ERROR_LEVEL, "Could not create instance of the class '%s'. Method='%s'. ignoring...", mod_name, METHOD_TYPE);
+                java_release_request_data(jServiceData);
+                return NULL;
+            }
+        }
+        if (klass->jOnData != NULL) {
+            return (void *)jServiceData;//streaming mode does not hold the body
+        }
+    }
+    ci_cached_file_t * buffer = cij_body_new(jdata);//FREEME
+    if (buffer == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not allocate memory for http body ignoring...");
+        java_release_request_data(jServiceData);
+        return NULL;
+    }
+    jServiceData->buffer = buffer;
+    int encoding = jdata->decode ? cij_content_encoding(req) : 0;
+    if (encoding != 0) {
+        jServiceData->decoder = cij_codec_new(jServiceData->arena, encoding, 0);
+        jServiceData->decoded = cij_body_new(jdata);//FREEME
+        if (jServiceData->decoder == NULL || jServiceData->decoded == NULL) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "Could not allocate memory for decoded http body ignoring...");
+            java_release_request_data(jServiceData);
+            return NULL;
+        }
+    }
+    if (jdata->cache != NULL) {
+        //the key covers mod type, url and body
+        char url[CIJ_MAX_URL];
+        int url_len = ci_http_request_url(req, url, sizeof(url));
+        cij_siphash_init(&(jServiceData->digest));
+        cij_siphash_update(&(jServiceData->digest), METHOD_TYPE, strlen(METHOD_TYPE) + 1);
+        cij_siphash_update(&(jServiceData->digest), url, url_len > 0 ? strnlen(url, sizeof(url)) + 1 : 0);
+    }
+    return (void *)jServiceData;
+}
+
+/**
+ * Get the service instance of the request, constructing it at the first call
+ * when java_init_request_data(ci_request_t * req) has left it to a verdict cache miss.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jServiceData service data of the request
+ * @return global ref of the instance or NULL
+ */
+static jobject cij_service_instance(JNIEnv * jni, jServiceData_t * jServiceData) {
+    if (jServiceData->instance == NULL) {
+        jServiceData->instance = cij_instance_acquire(jni, jServiceData, cij_service_headers(jServiceData->req));
+        if (jServiceData->instance == NULL) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "Could not create instance of the class '%s'.", jServiceData->jdata->name);
+        }
+    }
+    return jServiceData->instance;
+}
+
+/**
+ * copy a verdict out of the cache into the arena of the request given as data.<br>
+ */
+static void * cij_verdict_dup(const void * stored_val, size_t stored_val_size, void * data) {
+    if (stored_val_size < 1) {
+        return NULL;
+    }
+    cij_verdict_t * verdict = (cij_verdict_t *)cij_arena_calloc((cij_arena_t *)data, sizeof(cij_verdict_t) + stored_val_size);
+    if (verdict != NULL) {
+        verdict->size = stored_val_size;
+        memcpy(verdict->data, stored_val, stored_val_size);
+    }
+    return verdict;
+}
+
+/**
+ * Search the verdict cache by mod type, url and the digest of the whole body. once per request.<br>
+ * must be called after all of the body has been received.<br>
+ *
+ * @param jServiceData service data of the request
+ * @return the verdict or NULL if missed
+ */
+static cij_verdict_t * cij_verdict_lookup(jServiceData_t * jServiceData) {
+    if (jServiceData->looked_up) {
+        return jServiceData->verdict;
+    }
+    jServiceData->looked_up = 1;
+    uint64_t digest[2];
+    cij_siphash_final(&(jServiceData->digest), digest);
+    snprintf(jServiceData->key, sizeof(jServiceData->key), "%c%016llx%016llx",
+        ci_req_type(jServiceData->req) == ICAP_REQMOD ? 'Q' : 'S', (unsigned long long)digest[0], (unsigned long long)digest[1]);
+    void * verdict = NULL;
+    ci_cache_search(jServiceData->jdata->cache, jServiceData->key, &verdict, jServiceData->arena, cij_verdict_dup);
+    jServiceData->verdict = (cij_verdict_t *)verdict;
+    cij_stat_inc(verdict != NULL ? jServiceData->jdata->stat_cache_hit : jServiceData->jdata->stat_cache_miss, 1);
+    return jServiceData->verdict;
+}
+
+/**
+ * Byte size of header lines including the terminating empty line.<br>
+ *
+ * @see cij_header_lines(JNIEnv * jni, jobjectArray jLines)
+ */
+static size_t cij_header_lines_size(const char * lines) {
+    const char * line = lines;
+    while (*line != '\0') {
+        line += strlen(line) + 1;
+    }
+    return line - lines + 1;
+}
+
+/**
+ * Store the verdict of java to the cache.<br>
+ *
+ * @param jServiceData service data of the request
+ * @param jni JNIEnv of the current thread. unused if not modified
+ * @param jResult the modified body or NULL if not modified
+ * @param headers header changes of java or NULL
+ */
+static void cij_verdict_store(jServiceData_t * jServiceData, JNIEnv * jni, jbyteArray jResult, const char * headers) {
+    jData_t * jdata = jServiceData->jdata;
+    if (jdata->cache == NULL || !jServiceData->looked_up) {
+        return;
+    }
+    if (jResult == NULL) {
+        const char verdict = CIJ_VERDICT_NOT_MODIFIED;
+        ci_cache_update(jdata->cache, jServiceData->key, &verdict, 1, NULL);
+        return;
+    }
+    jsize length = (*jni)->GetArrayLength(jni, jResult);
+    size_t headers_size = headers != NULL ? cij_header_lines_size(headers) : 0;
+    if ((ci_off_t)(length + headers_size + 1) > jdata->cache_max_object) {
+        return;
+    }
+    char * verdict = (char *)malloc(length + headers_size + 1);//FREEME
+    if (verdict == NULL) {
+        return;
+    }
+    verdict[0] = headers != NULL ? CIJ_VERDICT_MODIFIED_HEADERS : CIJ_VERDICT_MODIFIED;
+    if (headers != NULL) {
+        memcpy(verdict + 1, headers, headers_size);
+    }
+    (*jni)->GetByteArrayRegion(jni, jResult, 0, length, (jbyte *)(verdict + 1 + headers_size));
+    ci_cache_update(jdata->cache, jServiceData->key, verdict, length + headers_size + 1, NULL);
+    free(verdict);
+}
+
+/**
+ * Convert the value returned by java preview() to c-icap's one.<br>
+ * 0 or CI_MOD_CONTINUE(100) hooks the request, CI_MOD_ALLOW204(204) unhooks it.<br>
+ *
+ * @param jdata the service
+ * @param status returned by preview()
+ * @return CI_MOD_CONTINUE, CI_MOD_ALLOW204 or CI_ERROR
+ */
+static int cij_preview_status(jData_t * jdata, jint status) {
+    switch (status) {
+    case 0:
+    case CI_MOD_CONTINUE:
+        return CI_MOD_CONTINUE;
+    case CI_MOD_ALLOW204:
+        return CI_MOD_ALLOW204;
+    default:
+        cij_debug_printf(CIJ_ERROR_LEVEL, "%s.preview(...) returned unknown status %d.", jdata->name, status);
+        return CI_ERROR;
+    }
+}
+
+/**
+ * Read-only direct view of native memory for java.<br>
+ * the body and the preview data are sent by c-icap as is, so java must not change them through the view.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param data start of the memory
+ * @param length byte length
+ * @return local ref of the ByteBuffer or NULL with the exception cleared
+ */
+static jobject cij_read_only_buffer(JNIEnv * jni, char * data, jlong length) {
+    jobject jbb = (*jni)->NewDirectByteBuffer(jni, length > 0 ? data : cij_empty, length > 0 ? length : 0);
+    jobject jView = jbb != NULL ? (*jni)->CallObjectMethod(jni, jbb, cij_read_only_method) : NULL;
+    if (jView == NULL) {
+        (*jni)->ExceptionClear(jni);
+    }
+    (*jni)->DeleteLocalRef(jni, jbb);
+    return jView;
+}
+
+/**
+ * Call java preview(ByteBuffer) or preview(byte[]) on the current thread.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param klass the version of the class of the instance
+ * @param jInstance the service instance
+ * @param preview_data preview body.
+ * @param preview_data_len preview body byte length.
+ * @param discard set to 1 if java threw an exception
+ * @return CI_MOD_CONTINUE, CI_MOD_ALLOW204 or CI_ERROR. CI_MOD_CONTINUE if the class has no preview()
+ */
+static int cij_invoke_preview(JNIEnv * jni, cij_class_t * klass, jobject jInstance, char * preview_data, int preview_data_len, int * discard) {
+    jData_t * jdata = klass->jdata;
+    jint status;
+    if (klass->jPreviewDirect != NULL) {
+        //Call int preview(ByteBuffer). the read-only view points the preview buffer and is valid only while preview() runs.
+        jobject jbb = cij_read_only_buffer(jni, preview_data, preview_data_len);
+        if (jbb == NULL) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "Could not create direct buffer for preview_data. ignoring...");
+            return CI_ERROR;
+        }
+        uint64_t start = cij_now_us();
+        status = (*jni)->CallIntMethod(jni, jInstance, klass->jPreviewDirect, jbb);
+        cij_stat_call(jdata, CIJ_CALL_PREVIEW, start);
+        (*jni)->DeleteLocalRef(jni, jbb);
+    } else if (klass->jPreview != NULL) {
+        //convert C-char* to Java-byte[]. the array of the thread is reused
+        jbyteArray jba = cij_preview_array(jni, preview_data_len);
+        if (jba == NULL) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "Could not allocate memory for preview_data byte array object. ignoring...");
+            (*jni)->ExceptionClear(jni);
+            return CI_ERROR;
+        }
+        (*jni)->SetByteArrayRegion(jni, jba, 0, preview_data_len, (const jbyte *)preview_data);
+        //Call int preview(byte[])
+        uint64_t start = cij_now_us();
+        status = (*jni)->CallIntMethod(jni, jInstance, klass->jPreview, jba);
+        cij_stat_call(jdata, CIJ_CALL_PREVIEW, start);
+    } else {
+        return CI_MOD_CONTINUE;
+    }
+    if (cij_exception_check(jni, jdata, "preview")) {
+        *discard = 1;
+        return CI_ERROR;
+    }
+    return cij_preview_status(jdata, status);
+}
+
+/**
+ * Call java onMatches(int[] ids, long[] offsets) with the PrescanPatterns matches found so far,
+ * if the class has it and there are new ones since the last call.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jServiceData service data of the request
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_invoke_matches(JNIEnv * jni, jServiceData_t * jServiceData) {
+    cij_class_t * klass = jServiceData->klass;
+    int n = jServiceData->prescan_used;
+    if (klass->jOnMatches == NULL || jServiceData->prescan_total == jServiceData->prescan_delivered) {
+        return CI_OK;
+    }
+    jServiceData->prescan_delivered = jServiceData->prescan_total;
+    if (n == 0) {
+        return CI_OK;//the matches could not be kept
+    }
+    jint * ids = (jint *)cij_arena_calloc(jServiceData->arena, n * (sizeof(jint) + sizeof(jlong)));
+    jintArray jIds = (*jni)->NewIntArray(jni, n);
+    jlongArray jOffsets = (*jni)->NewLongArray(jni, n);
+    if (ids == NULL || jIds == NULL || jOffsets == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not allocate memory for prescan matches. ignoring...");
+        (*jni)->ExceptionClear(jni);
+        (*jni)->DeleteLocalRef(jni, jIds);
+        (*jni)->DeleteLocalRef(jni, jOffsets);
+        return CI_ERROR;
+    }
+    jlong * offsets = (jlong *)(ids + n);
+    int i;
+    for (i = 0; i < n; i++) {
+        ids[i] = jServiceData->prescan_matches[i].id;
+        offsets[i] = jServiceData->prescan_matches[i].offset;
+    }
+    (*jni)->SetIntArrayRegion(jni, jIds, 0, n, ids);
+    (*jni)->SetLongArrayRegion(jni, jOffsets, 0, n, offsets);
+    (*jni)->CallVoidMethod(jni, jServiceData->instance, klass->jOnMatches, jIds, jOffsets);
+    (*jni)->DeleteLocalRef(jni, jIds);
+    (*jni)->DeleteLocalRef(jni, jOffsets);
+    if (cij_exception_check(jni, jServiceData->jdata, "onMatches")) {
+        jServiceData->discard = 1;
+        return CI_ERROR;
+    }
+    return CI_OK;
+}
+
+/**
+ * Convert header changes returned by java headers() to C.<br>
+ * lines are NUL terminated and followed by an empty line. null elements are skipped.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jLines String[] of "Name: value" lines
+ * @return header lines or NULL if none
+ */
+static char * cij_header_lines(JNIEnv * jni, jobjectArray jLines) {
+    jsize count = (*jni)->GetArrayLength(jni, jLines);
+    char * lines = NULL;
+    size_t used = 0;
+    jsize i;
+    for (i = 0; i < count; i++) {
+        jstring jLine = (jstring)(*jni)->GetObjectArrayElement(jni, jLines, i);
+        if (jLine == NULL) {
+            continue;
+        }
+        const char * line = (*jni)->GetStringUTFChars(jni, jLine, NULL);//FREEME
+        if (line != NULL) {
+            size_t len = strlen(line);
+            char * grown = (char *)realloc(lines, used + len + 2);//FREEME
+            if (grown != NULL) {
+                lines = grown;
+                memcpy(lines + used, line, len + 1);
+                used += len + 1;
+                lines[used] = '\0';
+            }
+            (*jni)->ReleaseStringUTFChars(jni, jLine, line);
+        }
+        (*jni)->DeleteLocalRef(jni, jLine);
+    }
+    return lines;
+}
+
+/**
+ * Call java service(ByteBuffer) or service(byte[]) on the current thread.<br>
+ * headers() follows if the body was modified and the class has it.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param klass the version of the class of the instance
+ * @param jInstance the service instance
+ * @param data http body
+ * @param length http body byte length
+ * @param jResult local ref of the modified body, NULL if not modified
+ * @param headers header changes of java or NULL. see cij_header_lines(JNIEnv * jni, jobjectArray jLines)
+ * @param discard set to 1 if java threw an exception
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_invoke_service(JNIEnv * jni, cij_class_t * klass, jobject jInstance, char * data, size_t length, jbyteArray * jResult, char ** headers, int * discard) {
+    jData_t * jdata = klass->jdata;
+    jobject jBody;
+    jmethodID jService;
+    *jResult = NULL;
+    *headers = NULL;
+    if (klass->jServiceDirect != NULL) {
+        //read-only view of the body in memory or mapped from the spilled file. valid only while service() runs.
+        jBody = cij_read_only_buffer(jni, data, length);
+        jService = klass->jServiceDirect;
+    } else {
+        jBody = (*jni)->NewByteArray(jni, length);
+        if (jBody != NULL) {
+            (*jni)->SetByteArrayRegion(jni, (jbyteArray)jBody, 0, length, (const jbyte *)data);
+        }
+        jService = klass->jService;
+    }
+    if (jBody == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not create java object for http body. ignoring...");
+        (*jni)->ExceptionClear(jni);
+        return CI_ERROR;
+    }
+    uint64_t start = cij_now_us();
+    jbyteArray jModified = (jbyteArray)(*jni)->CallObjectMethod(jni, jInstance, jService, jBody);
+    cij_stat_call(jdata, CIJ_CALL_SERVICE, start);
+    (*jni)->DeleteLocalRef(jni, jBody);
+    if (cij_exception_check(jni, jdata, "service")) {
+        *discard = 1;
+        return CI_ERROR;
+    }
+    if (jModified != NULL && klass->jHeaders != NULL) {
+        jobjectArray jLines = (jobjectArray)(*jni)->CallObjectMethod(jni, jInstance, klass->jHeaders);
+        if (cij_exception_check(jni, jdata, "headers")) {
+            *discard = 1;
+            (*jni)->DeleteLocalRef(jni, jModified);
+            return CI_ERROR;
+        }
+        if (jLines != NULL) {
+            *headers = cij_header_lines(jni, jLines);//FREEME
+            (*jni)->DeleteLocalRef(jni, jLines);
+        }
+    }
+    *jResult = jModified;
+    return CI_OK;
+}
+
+#define CIJ_JOB_PREVIEW 1
+#define CIJ_JOB_SERVICE 2
+
+/**
+ * a java call handed to the executor of the service.<br>
+ * the job owns everything java reads, so that the request can give it up at the deadline
+ * and go on while java is still running. the last of the waiter and the executor frees it.
+ */
+typedef struct cijJobStruct {
+    struct cijJobStruct * next;
+    jData_t * jdata;
+    int kind;//CIJ_JOB_PREVIEW or CIJ_JOB_SERVICE
+    cij_class_t * klass;//own reference of the version of the instance
+    jobject instance;//own global ref of the service instance
+    char * data;//copy of the preview, or the body. see cij_body_snapshot(ci_cached_file_t * body, char ** data, size_t * length, int * mapped)
+    size_t length;
+    int mapped;//data is mapped, not allocated
+    int status;//CI_MOD_CONTINUE/CI_MOD_ALLOW204/CI_ERROR for preview, CI_OK/CI_ERROR for service
+    jobject result;//global ref of the modified body
+    char * headers;//header changes of java
+    int discard;//java threw an exception
+    int done;
+    int refs;//waiter and executor
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} cij_job_t;
+
+/**
+ * a sample request of the warm-up corpus (WarmupDir).<br>
+ */
+typedef struct cijSampleStruct {
+    int mod_type;//ICAP_REQMOD or ICAP_RESPMOD
+    ci_headers_list_t * hdrs;//NULL if the file has no http header
+    char * data;//the whole file
+    char * body;//in data
+    size_t length;
+} cij_sample_t;
+
+/**
+ * Load a sample of the warm-up corpus.<br>
+ * a file starting with a status line ("HTTP/1.1 200 OK") is a response for RESPMOD, a file starting with a request line
+ * ("GET / HTTP/1.1") is a request for REQMOD. the header lines end with an empty line and the rest is the body.
+ * any other file is a RESPMOD body without headers.<br>
+ *
+ * @param path the file
+ * @param sample loaded sample
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_sample_load(const char * path, cij_sample_t * sample) {
+    struct stat st;
+    memset(sample, 0, sizeof(cij_sample_t));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return CI_ERROR;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > CIJ_WARMUP_MAX_SAMPLE) {
+        close(fd);
+        return CI_ERROR;
+    }
+    sample->data = (char *)malloc(st.st_size + 1);//FREEME by cij_sample_free()
+    if (sample->data == NULL || read(fd, sample->data, st.st_size) != st.st_size) {
+        close(fd);
+        free(sample->data);
+        sample->data = NULL;
+        return CI_ERROR;
+    }
+    close(fd);
+    sample->data[st.st_size] = '\0';
+    sample->mod_type = ICAP_RESPMOD;
+    sample->body = sample->data;
+    sample->length = st.st_size;
+
+    char * eol = memchr(sample->data, '\n', st.st_size);
+    size_t first = eol != NULL ? (size_t)(eol - sample->data) : 0;
+    if (first > 0 && sample->data[first - 1] == '\r') {
+        first--;
+    }
+    int response = first > 5 && strncmp(sample->data, "HTTP/", 5) == 0;
+    int request = first > 9 && memmem(sample->data, first, " HTTP/", 6) != NULL;
+    if (!response && !request) {
+        return CI_OK;
+    }
+    sample->hdrs = ci_headers_create();
+    if (sample->hdrs == NULL) {
+        free(sample->data);
+        return CI_ERROR;
+    }
+    sample->mod_type = response ? ICAP_RESPMOD : ICAP_REQMOD;
+    char * line = sample->data;
+    char * end = sample->data + st.st_size;
+    while (line < end) {
+        eol = memchr(line, '\n', end - line);
+        char * next = eol != NULL ? eol + 1 : end;
+        char * stop = eol != NULL ? eol : end;
+        if (stop > line && stop[-1] == '\r') {
+            stop--;
+        }
+        if (stop == line) {
+            line = next;//empty line. the body follows
+            break;
+        }
+        *stop = '\0';
+        ci_headers_add(sample->hdrs, line);
+        line = next;
+    }
+    sample->body = line;
+    sample->length = end - line;
+    return CI_OK;
+}
+
+static void cij_sample_free(cij_sample_t * sample) {
+    if (sample->hdrs != NULL) {
+        ci_headers_destroy(sample->hdrs);
+    }
+    free(sample->data);
+}
+
+/**
+ * Replay the warm-up corpus (WarmupDir) through the constructor, preview() and service() of the service,
+ * so that the JIT has compiled them before the child takes its first request.
+ * stops after WarmupRequests requests or WarmupTime seconds, only the former if WarmupTime is 0 or less.
+ * the samples are replayed in turn.<br>
+ * IcapRequest natives get request 0 and return null during the warm-up.<br>
+ *
+ * @see cij_child_start(const char * name, int type, void * data)
+ * @param jdata the service
+ * @param jni JNIEnv of the current thread
+ */
+static void cij_warmup(jData_t * jdata, JNIEnv * jni) {
+    cij_sample_t * samples = NULL;
+    int used = 0;
+    int size = 0;
+    DIR * dir = opendir(jdata->warmup_dir);
+    if (dir == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to open WarmupDir '%s' of service '%s'.", jdata->warmup_dir, jdata->name);
+        return;
+    }
+    struct dirent * entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        if (used == size) {
+            size = size > 0 ? size * 2 : 16;
+            cij_sample_t * grown = (cij_sample_t *)realloc(samples, size * sizeof(cij_sample_t));//FREEME
+            if (grown == NULL) {
+                break;
+            }
+            samples = grown;
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", jdata->warmup_dir, entry->d_name);
+        if (cij_sample_load(path, &(samples[used])) == CI_OK) {
+            used++;
+        }
+    }
+    closedir(dir);
+    if (used == 0) {
+        cij_debug_printf(CIJ_WARN_LEVEL, "No sample in WarmupDir '%s' of service '%s'.", jdata->warmup_dir, jdata->name);
+        goto END_OF_WARMUP;
+    }
 
-    //identify reqmod or respmod or else
-    if (REQ_TYPE == ICAP_REQMOD) {
-        hdrs = ci_http_request_headers(req);
-    } else if (REQ_TYPE == ICAP_RESPMOD) {
-        hdrs = ci_http_response_headers(req);
-    } else if (REQ_TYPE == ICAP_OPTIONS){
-        cij_debug_printf(CIJ_INFO_LEVEL, "ICAP OPTIONS comes. ignoring...");
-        return NULL;//pass
+    cij_class_t * klass = cij_class_acquire(jni, jdata);
+    if (klass->jOnData != NULL) {
+        cij_debug_printf(CIJ_INFO_LEVEL, "service '%s' streams by onData(). no warm-up.", jdata->name);
+        cij_class_unref(jni, klass);
+        goto END_OF_WARMUP;
+    }
+    jdata->warming = 1;
+    uint64_t start = cij_now_us();
+    uint64_t deadline = start + (uint64_t)(jdata->warmup_time > 0 ? jdata->warmup_time : 0) * 1000000;
+    long requests;
+    for (requests = 0; requests < jdata->warmup_requests && (jdata->warmup_time <= 0 || cij_now_us() < deadline); requests++) {
+        cij_sample_t * sample = &(samples[requests % used]);
+        if ((*jni)->PushLocalFrame(jni, CIJ_LOCAL_FRAME) != 0) {
+            (*jni)->ExceptionClear(jni);
+            break;
+        }
+        int discard = 0;
+        jobject jInstance = cij_instance_take(jni, klass, sample->mod_type, 0, sample->hdrs);
+        if (jInstance != NULL) {
+            int preview = jdata->preview_size > 0 ? jdata->preview_size : 0;
+            if ((size_t)preview > sample->length) {
+                preview = (int)sample->length;
+            }
+            if (cij_invoke_preview(jni, klass, jInstance, sample->body, preview, &discard) == CI_MOD_CONTINUE) {
+                jbyteArray jResult = NULL;
+                char * headers = NULL;
+                cij_invoke_service(jni, klass, jInstance, sample->body, sample->length, &jResult, &headers, &discard);
+                free(headers);
+            }
+            cij_instance_release(jni, klass, jInstance, !discard);
+        }
+        (*jni)->PopLocalFrame(jni, NULL);
+    }
+    jdata->warming = 0;
+    cij_class_unref(jni, klass);
+    cij_debug_printf(CIJ_INFO_LEVEL, "service '%s' warmed up by %ld requests of %d samples in %llu ms.",
+        jdata->name, requests, used, (unsigned long long)((cij_now_us() - start) / 1000));
+
+END_OF_WARMUP:
+    while (used > 0) {
+        cij_sample_free(&(samples[--used]));
+    }
+    free(samples);
+}
+
+/**
+ * Create a job with own global ref of the instance.<br>
+ *
+ * @return the job referred by the waiter and the executor or NULL
+ */
+static cij_job_t * cij_job_new(JNIEnv * jni, jServiceData_t * jServiceData, int kind) {
+    cij_job_t * job = (cij_job_t *)calloc(1, sizeof(cij_job_t));//FREEME
+    if (job == NULL) {
+        return NULL;
+    }
+    job->instance = (*jni)->NewGlobalRef(jni, jServiceData->instance);//FREEME
+    if (job->instance == NULL) {
+        free(job);
+        return NULL;
+    }
+    job->jdata = jServiceData->jdata;
+    job->klass = cij_class_ref(jServiceData->klass);
+    job->kind = kind;
+    job->status = CI_ERROR;
+    job->refs = 2;
+    pthread_mutex_init(&(job->mutex), NULL);
+    pthread_cond_init(&(job->cond), NULL);
+    return job;
+}
+
+/**
+ * Drop a reference of the job and free it by the last one.<br>
+ */
+static void cij_job_unref(JNIEnv * jni, cij_job_t * job) {
+    pthread_mutex_lock(&(job->mutex));
+    int refs = --(job->refs);
+    pthread_mutex_unlock(&(job->mutex));
+    if (refs > 0) {
+        return;
+    }
+    if (jni != NULL) {
+        (*jni)->DeleteGlobalRef(jni, job->instance);
+        (*jni)->DeleteGlobalRef(jni, job->result);
+    }
+    cij_class_unref(jni, job->klass);
+    if (job->mapped) {
+        cij_body_unmap(job->data, job->length, job->mapped);
+    } else {
+        free(job->data);
+    }
+    free(job->headers);
+    pthread_mutex_destroy(&(job->mutex));
+    pthread_cond_destroy(&(job->cond));
+    free(job);
+}
+
+/**
+ * Run a job on an executor thread.<br>
+ */
+static void cij_job_run(JNIEnv * jni, cij_job_t * job) {
+    int status = CI_ERROR;
+    int discard = 0;
+    jobject jResult = NULL;
+    char * headers = NULL;
+    if (jni != NULL && (*jni)->PushLocalFrame(jni, CIJ_LOCAL_FRAME) != 0) {
+        (*jni)->ExceptionClear(jni);
+        jni = NULL;
+    }
+    if (jni != NULL) {
+        if (job->kind == CIJ_JOB_PREVIEW) {
+            status = cij_invoke_preview(jni, job->klass, job->instance, job->data, (int)job->length, &discard);
+        } else {
+            jbyteArray jLocal;
+            status = cij_invoke_service(jni, job->klass, job->instance, job->data, job->length, &jLocal, &headers, &discard);
+            if (jLocal != NULL) {
+                jResult = (*jni)->NewGlobalRef(jni, jLocal);//FREEME
+            }
+        }
+        (*jni)->PopLocalFrame(jni, NULL);
+    }
+    pthread_mutex_lock(&(job->mutex));
+    job->status = status;
+    job->discard = discard;
+    job->result = jResult;
+    job->headers = headers;
+    job->done = 1;
+    pthread_cond_signal(&(job->cond));
+    pthread_mutex_unlock(&(job->mutex));
+}
+
+/**
+ * Executor thread of a service. runs queued jobs one by one forever.<br>
+ */
+static void * cij_executor(void * data) {
+    jData_t * jdata = (jData_t *)data;
+    JNIEnv * jni = cij_attach_env(cij_jvm);
+    for (;;) {
+        pthread_mutex_lock(&(jdata->exec_mutex));
+        while (jdata->exec_head == NULL && !jdata->exec_stop) {
+            pthread_cond_wait(&(jdata->exec_cond), &(jdata->exec_mutex));
+        }
+        if (jdata->exec_head == NULL) {
+            pthread_mutex_unlock(&(jdata->exec_mutex));
+            break;
+        }
+        cij_job_t * job = jdata->exec_head;
+        jdata->exec_head = job->next;
+        if (jdata->exec_head == NULL) {
+            jdata->exec_tail = NULL;
+        }
+        pthread_mutex_unlock(&(jdata->exec_mutex));
+
+        cij_job_run(jni, job);
+        cij_job_unref(jni, job);
+
+        pthread_mutex_lock(&(jdata->exec_mutex));
+        jdata->exec_inflight--;
+        pthread_mutex_unlock(&(jdata->exec_mutex));
+    }
+    //detach now, the JVM is destroyed once every executor is gone
+    if (jni != NULL) {
+        cij_detach_env(jni);
+        pthread_setspecific(cij_env_key, NULL);
+    }
+    pthread_mutex_lock(&(jdata->exec_mutex));
+    jdata->exec_threads--;
+    pthread_cond_broadcast(&(jdata->exec_cond));
+    pthread_mutex_unlock(&(jdata->exec_mutex));
+    return NULL;
+}
+
+/**
+ * Start the executor threads of the service in this process. must be called with exec_mutex locked.<br>
+ *
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_executor_start(jData_t * jdata) {
+    int i;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (i = 0; i < jdata->concurrency; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, cij_executor, jdata) != 0) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "Failed to start executor of %s.", jdata->name);
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    if (i == 0) {
+        return CI_ERROR;
+    }
+    jdata->concurrency = i;
+    jdata->exec_threads = i;
+    jdata->exec_stop = 0;
+    jdata->exec_pid = getpid();
+    jdata->exec_head = jdata->exec_tail = NULL;//jobs queued in the parent are not ours
+    jdata->exec_inflight = 0;
+    return CI_OK;
+}
+
+/**
+ * Let the executor threads of the service in this process exit after the queued jobs,
+ * and wait up to CIJ_EXECUTOR_STOP_WAIT seconds for them.<br>
+ *
+ * @param jdata the service
+ * @return 1 if no executor thread is left, 0 if some are still in java
+ */
+static int cij_executor_stop(jData_t * jdata) {
+    pthread_mutex_lock(&(jdata->exec_mutex));
+    if (jdata->exec_pid != getpid()) {
+        pthread_mutex_unlock(&(jdata->exec_mutex));
+        return 1;//never started in this process
+    }
+    jdata->exec_stop = 1;
+    pthread_cond_broadcast(&(jdata->exec_cond));
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += CIJ_EXECUTOR_STOP_WAIT;
+    while (jdata->exec_threads > 0) {
+        if (pthread_cond_timedwait(&(jdata->exec_cond), &(jdata->exec_mutex), &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    int stopped = jdata->exec_threads == 0;
+    pthread_mutex_unlock(&(jdata->exec_mutex));
+    return stopped;
+}
+
+/**
+ * Queue a job to the executor of the service. the executor is started at the first job of the process.<br>
+ * a job is refused if Concurrency java calls are in flight,
+ * so calls abandoned at the deadline keep counting until java returns.<br>
+ *
+ * @param job the job
+ * @return CI_OK or CI_ERROR if saturated
+ */
+static int cij_job_submit(cij_job_t * job) {
+    jData_t * jdata = job->jdata;
+    int ret = CI_ERROR;
+    pthread_mutex_lock(&(jdata->exec_mutex));
+    if (jdata->exec_pid != getpid() && cij_executor_start(jdata) != CI_OK) {
+        goto END_OF_SUBMIT;
+    }
+    if (jdata->exec_inflight >= jdata->concurrency) {
+        goto END_OF_SUBMIT;
+    }
+    jdata->exec_inflight++;
+    job->next = NULL;
+    if (jdata->exec_tail != NULL) {
+        jdata->exec_tail->next = job;
+    } else {
+        jdata->exec_head = job;
+    }
+    jdata->exec_tail = job;
+    pthread_cond_signal(&(jdata->exec_cond));
+    ret = CI_OK;
+END_OF_SUBMIT:
+    pthread_mutex_unlock(&(jdata->exec_mutex));
+    return ret;
+}
+
+/**
+ * Wait for a job until the deadline of the service.<br>
+ *
+ * @return 1 if the job has done, 0 if the deadline has passed
+ */
+static int cij_job_wait(cij_job_t * job) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += job->jdata->deadline / 1000;
+    deadline.tv_nsec += (long)(job->jdata->deadline % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&(job->mutex));
+    while (!job->done) {
+        if (pthread_cond_timedwait(&(job->cond), &(job->mutex), &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    int done = job->done;
+    pthread_mutex_unlock(&(job->mutex));
+    return done;
+}
+
+/**
+ * Run a job on the executor and wait for it.<br>
+ * if the executor is saturated or the deadline passes, the job is given up (it frees itself when java returns)
+ * and the instance is discarded because java may still be running on it.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jServiceData service data of the request
+ * @param job the job
+ * @return 1 if the job has done, 0 if given up. in both cases the caller must not touch the job anymore except on 1
+ */
+static int cij_job_execute(JNIEnv * jni, jServiceData_t * jServiceData, cij_job_t * job) {
+    jData_t * jdata = jServiceData->jdata;
+    if (cij_job_submit(job) != CI_OK) {
+        cij_debug_printf(CIJ_WARN_LEVEL, "%s is saturated by %d java calls.", jdata->name, jdata->concurrency);
+        cij_stat_inc(jdata->stat_saturated, 1);
+        cij_job_unref(jni, job);//the executor's reference
+        return 0;
+    }
+    if (cij_job_wait(job)) {
+        if (job->discard) {
+            jServiceData->discard = 1;
+        }
+        return 1;
+    }
+    cij_debug_printf(CIJ_WARN_LEVEL, "%s did not answer within %d ms.", jdata->name, jdata->deadline);
+    cij_stat_inc(jdata->stat_late, 1);
+    jServiceData->discard = 1;
+    return 0;
+}
+
+#define CIJ_BATCH_ALONE (-100) //the request was not in the call of the batch. previewed alone
+
+/**
+ * a request waiting in the batch of its service. lives on the stack of its worker thread until done.<br>
+ */
+typedef struct cijBatchEntryStruct {
+    struct cijBatchEntryStruct * next;
+    jServiceData_t * jServiceData;
+    const char * data;//the whole body
+    int length;
+    int status;//CI_MOD_CONTINUE, CI_MOD_ALLOW204, CI_ERROR or CIJ_BATCH_ALONE
+    int done;
+    int lead;//the request leads the next batch. the batch it joined was full
+} cij_batch_entry_t;
+
+/**
+ * Call java previewBatch(RequestView[]) once for the requests of a batch and set their status.<br>
+ * requests on another version of the class than the first one, after a reload, are left CIJ_BATCH_ALONE.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param head the batch
+ * @param count requests in the batch
+ */
+static void cij_batch_call(JNIEnv * jni, cij_batch_entry_t * head, int count) {
+    cij_class_t * klass = head->jServiceData->klass;
+    jData_t * jdata = klass->jdata;
+    cij_batch_entry_t * entry;
+    int n = 0;
+    for (entry = head; entry != NULL; entry = entry->next) {
+        entry->status = CIJ_BATCH_ALONE;
+        n += entry->jServiceData->klass == klass;
+    }
+    if ((*jni)->PushLocalFrame(jni, 4 + n) != JNI_OK) {
+        (*jni)->ExceptionClear(jni);
+        return;
+    }
+    int status = CI_ERROR;
+    jobjectArray jViews = (*jni)->NewObjectArray(jni, n, klass->jViewClass, NULL);
+    int i = 0;
+    for (entry = head; jViews != NULL && entry != NULL; entry = entry->next) {
+        if (entry->jServiceData->klass != klass) {
+            continue;
+        }
+        ci_request_t * req = entry->jServiceData->req;
+        jbyteArray jBody = (*jni)->NewByteArray(jni, entry->length);
+        if (jBody == NULL) {
+            goto END_OF_BATCH_CALL;
+        }
+        (*jni)->SetByteArrayRegion(jni, jBody, 0, entry->length, (const jbyte *)entry->data);
+        jstring jModType = ci_req_type(req) == ICAP_REQMOD ? cij_jstr_reqmod : cij_jstr_respmod;
+        jobject jView = (*jni)->NewObject(jni, klass->jViewClass, klass->jViewConstructor, jModType, cij_request_handle(entry->jServiceData), jBody);
+        (*jni)->DeleteLocalRef(jni, jBody);
+        if (jView == NULL) {
+            goto END_OF_BATCH_CALL;
+        }
+        (*jni)->SetObjectArrayElement(jni, jViews, i++, jView);
+        (*jni)->DeleteLocalRef(jni, jView);
+    }
+    if (jViews == NULL) {
+        goto END_OF_BATCH_CALL;
+    }
+    uint64_t start = cij_now_us();
+    jintArray jStatus = (jintArray)(*jni)->CallStaticObjectMethod(jni, klass->jIcapClass, klass->jPreviewBatch, jViews);
+    cij_stat_call(jdata, CIJ_CALL_PREVIEW, start);
+    cij_stat_inc(jdata->stat_batches, 1);
+    if (cij_exception_check(jni, jdata, "previewBatch")) {
+        goto END_OF_BATCH_CALL;
+    }
+    if (jStatus == NULL || (*jni)->GetArrayLength(jni, jStatus) != n) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "%s.previewBatch(...) returned no status for some of %d requests.", jdata->name, n);
+        goto END_OF_BATCH_CALL;
+    }
+    jint * values = (jint *)cij_arena_calloc(head->jServiceData->arena, (n > 0 ? n : 1) * sizeof(jint));//head is the request of the leader
+    if (values == NULL) {
+        goto END_OF_BATCH_CALL;
+    }
+    (*jni)->GetIntArrayRegion(jni, jStatus, 0, n, values);
+    i = 0;
+    for (entry = head; entry != NULL; entry = entry->next) {
+        if (entry->jServiceData->klass == klass) {
+            entry->status = cij_preview_status(jdata, values[i++]);
+        }
+    }
+    status = CI_OK;
+
+END_OF_BATCH_CALL:
+    if (status != CI_OK) {
+        (*jni)->ExceptionClear(jni);
+        for (entry = head; entry != NULL; entry = entry->next) {
+            if (entry->jServiceData->klass == klass) {
+                entry->status = CI_ERROR;
+            }
+        }
+    }
+    (*jni)->PopLocalFrame(jni, NULL);
+    cij_debug_printf(CIJ_DEBUG_LEVEL, "%s.previewBatch() previewed %d of %d requests.", jdata->name, n, count);
+}
+
+/**
+ * Preview a small request in a batch with the requests of other worker threads.<br>
+ * the first thread to come leads the batch: it waits up to BatchWindow microseconds, or until BatchSize requests
+ * have joined, then calls java previewBatch(RequestView[]) once for all of them. the others wait for its verdicts.
+ * while a batch is in java, the next one is collected by a new leader: the first request past a full batch,
+ * or the next one to come.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jServiceData service data of the request
+ * @param data the whole body
+ * @param length data byte length
+ * @return CI_MOD_CONTINUE, CI_MOD_ALLOW204, CI_ERROR or CIJ_BATCH_ALONE
+ */
+static int cij_batch_preview(JNIEnv * jni, jServiceData_t * jServiceData, const char * data, int length) {
+    jData_t * jdata = jServiceData->jdata;
+    cij_batch_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.jServiceData = jServiceData;
+    entry.data = data;
+    entry.length = length;
+
+    pthread_mutex_lock(&(jdata->batch_mutex));
+    if (jdata->batch_tail != NULL) {
+        jdata->batch_tail->next = &entry;
+    } else {
+        jdata->batch_head = &entry;
+    }
+    jdata->batch_tail = &entry;
+    jdata->batch_used++;
+    if (jdata->batch_leader) {
+        //follower. the leader reads entry until it is done
+        if (jdata->batch_used >= jdata->batch_size) {
+            pthread_cond_broadcast(&(jdata->batch_cond));
+        }
+        while (!entry.done && !entry.lead) {
+            pthread_cond_wait(&(jdata->batch_cond), &(jdata->batch_mutex));
+        }
+        if (entry.done) {
+            pthread_mutex_unlock(&(jdata->batch_mutex));
+            return entry.status;
+        }
+        //joined after the batch before was full. leads the rest
+    }
+
+    jdata->batch_leader = 1;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (long)jdata->batch_window * 1000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    while (jdata->batch_used < jdata->batch_size) {
+        if (pthread_cond_timedwait(&(jdata->batch_cond), &(jdata->batch_mutex), &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    //up to BatchSize requests from the head, which is this one
+    cij_batch_entry_t * head = jdata->batch_head;
+    cij_batch_entry_t * last = head;
+    int count = 1;
+    while (count < jdata->batch_size && last->next != NULL) {
+        last = last->next;
+        count++;
+    }
+    jdata->batch_head = last->next;
+    last->next = NULL;
+    jdata->batch_used -= count;
+    if (jdata->batch_head != NULL) {
+        jdata->batch_head->lead = 1;
+        pthread_cond_broadcast(&(jdata->batch_cond));
+    } else {
+        jdata->batch_tail = NULL;
+        jdata->batch_leader = 0;
+    }
+    pthread_mutex_unlock(&(jdata->batch_mutex));
+
+    cij_batch_call(jni, head, count);
+
+    pthread_mutex_lock(&(jdata->batch_mutex));
+    cij_batch_entry_t * next;
+    for (; head != NULL; head = next) {
+        next = head->next;//entry of a follower is gone once done is set and the mutex is released
+        head->done = 1;
+    }
+    pthread_cond_broadcast(&(jdata->batch_cond));
+    pthread_mutex_unlock(&(jdata->batch_mutex));
+    return entry.status;
+}
+
+/**
+ * Drop the sidecar connection of a request after a failed call.<br>
+ * a reply that did not come within the deadline counts as missed, anything else as a sidecar error.<br>
+ *
+ * @param jServiceData service data of the request
+ * @param sc the connection, or NULL if it could not connect
+ */
+static void cij_sidecar_lost(jServiceData_t * jServiceData, cij_sidecar_t * sc) {
+    jData_t * jdata = jServiceData->jdata;
+    if (sc != NULL && sc->timed_out) {
+        cij_debug_printf(CIJ_WARN_LEVEL, "%s did not answer within %d ms in the sidecar.", jdata->name, jdata->deadline);
+        cij_stat_inc(jdata->stat_late, 1);
+    } else {
+        cij_stat_inc(jdata->stat_sidecar_errors, 1);
+    }
+    cij_sidecar_drop();
+    jServiceData->sidecar_open = 0;
+}
+
+/**
+ * Give up the sidecar call of a request. the connection is dropped.<br>
+ *
+ * @see cij_sidecar_lost(jServiceData_t * jServiceData, cij_sidecar_t * sc)
+ * @param jServiceData service data of the request
+ * @param sc the connection, or NULL if it could not connect
+ * @return CI_MOD_ALLOW204 if FailOpen is on, otherwise CI_ERROR
+ */
+static int cij_sidecar_fail(jServiceData_t * jServiceData, cij_sidecar_t * sc) {
+    cij_sidecar_lost(jServiceData, sc);
+    return jServiceData->jdata->fail_open ? CI_MOD_ALLOW204 : CI_ERROR;
+}
+
+/**
+ * Construct the instance of the request in the sidecar at the first call, like cij_service_instance().<br>
+ * the sidecar gets the mod type, the service name and the http headers, each terminated by NUL, and an empty line.<br>
+ *
+ * @param sc the connection
+ * @param jServiceData service data of the request
+ * @return CIJ_SIDECAR_REPLY if constructed, CIJ_SIDECAR_ERROR if java failed, CI_ERROR on i/o errors
+ */
+static int cij_sidecar_open(cij_sidecar_t * sc, jServiceData_t * jServiceData) {
+    if (jServiceData->sidecar_open) {
+        return CIJ_SIDECAR_REPLY;
+    }
+    jData_t * jdata = jServiceData->jdata;
+    const char * method = ci_method_string(ci_req_type(jServiceData->req));
+    ci_headers_list_t * hdrs = cij_service_headers(jServiceData->req);
+    size_t size = strlen(method) + 1 + strlen(jdata->name) + 1 + 1;
+    int i;
+    for (i = 0; hdrs != NULL && i < hdrs->used; i++) {
+        size += strlen(hdrs->headers[i]) + 1;
+    }
+    char * payload = (char *)cij_arena_calloc(jServiceData->arena, size);
+    if (payload == NULL) {
+        return CIJ_SIDECAR_ERROR;
+    }
+    char * p = payload;
+    p = stpcpy(p, method) + 1;
+    p = stpcpy(p, jdata->name) + 1;
+    for (i = 0; hdrs != NULL && i < hdrs->used; i++) {
+        p = stpcpy(p, hdrs->headers[i]) + 1;
+    }
+    uint64_t start = cij_now_us();
+    if (cij_sidecar_send(sc, CIJ_SIDECAR_OPEN, payload, size) != CI_OK) {
+        return CI_ERROR;
+    }
+    int op = cij_sidecar_recv(sc, jdata);
+    cij_stat_call(jdata, CIJ_CALL_CONSTRUCTOR, start);
+    if (op == CIJ_SIDECAR_REPLY) {
+        jServiceData->sidecar_open = 1;
+    }
+    return op;
+}
+
+/**
+ * Pass the PrescanPatterns matches found so far to the sidecar, like cij_invoke_matches().<br>
+ *
+ * @param sc the connection
+ * @param jServiceData service data of the request
+ * @return CIJ_SIDECAR_REPLY if passed or nothing new, CIJ_SIDECAR_ERROR if java failed, CI_ERROR on i/o errors
+ */
+static int cij_sidecar_matches(cij_sidecar_t * sc, jServiceData_t * jServiceData) {
+    int n = jServiceData->prescan_used;
+    if (jServiceData->prescan_total == jServiceData->prescan_delivered) {
+        return CIJ_SIDECAR_REPLY;
+    }
+    jServiceData->prescan_delivered = jServiceData->prescan_total;
+    if (n == 0) {
+        return CIJ_SIDECAR_REPLY;
+    }
+    size_t size = 4 + (size_t)n * 12;
+    unsigned char * payload = (unsigned char *)cij_arena_calloc(jServiceData->arena, size);
+    if (payload == NULL) {
+        return CIJ_SIDECAR_ERROR;
+    }
+    uint32_t u = htonl((uint32_t)n);
+    memcpy(payload, &u, 4);
+    int i;
+    for (i = 0; i < n; i++) {
+        unsigned char * p = payload + 4 + i * 12;
+        uint64_t offset = (uint64_t)jServiceData->prescan_matches[i].offset;
+        u = htonl((uint32_t)jServiceData->prescan_matches[i].id);
+        memcpy(p, &u, 4);
+        u = htonl((uint32_t)(offset >> 32));
+        memcpy(p + 4, &u, 4);
+        u = htonl((uint32_t)offset);
+        memcpy(p + 8, &u, 4);
+    }
+    if (cij_sidecar_send(sc, CIJ_SIDECAR_MATCHES, (const char *)payload, size) != CI_OK) {
+        return CI_ERROR;
+    }
+    return cij_sidecar_recv(sc, jServiceData->jdata);
+}
+
+/**
+ * Call java preview() of the request in the sidecar.<br>
+ * the preview data is put in the ring, up to its size.<br>
+ *
+ * @param jServiceData service data of the request
+ * @param preview_data preview body.
+ * @param preview_data_len preview body byte length.
+ * @return CI_MOD_CONTINUE, CI_MOD_ALLOW204 or CI_ERROR
+ */
+static int cij_sidecar_preview(jServiceData_t * jServiceData, char * preview_data, int preview_data_len) {
+    jData_t * jdata = jServiceData->jdata;
+    cij_sidecar_t * sc = cij_sidecar_get(jdata);
+    if (sc == NULL) {
+        return cij_sidecar_fail(jServiceData, sc);
+    }
+    int op = cij_sidecar_open(sc, jServiceData);
+    if (op == CIJ_SIDECAR_REPLY) {
+        op = cij_sidecar_matches(sc, jServiceData);
+    }
+    if (op == CIJ_SIDECAR_REPLY) {
+        size_t length = preview_data_len > 0 ? (size_t)preview_data_len : 0;
+        if (length > sc->ring_size) {
+            length = sc->ring_size;
+        }
+        memcpy(sc->ring, preview_data, length);
+        uint64_t start = cij_now_us();
+        op = cij_sidecar_send_u32(sc, CIJ_SIDECAR_PREVIEW, length) == CI_OK ? cij_sidecar_recv(sc, jdata) : CI_ERROR;
+        cij_stat_call(jdata, CIJ_CALL_PREVIEW, start);
+    }
+    if (op == CIJ_SIDECAR_ERROR) {
+        return CI_ERROR;
+    }
+    if (op != CIJ_SIDECAR_REPLY) {
+        return cij_sidecar_fail(jServiceData, sc);
+    }
+    return cij_preview_status(jdata, (jint)cij_sidecar_reply_u32(sc));
+}
+
+/**
+ * Let the sidecar drop the instance of the request. no reply is awaited.<br>
+ *
+ * @param jServiceData service data of the request
+ */
+static void cij_sidecar_release(jServiceData_t * jServiceData) {
+    cij_thread_t * thread = cij_thread_get();
+    if (thread != NULL && thread->sidecar != NULL && cij_sidecar_send(thread->sidecar, CIJ_SIDECAR_CLOSE, NULL, 0) != CI_OK) {
+        cij_sidecar_drop();
+    }
+    jServiceData->sidecar_open = 0;
+}
+
+/**
+ * Call java preview(ByteBuffer) or preview(byte[]).<br>
+ * runs on the executor with the deadline if Async is on.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jServiceData service data of the request
+ * @param preview_data preview body.
+ * @param preview_data_len preview body byte length.
+ * @return CI_MOD_CONTINUE, CI_MOD_ALLOW204 or CI_ERROR. CI_MOD_CONTINUE if the class has no preview()
+ */
+static int cij_call_preview(JNIEnv * jni, jServiceData_t * jServiceData, char * preview_data, int preview_data_len) {
+    jData_t * jdata = jServiceData->jdata;
+    if (jServiceData->sidecar) {
+        return cij_sidecar_preview(jServiceData, preview_data, preview_data_len);
+    }
+    if (jServiceData->klass->jPreviewBatch != NULL && jServiceData->prescan_total == 0 && ci_req_hasalldata(jServiceData->req)
+        && preview_data_len <= jdata->batch_max_body) {
+        //a small request which the preview holds whole
+        int ret = cij_batch_preview(jni, jServiceData, preview_data, preview_data_len > 0 ? preview_data_len : 0);
+        if (ret != CIJ_BATCH_ALONE) {
+            return ret;
+        }
+    }
+    if (cij_service_instance(jni, jServiceData) == NULL || cij_invoke_matches(jni, jServiceData) != CI_OK) {
+        return CI_ERROR;
+    }
+    if (!jdata->async || (jServiceData->klass->jPreviewDirect == NULL && jServiceData->klass->jPreview == NULL)) {
+        return cij_invoke_preview(jni, jServiceData->klass, jServiceData->instance, preview_data, preview_data_len, &(jServiceData->discard));
+    }
+    cij_job_t * job = cij_job_new(jni, jServiceData, CIJ_JOB_PREVIEW);
+    if (job == NULL) {
+        return CI_ERROR;
+    }
+    if (preview_data_len > 0) {
+        job->data = (char *)malloc(preview_data_len);//FREEME
+        if (job->data == NULL) {
+            cij_job_unref(jni, job);
+            cij_job_unref(jni, job);
+            return CI_ERROR;
+        }
+        memcpy(job->data, preview_data, preview_data_len);
+        job->length = preview_data_len;
+    }
+    int ret = jdata->fail_open ? CI_MOD_ALLOW204 : CI_ERROR;
+    if (cij_job_execute(jni, jServiceData, job)) {
+        ret = job->status;
+    }
+    cij_job_unref(jni, job);
+    return ret;
+}
+
+/**
+ * Call java onData(ByteBuffer in, ByteBuffer out, boolean eof) of a streaming service.<br>
+ * in is a view of the received chunk and out is a view of c-icap's write buffer.
+ * Both are valid only while onData() runs.
+ * java consumes all of in, puts up to out.capacity() bytes to out and keeps the rest for the next call.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jServiceData service data of the request
+ * @param in received chunk or NULL
+ * @param in_len in byte length
+ * @param out buffer to write or NULL
+ * @param out_len out byte length
+ * @param eof no more input after in
+ * @param written bytes written to out, or CI_EOF when java has written all output
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_call_on_data(JNIEnv * jni, jServiceData_t * jServiceData, char * in, int in_len, char * out, int out_len, int eof, int * written) {
+    jData_t * jdata = jServiceData->jdata;
+    jobject jIn = (*jni)->NewDirectByteBuffer(jni, in_len > 0 ? in : cij_empty, in_len > 0 ? in_len : 0);
+    jobject jOut = (*jni)->NewDirectByteBuffer(jni, out_len > 0 ? out : cij_empty, out_len > 0 ? out_len : 0);
+    if (jIn == NULL || jOut == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not create direct buffers for streaming. ignoring...");
+        (*jni)->ExceptionClear(jni);
+        (*jni)->DeleteLocalRef(jni, jIn);
+        (*jni)->DeleteLocalRef(jni, jOut);
+        return CI_ERROR;
+    }
+    uint64_t start = cij_now_us();
+    jint ret = (*jni)->CallIntMethod(jni, jServiceData->instance, jServiceData->klass->jOnData, jIn, jOut, eof ? JNI_TRUE : JNI_FALSE);
+    cij_stat_call(jdata, CIJ_CALL_ON_DATA, start);
+    (*jni)->DeleteLocalRef(jni, jIn);
+    (*jni)->DeleteLocalRef(jni, jOut);
+    if (cij_exception_check(jni, jdata, "onData")) {
+        jServiceData->discard = 1;
+        return CI_ERROR;
+    }
+    if (ret < 0) {
+        if (!jServiceData->stream_eof) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "%s.onData(...) finished output before end of input.", jdata->name);
+            return CI_ERROR;
+        }
+        *written = CI_EOF;
+        return CI_OK;
+    }
+    if (ret > (out_len > 0 ? out_len : 0)) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "%s.onData(...) returned %d, larger than the output buffer.", jdata->name, ret);
+        return CI_ERROR;
+    }
+    *written = ret;
+    return CI_OK;
+}
+
+/**
+ * Preview of a streaming service.<br>
+ * calls preview() if the class has it, passes the preview data to onData()
+ * and unlocks the request so that output is sent before end of data.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jServiceData service data of the request
+ * @param preview_data preview body.
+ * @param preview_data_len preview body byte length.
+ * @param req a pointer of request data.
+ * @return CI_MOD_CONTINUE, CI_MOD_ALLOW204 or CI_ERROR
+ */
+static int cij_stream_preview(JNIEnv * jni, jServiceData_t * jServiceData, char * preview_data, int preview_data_len, ci_request_t * req) {
+    int ret = cij_call_preview(jni, jServiceData, preview_data, preview_data_len);
+    if (ret != CI_MOD_CONTINUE) {
+        return ret;
+    }
+    jServiceData->stream_eof = ci_req_hasalldata(req);
+    int written = 0;
+    if (cij_call_on_data(jni, jServiceData, preview_data, preview_data_len, NULL, 0, jServiceData->stream_eof, &written) != CI_OK) {
+        return CI_ERROR;
+    }
+    if (written == CI_EOF) {
+        jServiceData->stream_done = 1;
+    }
+    //output length is unknown until java finishes
+    if (ci_req_type(req) == ICAP_REQMOD) {
+        ci_http_request_remove_header(req, "Content-Length");
     } else {
-        //UNKNOWN ICAP METHOD
-        cij_debug_printf(CIJ_INFO_LEVEL, "INVALID ICAP METHOD (NO. %d) has come. ignoring...", REQ_TYPE);
-        return NULL;//pass
+        ci_http_response_remove_header(req, "Content-Length");
     }
+    ci_req_unlock_data(req);
+    return CI_MOD_CONTINUE;
+}
 
-    //Create service_data
-    jServiceData_t * jServiceData = NULL;
-    jServiceData = (jServiceData_t *)malloc(sizeof(jServiceData_t));
-    if (jServiceData == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Unable to allocate memory for jServiceData_t !");
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Dropping request...");
-        return NULL;
+/**
+ * send-recv body of a streaming service.<br>
+ * each received chunk goes to java onData() as it arrives and java output goes to wbuf.
+ * after the end of input, onData() is called with an empty chunk until java has written all output.<br>
+ *
+ * @see java_service_io(char * wbuf, int * wlen, char * rbuf, int * rlen, int iseof, ci_request_t * req)
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_stream_io(jServiceData_t * jServiceData, char * wbuf, int * wlen, char * rbuf, int * rlen, int iseof) {
+    int out_len = (wbuf && wlen) ? *wlen : 0;
+    if (jServiceData->stream_done) {
+        if (wlen) {
+            *wlen = CI_EOF;
+        }
+        return CI_OK;
     }
-
-    //Get Java environment from mod_name
-    const char * mod_name = (req->current_service_mod)->mod_name;
-    jData_t * jdata = (jData_t *)ci_dyn_array_search(environments, mod_name);
-    if (jdata == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Invalid mod_name %s is not in environments array.", mod_name);
-        free(jServiceData);
-        return NULL;
+    JNIEnv * jni = cij_service_env(jServiceData->jdata);
+    if (jni == NULL) {
+        return CI_ERROR;
+    }
+    int written = 0;
+    if (rbuf && rlen) {
+        jServiceData->stream_eof |= iseof;
+        if (cij_call_on_data(jni, jServiceData, rbuf, *rlen, wbuf, out_len, jServiceData->stream_eof, &written) != CI_OK) {
+            return CI_ERROR;
+        }
+    } else if (iseof || jServiceData->stream_eof) {
+        jServiceData->stream_eof = 1;
+        if (cij_call_on_data(jni, jServiceData, NULL, 0, wbuf, out_len, 1, &written) != CI_OK) {
+            return CI_ERROR;
+        }
+    }
+    if (written == CI_EOF) {
+        jServiceData->stream_done = 1;
     }
+    if (wlen) {
+        *wlen = written;
+    }
+    return CI_OK;
+}
 
-    //Attach service instance to JVM
-    jServiceData->jdata = jdata;
-    JNIEnv * jni = jdata->jni;
+/**
+ * preview of buffered requests: from the verdict cache, deferred to end of data, or java preview().<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jServiceData service data of the request
+ * @param data the head of the body java sees
+ * @param length data byte length
+ * @param req a pointer of request data.
+ * @return CI_MOD_CONTINUE, CI_MOD_ALLOW204 or CI_ERROR
+ */
+static int cij_preview_java(JNIEnv * jni, jServiceData_t * jServiceData, char * data, int length, ci_request_t * req) {
+    if (jServiceData->jdata->prescan != NULL && jServiceData->prescan_total == 0) {
+        if (ci_req_hasalldata(req)) {
+            cij_stat_inc(jServiceData->jdata->stat_prescan_clean, 1);
+            return CI_MOD_ALLOW204;
+        }
+        //java preview() waits for a match in the rest of the body
+        jServiceData->preview_len = length;
+        jServiceData->preview_deferred = 1;
+        return CI_MOD_CONTINUE;
+    }
+    if (jServiceData->jdata->cache == NULL) {
+        return cij_call_preview(jni, jServiceData, data, length);
+    }
+    if (!ci_req_hasalldata(req)) {
+        //the verdict of the whole body may be cached. java preview() waits for a miss at end of data.
+        jServiceData->preview_len = length;
+        jServiceData->preview_deferred = 1;
+        return CI_MOD_CONTINUE;
+    }
+    cij_verdict_t * verdict = cij_verdict_lookup(jServiceData);
+    if (verdict != NULL) {
+        //a modified body is sent at end of data
+        return verdict->data[0] == CIJ_VERDICT_NOT_MODIFIED ? CI_MOD_ALLOW204 : CI_MOD_CONTINUE;
+    }
+    int ret = cij_call_preview(jni, jServiceData, data, length);
+    if (ret == CI_MOD_ALLOW204) {
+        cij_verdict_store(jServiceData, jni, NULL, NULL);
+    }
+    return ret;
+}
 
-    //Create new HTTP headers array for java
-    jclass jClass_String = (*jni)->FindClass(jni, "java/lang/String");
-    jobjectArray jHeaders = (*jni)->NewObjectArray(jni, hdrs->used, jClass_String, NULL);
-    if (jHeaders == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not allocate memory for http headers. ignoring...");
-        return NULL;
+/**
+ * preview of buffered, streaming or bypassed requests.<br>
+ *
+ * @see java_check_preview_handler(char * preview_data, int preview_data_len, ci_request_t * req)
+ */
+static int cij_check_preview(char * preview_data, int preview_data_len, ci_request_t * req) {
+    jServiceData_t * jServiceData = (jServiceData_t *)ci_service_data(req);
+    jData_t * jdata = jServiceData->jdata;
+    if (jServiceData->bypass) {
+        return CI_MOD_ALLOW204;
     }
-    (*jni)->DeleteLocalRef(jni, jClass_String);
-    int i;
-    for(i=0;i<hdrs->used;i++) {
-        jstring buf = (*jni)->NewStringUTF(jni, hdrs->headers[i]);
-        if (buf == NULL) {
-            cij_debug_printf(CIJ_ERROR_LEVEL, "Could not allocate memory for http headers string. ignoring...");
-            return NULL;
+    JNIEnv * jni = NULL;
+    if (!jServiceData->sidecar) {
+        jni = cij_service_env(jdata);
+        if (jni == NULL) {
+            return CI_ERROR;
+        }
+        if (jServiceData->klass->jOnData != NULL) {
+            return cij_stream_preview(jni, jServiceData, preview_data, preview_data_len, req);
         }
-        (*jni)->SetObjectArrayElement(jni, jHeaders, i, buf);
-        (*jni)->DeleteLocalRef(jni, buf);
     }
 
-    //Create instance.
-    jobject jInstance = (*jni)->NewObject(jni, jdata->jIcapClass, jdata->jServiceConstructor,METHOD_TYPE,jHeaders);
-    (*jni)->DeleteLocalRef(jni, jHeaders);
-    if (jInstance == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not create instance of the class '%s'. Method='%s'. ignoring...", mod_name, METHOD_TYPE);
-        return NULL;
+    //preview data is the head of http body
+    if (preview_data_len > 0) {
+        if (ci_cached_file_write(jServiceData->buffer, preview_data, preview_data_len, ci_req_hasalldata(req)) < 0) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "Could not store preview data. ignoring...");
+            return CI_ERROR;
+        }
     }
-    jServiceData->instance = jInstance;//+REF
-    ci_membuf_t * buffer = ci_membuf_new();
-    if (buffer == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not allocate memory for http body ignoring...");
-        return NULL;
+    if (jdata->cache != NULL) {
+        cij_siphash_update(&(jServiceData->digest), preview_data, preview_data_len > 0 ? preview_data_len : 0);
     }
-    return (void *)jServiceData;
+    if (jServiceData->decoder == NULL) {
+        cij_prescan_feed(jServiceData, preview_data, preview_data_len > 0 ? preview_data_len : 0);
+        return cij_preview_java(jni, jServiceData, preview_data, preview_data_len > 0 ? preview_data_len : 0, req);
+    }
+    //java previews as much as the preview data inflates to
+    char * data;
+    size_t length;
+    int mapped;
+    if (cij_decode(jServiceData, preview_data, preview_data_len > 0 ? preview_data_len : 0, ci_req_hasalldata(req)) != CI_OK
+        || cij_body_map(cij_java_body(jServiceData), &data, &length, &mapped) != CI_OK) {
+        return CI_ERROR;
+    }
+    int ret = cij_preview_java(jni, jServiceData, data, (int)length, req);
+    cij_body_unmap(data, length, mapped);
+    return ret;
 }
 
 /**
@@ -456,30 +5385,275 @@ void * java_init_request_data(ci_request_t * req) {
  */
 int java_check_preview_handler(char * preview_data, int preview_data_len, ci_request_t * req) {
     jServiceData_t * jServiceData = (jServiceData_t *)ci_service_data(req);
-    jData_t * jdata = jServiceData->jdata;
-    JNIEnv * jni = jdata->jni;
-    jobject jInstance = jServiceData->instance;
+    JNIEnv * frame = cij_frame_push(jServiceData);
+    int ret = cij_check_preview(preview_data, preview_data_len, req);
+    cij_frame_pop(frame);
+    cij_stat_kbs(jServiceData->jdata->stat_bytes_in, preview_data_len);
+    if (ret == CI_MOD_ALLOW204) {
+        cij_stat_inc(jServiceData->jdata->stat_allow204, 1);
+    } else if (ret == CI_ERROR) {
+        cij_stat_inc(jServiceData->jdata->stat_errors, 1);
+    }
+    return ret;
+}
+
+/**
+ * Apply header changes of java and Content-Length of the modified body to the encapsulated http message at once.<br>
+ * "Name: value" replaces every Name header, "Name:" removes them. Content-Length of java is ignored.<br>
+ *
+ * @param req a pointer of request data.
+ * @param headers header lines or NULL. see cij_header_lines(JNIEnv * jni, jobjectArray jLines)
+ * @param length modified body length, or -1 if unknown until sent
+ */
+static void cij_apply_headers(ci_request_t * req, const char * headers, long long length) {
+    ci_headers_list_t * hdrs = cij_service_headers(req);
+    if (hdrs == NULL) {
+        return;
+    }
+    const char * line;
+    char name[CIJ_MAX_HEADER_NAME];
+    //all removals first, so that a line does not remove the one added by a previous line
+    for (line = headers; line != NULL && *line != '\0'; line += strlen(line) + 1) {
+        const char * colon = strchr(line, ':');
+        if (colon == NULL || colon == line || colon - line >= (int)sizeof(name)) {
+            continue;
+        }
+        memcpy(name, line, colon - line);
+        name[colon - line] = '\0';
+        while (ci_headers_remove(hdrs, name));
+    }
+    for (line = headers; line != NULL && *line != '\0'; line += strlen(line) + 1) {
+        const char * colon = strchr(line, ':');
+        if (colon == NULL || colon == line || strncasecmp(line, "Content-Length:", 15) == 0) {
+            continue;
+        }
+        const char * value = colon + 1;
+        while (*value == ' ' || *value == '\t') {
+            value++;
+        }
+        if (*value != '\0') {
+            ci_headers_add(hdrs, line);
+        }
+    }
+    while (ci_headers_remove(hdrs, "Content-Length"));
+    if (length >= 0) {
+        char header[64];
+        snprintf(header, sizeof(header), "Content-Length: %lld", length);
+        ci_headers_add(hdrs, header);
+    }
+}
+
+/**
+ * Prepare the encoder if the modified body of a decoded body has to be compressed again.<br>
+ * not if java changed Content-Encoding itself by headers().<br>
+ *
+ * @param jServiceData service data of the request
+ * @param headers header changes of java or NULL
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_output_encoder(jServiceData_t * jServiceData, const char * headers) {
+    if (jServiceData->decoder == NULL || jServiceData->decoder->failed) {
+        return CI_OK;
+    }
+    const char * line;
+    for (line = headers; line != NULL && *line != '\0'; line += strlen(line) + 1) {
+        if (strncasecmp(line, "Content-Encoding:", 17) == 0) {
+            return CI_OK;
+        }
+    }
+    jServiceData->encoder = cij_codec_new(jServiceData->arena, jServiceData->decoder->encoding, 1);
+    if (jServiceData->encoder == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not initialize zlib for modified body.");
+        return CI_ERROR;
+    }
+    return CI_OK;
+}
 
-    //convert C-char* to Java-byte[]
-    jbyteArray jba = (*jni)->NewByteArray(jni, preview_data_len);
-    if (jba == NULL) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not allocate memory for preview_data byte array object. ignoring...");
+/**
+ * Send the modified body stored in the verdict instead of the http body.<br>
+ * the verdict stays owned by the request until java_release_request_data(void * data).<br>
+ *
+ * @param req a pointer of request data.
+ * @param jServiceData service data of the request
+ * @param verdict CIJ_VERDICT_MODIFIED or CIJ_VERDICT_MODIFIED_HEADERS
+ * @return CI_MOD_DONE or CI_ERROR
+ */
+static int cij_output_verdict(ci_request_t * req, jServiceData_t * jServiceData, const cij_verdict_t * verdict) {
+    const char * headers = NULL;
+    size_t offset = 1;
+    if (verdict->data[0] == CIJ_VERDICT_MODIFIED_HEADERS) {
+        headers = verdict->data + 1;
+        offset += cij_header_lines_size(headers);
+    }
+    jServiceData->output_data = verdict->data + offset;
+    jServiceData->output_len = (jsize)(verdict->size - offset);
+    jServiceData->output_pos = 0;
+    if (cij_output_encoder(jServiceData, headers) != CI_OK) {
         return CI_ERROR;
     }
-    //int i;
-   //:******* (*jni)->SetByteArrayRegion(jni, preview_data, START_INDEX, jba, preview_data_len);
+    //the compressed length is known only after it is sent
+    cij_apply_headers(req, headers, jServiceData->encoder != NULL ? -1 : jServiceData->output_len);
+    return CI_MOD_DONE;
+}
 
-    //Call int preview(byte[])
-    jint status = (*jni)->CallIntMethod(jni, jInstance, jdata->jPreview, jba);
-    if (status) {
-        cij_debug_printf(CIJ_ERROR_LEVEL, "%s.initialize(...) returned not %d.", jdata->name, CI_OK);
+/**
+ * Send the body returned from java service() instead of the http body.<br>
+ * the array is kept by a global ref and read into wbuf slice by slice, it is not copied to another buffer.<br>
+ *
+ * @see cij_output_read(jServiceData_t * jServiceData, char * wbuf, int wlen)
+ * @param req a pointer of request data.
+ * @param jServiceData service data of the request
+ * @param jni JNIEnv of the current thread
+ * @param jBody modified body
+ * @param headers header changes of java or NULL
+ * @return CI_MOD_DONE or CI_ERROR
+ */
+static int cij_output(ci_request_t * req, jServiceData_t * jServiceData, JNIEnv * jni, jbyteArray jBody, const char * headers) {
+    jServiceData->output = (jbyteArray)(*jni)->NewGlobalRef(jni, jBody);//FREEME
+    if (jServiceData->output == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not keep modified body.");
         return CI_ERROR;
     }
-    //check preview data
-    //hasbody
-    //lock or  unlock
-    // send to service_io?
-    return CI_MOD_CONTINUE;
+    jServiceData->output_len = (*jni)->GetArrayLength(jni, jBody);
+    jServiceData->output_pos = 0;
+    if (cij_output_encoder(jServiceData, headers) != CI_OK) {
+        return CI_ERROR;
+    }
+    cij_apply_headers(req, headers, jServiceData->encoder != NULL ? -1 : jServiceData->output_len);
+    return CI_MOD_DONE;
+}
+
+/**
+ * Copy the next bytes of the modified body.<br>
+ * GetByteArrayRegion() copies from the java heap straight to the destination. the array is not pinned between slices,
+ * so GC is never held by a slow client.<br>
+ *
+ * @param jServiceData service data of the request
+ * @param dst destination
+ * @param n max bytes to copy
+ * @return bytes copied or CI_ERROR
+ */
+static int cij_output_copy(jServiceData_t * jServiceData, char * dst, int n) {
+    if (n > jServiceData->output_len - jServiceData->output_pos) {
+        n = jServiceData->output_len - jServiceData->output_pos;
+    }
+    if (jServiceData->output != NULL) {
+        JNIEnv * jni = cij_service_env(jServiceData->jdata);
+        if (jni == NULL) {
+            return CI_ERROR;
+        }
+        (*jni)->GetByteArrayRegion(jni, jServiceData->output, jServiceData->output_pos, n, (jbyte *)dst);
+    } else {
+        memcpy(dst, jServiceData->output_data + jServiceData->output_pos, n);
+    }
+    jServiceData->output_pos += n;
+    return n;
+}
+
+/**
+ * Deflate the next slice of the modified body into wbuf.<br>
+ *
+ * @see cij_output_encoder(jServiceData_t * jServiceData, const char * headers)
+ * @return bytes written, CI_EOF at the end or CI_ERROR
+ */
+static int cij_output_deflate(jServiceData_t * jServiceData, char * wbuf, int wlen) {
+    cij_codec_t * codec = jServiceData->encoder;
+    codec->z.next_out = (Bytef *)wbuf;
+    codec->z.avail_out = wlen;
+    while (codec->z.avail_out > 0 && !codec->finished) {
+        if (codec->z.avail_in == 0 && jServiceData->output_pos < jServiceData->output_len) {
+            int n = cij_output_copy(jServiceData, codec->buf, sizeof(codec->buf));
+            if (n < 0) {
+                return CI_ERROR;
+            }
+            codec->z.next_in = (Bytef *)codec->buf;
+            codec->z.avail_in = n;
+        }
+        int flush = (codec->z.avail_in == 0 && jServiceData->output_pos == jServiceData->output_len) ? Z_FINISH : Z_NO_FLUSH;
+        int ret = deflate(&(codec->z), flush);
+        if (ret == Z_STREAM_END) {
+            codec->finished = 1;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "Could not deflate modified body (%d).", ret);
+            return CI_ERROR;
+        }
+    }
+    int written = wlen - codec->z.avail_out;
+    return (written == 0 && codec->finished) ? CI_EOF : written;
+}
+
+/**
+ * Read the next slice of the modified body into wbuf.<br>
+ *
+ * @param jServiceData service data of the request
+ * @param wbuf buffer to write body to send
+ * @param wlen wbuf byte length
+ * @return bytes written, CI_EOF at the end or CI_ERROR
+ */
+static int cij_output_read(jServiceData_t * jServiceData, char * wbuf, int wlen) {
+    if (jServiceData->encoder != NULL) {
+        return cij_output_deflate(jServiceData, wbuf, wlen);
+    }
+    if (jServiceData->output_pos >= jServiceData->output_len) {
+        return CI_EOF;
+    }
+    return cij_output_copy(jServiceData, wbuf, wlen);
+}
+
+/**
+ * body io of buffered, streaming or bypassed requests.<br>
+ *
+ * @see java_service_io(char * wbuf, int * wlen, char * rbuf, int * rlen, int iseof, ci_request_t * req)
+ */
+static int cij_service_io(char * wbuf, int * wlen, char * rbuf, int * rlen, int iseof, ci_request_t * req) {
+    jServiceData_t * jServiceData = (jServiceData_t *)ci_service_data(req);
+    int ret = CI_OK;
+
+    if (jServiceData->klass != NULL && jServiceData->klass->jOnData != NULL) {
+        return cij_stream_io(jServiceData, wbuf, wlen, rbuf, rlen, iseof);
+    }
+
+    if (rlen && rbuf) {
+        *rlen = ci_cached_file_write(jServiceData->buffer, rbuf, *rlen, iseof);
+        if (*rlen < 0) {
+            ret = CI_ERROR;
+        } else {
+            if (jServiceData->jdata->cache != NULL && !jServiceData->bypass) {
+                cij_siphash_update(&(jServiceData->digest), rbuf, *rlen);
+            }
+            if (jServiceData->decoder != NULL) {
+                if (cij_decode(jServiceData, rbuf, *rlen, iseof) != CI_OK) {
+                    ret = CI_ERROR;
+                }
+            } else if (!jServiceData->bypass) {
+                cij_prescan_feed(jServiceData, rbuf, *rlen);
+            }
+        }
+    } else if (iseof) {
+        if (ci_cached_file_write(jServiceData->buffer, NULL, 0, iseof) < 0) {
+            ret = CI_ERROR;
+        }
+        if (jServiceData->decoder != NULL && cij_decode(jServiceData, NULL, 0, iseof) != CI_OK) {
+            ret = CI_ERROR;
+        }
+    }
+
+    if (wlen && wbuf) {
+        if (jServiceData->eof && (jServiceData->output != NULL || jServiceData->output_data != NULL)) {
+            *wlen = cij_output_read(jServiceData, wbuf, *wlen);
+            if (*wlen == CI_ERROR) {
+                ret = CI_ERROR;
+            }
+        } else if (jServiceData->eof) {
+            *wlen = ci_cached_file_read(jServiceData->buffer, wbuf, *wlen);
+            if (*wlen == CI_ERROR) {
+                ret = CI_ERROR;
+            }
+        } else {
+            *wlen = 0;//body is held until java service() returns
+        }
+    }
+    return ret;
 }
 
 /**
@@ -503,17 +5677,290 @@ int java_check_preview_handler(char * preview_data, int preview_data_len, ci_req
  * @return CI_OK if modification is ok. (if *wlen equals CI_EOF then modification is OK and no write anymore)
  */
 int java_service_io(char * wbuf, int * wlen, char * rbuf, int * rlen, int iseof, ci_request_t * req) {
-    int ret = CI_OK;
-
+    jServiceData_t * jServiceData = (jServiceData_t *)ci_service_data(req);
+    JNIEnv * frame = cij_frame_push(jServiceData);
+    int ret = cij_service_io(wbuf, wlen, rbuf, rlen, iseof, req);
+    cij_frame_pop(frame);
+    if (ret == CI_ERROR) {
+        cij_stat_inc(jServiceData->jdata->stat_errors, 1);
+        return ret;
+    }
     if (rlen && rbuf) {
-        //call
+        cij_stat_kbs(jServiceData->jdata->stat_bytes_in, *rlen);
     }
-
     if (wlen && wbuf) {
-        //call
+        cij_stat_kbs(jServiceData->jdata->stat_bytes_out, *wlen);//CI_EOF is not counted
+    }
+    return ret;
+}
+/**
+ * Get the body for a job, which must stay readable after the request has released the buffer.<br>
+ * a spilled file is mapped (the mapping survives close and unlink of the file), a body in memory is copied.<br>
+ *
+ * @see cij_body_map(ci_cached_file_t * body, char ** data, size_t * length, int * mapped)
+ * @return CI_OK or CI_ERROR
+ */
+static int cij_body_snapshot(ci_cached_file_t * body, char ** data, size_t * length, int * mapped) {
+    char * view;
+    if (cij_body_map(body, &view, length, mapped) != CI_OK) {
+        return CI_ERROR;
+    }
+    if (*mapped) {
+        *data = view;
+        return CI_OK;
+    }
+    *data = (char *)malloc(*length > 0 ? *length : 1);//FREEME
+    if (*data == NULL) {
+        return CI_ERROR;
+    }
+    memcpy(*data, view, *length);
+    return CI_OK;
+}
+
+/**
+ * Call java service(ByteBuffer) or service(byte[]) with the whole body.<br>
+ * runs on the executor with the deadline if Async is on.<br>
+ *
+ * @param jni JNIEnv of the current thread
+ * @param jServiceData service data of the request
+ * @param jResult local ref of the modified body, NULL if not modified
+ * @param headers header changes of java or NULL
+ * @return CI_OK, CI_ERROR, or CI_MOD_ALLOW204 if java was saturated or late and FailOpen is on
+ */
+static int cij_call_service(JNIEnv * jni, jServiceData_t * jServiceData, jbyteArray * jResult, char ** headers) {
+    jData_t * jdata = jServiceData->jdata;
+    *jResult = NULL;
+    *headers = NULL;
+    if (cij_service_instance(jni, jServiceData) == NULL || cij_invoke_matches(jni, jServiceData) != CI_OK) {
+        return CI_ERROR;
+    }
+    if (!jdata->async) {
+        char * data;
+        size_t length;
+        int mapped;
+        if (cij_body_map(cij_java_body(jServiceData), &data, &length, &mapped) != CI_OK) {
+            return CI_ERROR;
+        }
+        int ret = cij_invoke_service(jni, jServiceData->klass, jServiceData->instance, data, length, jResult, headers, &(jServiceData->discard));
+        cij_body_unmap(data, length, mapped);
+        return ret;
+    }
+    cij_job_t * job = cij_job_new(jni, jServiceData, CIJ_JOB_SERVICE);
+    if (job == NULL) {
+        return CI_ERROR;
+    }
+    if (cij_body_snapshot(cij_java_body(jServiceData), &(job->data), &(job->length), &(job->mapped)) != CI_OK) {
+        cij_job_unref(jni, job);
+        cij_job_unref(jni, job);
+        return CI_ERROR;
+    }
+    int ret = jdata->fail_open ? CI_MOD_ALLOW204 : CI_ERROR;
+    if (cij_job_execute(jni, jServiceData, job)) {
+        ret = job->status;
+        if (job->result != NULL) {
+            *jResult = (jbyteArray)(*jni)->NewLocalRef(jni, job->result);
+        }
+        *headers = job->headers;
+        job->headers = NULL;
+    }
+    cij_job_unref(jni, job);
+    return ret;
+}
+
+/**
+ * Call java service() of the request in the sidecar and send the modified body.<br>
+ * the body goes to the sidecar through the ring, a ring size at a time, and the modified body comes back the same way
+ * into a verdict in the arena of the request. it is sent and cached like a verdict from the cache.<br>
+ *
+ * @see cij_output_verdict(ci_request_t * req, jServiceData_t * jServiceData, const cij_verdict_t * verdict)
+ * @param req a pointer of request data.
+ * @param jServiceData service data of the request
+ * @return CI_MOD_DONE, CI_MOD_ALLOW204 or CI_ERROR
+ */
+static int cij_sidecar_service(ci_request_t * req, jServiceData_t * jServiceData) {
+    jData_t * jdata = jServiceData->jdata;
+    cij_sidecar_t * sc = cij_sidecar_get(jdata);
+    int op = sc != NULL ? cij_sidecar_open(sc, jServiceData) : CI_ERROR;
+    if (op == CIJ_SIDECAR_REPLY) {
+        op = cij_sidecar_matches(sc, jServiceData);
+    }
+    uint64_t start = cij_now_us();
+    if (op == CIJ_SIDECAR_REPLY) {
+        char * data;
+        size_t length;
+        int mapped;
+        if (cij_body_map(cij_java_body(jServiceData), &data, &length, &mapped) != CI_OK) {
+            return CI_ERROR;
+        }
+        size_t sent = 0;
+        while (op == CIJ_SIDECAR_REPLY && length - sent > sc->ring_size) {
+            memcpy(sc->ring, data + sent, sc->ring_size);
+            sent += sc->ring_size;
+            op = cij_sidecar_send_u32(sc, CIJ_SIDECAR_DATA, sc->ring_size) == CI_OK ? cij_sidecar_recv(sc, jdata) : CI_ERROR;
+        }
+        if (op == CIJ_SIDECAR_REPLY) {
+            memcpy(sc->ring, data + sent, length - sent);
+            op = cij_sidecar_send_u32(sc, CIJ_SIDECAR_SERVICE, length - sent) == CI_OK ? cij_sidecar_recv(sc, jdata) : CI_ERROR;
+        }
+        cij_body_unmap(data, length, mapped);
+    }
+    if (op == CIJ_SIDECAR_ERROR) {
+        return CI_ERROR;
+    }
+    if (op == CIJ_VERDICT_NOT_MODIFIED) {
+        cij_stat_call(jdata, CIJ_CALL_SERVICE, start);
+        cij_verdict_store(jServiceData, NULL, NULL, NULL);
+        jServiceData->eof = 1;
+        return ci_req_allow204(req) ? CI_MOD_ALLOW204 : CI_MOD_DONE;
+    }
+    if (op != CIJ_VERDICT_MODIFIED && op != CIJ_VERDICT_MODIFIED_HEADERS) {
+        if (cij_sidecar_fail(jServiceData, sc) != CI_MOD_ALLOW204) {
+            return CI_ERROR;
+        }
+        //fail open: send the body as is
+        jServiceData->eof = 1;
+        return ci_req_allow204(req) ? CI_MOD_ALLOW204 : CI_MOD_DONE;
+    }
+
+    //'M' length, or 'H' length and header lines
+    uint32_t total = cij_sidecar_reply_u32(sc);
+    if (cij_conf_sidecar_max_body > 0 && (ci_off_t)total > cij_conf_sidecar_max_body) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Sidecar returned a modified body of %u bytes for service '%s', above SidecarMaxBody.", total, jdata->name);
+        if (cij_sidecar_fail(jServiceData, sc) != CI_MOD_ALLOW204) {
+            return CI_ERROR;
+        }
+        //fail open: send the body as is
+        jServiceData->eof = 1;
+        return ci_req_allow204(req) ? CI_MOD_ALLOW204 : CI_MOD_DONE;
+    }
+    size_t headers_size = op == CIJ_VERDICT_MODIFIED_HEADERS && sc->reply_len > 4 ? sc->reply_len - 4 : 0;
+    cij_verdict_t * verdict = (cij_verdict_t *)cij_arena_calloc(jServiceData->arena, sizeof(cij_verdict_t) + 1 + headers_size + 1 + total);
+    if (verdict == NULL) {
+        cij_debug_printf(CIJ_ERROR_LEVEL, "Could not allocate memory for modified body.");
+        cij_sidecar_drop();
+        jServiceData->sidecar_open = 0;
+        return CI_ERROR;
+    }
+    verdict->data[0] = headers_size > 0 ? CIJ_VERDICT_MODIFIED_HEADERS : CIJ_VERDICT_MODIFIED;
+    if (headers_size > 0) {
+        //the lines end with an empty one. the extra NUL guards a reply without it
+        memcpy(verdict->data + 1, sc->reply + 4, headers_size);
+        headers_size = cij_header_lines_size(verdict->data + 1);
+    }
+    verdict->size = 1 + headers_size + total;
+    char * body = verdict->data + 1 + headers_size;
+    size_t received = total < sc->ring_size ? total : sc->ring_size;
+    memcpy(body, sc->ring, received);
+    while (received < total) {
+        if (cij_sidecar_send_u32(sc, CIJ_SIDECAR_GET, received) != CI_OK || cij_sidecar_recv(sc, jdata) != CIJ_SIDECAR_REPLY) {
+            cij_sidecar_lost(jServiceData, sc);
+            return CI_ERROR;
+        }
+        uint32_t n = cij_sidecar_reply_u32(sc);
+        if (n == 0 || n > sc->ring_size || n > total - received) {
+            cij_debug_printf(CIJ_ERROR_LEVEL, "Broken modified body from sidecar for service '%s'.", jdata->name);
+            cij_sidecar_lost(jServiceData, sc);
+            return CI_ERROR;
+        }
+        memcpy(body + received, sc->ring, n);
+        received += n;
+    }
+    cij_stat_call(jdata, CIJ_CALL_SERVICE, start);
+
+    if (jdata->cache != NULL && jServiceData->looked_up && (ci_off_t)verdict->size <= jdata->cache_max_object) {
+        ci_cache_update(jdata->cache, jServiceData->key, verdict->data, verdict->size, NULL);
+    }
+    jServiceData->eof = 1;
+    return cij_output_verdict(req, jServiceData, verdict);
+}
+
+/**
+ * end of data of buffered, streaming or bypassed requests.<br>
+ *
+ * @see java_end_of_data_handler(ci_request_t * req)
+ */
+static int cij_end_of_data(ci_request_t * req) {
+    jServiceData_t * jServiceData = (jServiceData_t *)ci_service_data(req);
+    jData_t * jdata = jServiceData->jdata;
+    if (jServiceData->bypass) {
+        jServiceData->eof = 1;
+        return ci_req_allow204(req) ? CI_MOD_ALLOW204 : CI_MOD_DONE;
+    }
+    if (jServiceData->klass != NULL && jServiceData->klass->jOnData != NULL) {
+        return CI_MOD_DONE;//output has been streamed by java_service_io()
+    }
+    if (jdata->prescan != NULL && jServiceData->prescan_total == 0) {
+        //no pattern in the body. answered without entering JVM
+        cij_stat_inc(jdata->stat_prescan_clean, 1);
+        jServiceData->eof = 1;
+        return ci_req_allow204(req) ? CI_MOD_ALLOW204 : CI_MOD_DONE;
+    }
+    if (jdata->cache != NULL) {
+        cij_verdict_t * verdict = cij_verdict_lookup(jServiceData);
+        if (verdict != NULL) {
+            //answered without entering JVM
+            jServiceData->eof = 1;
+            if (verdict->data[0] != CIJ_VERDICT_NOT_MODIFIED) {
+                return cij_output_verdict(req, jServiceData, verdict);
+            }
+            return ci_req_allow204(req) ? CI_MOD_ALLOW204 : CI_MOD_DONE;
+        }
+    }
+    JNIEnv * jni = NULL;
+    if (!jServiceData->sidecar) {
+        jni = cij_service_env(jdata);
+        if (jni == NULL) {
+            return CI_ERROR;
+        }
+    }
+    if (jServiceData->preview_deferred) {
+        char * data;
+        size_t length;
+        int mapped;
+        if (cij_body_map(cij_java_body(jServiceData), &data, &length, &mapped) != CI_OK) {
+            return CI_ERROR;
+        }
+        int status = cij_call_preview(jni, jServiceData, data, jServiceData->preview_len);
+        cij_body_unmap(data, length, mapped);
+        if (status == CI_MOD_ALLOW204) {
+            cij_verdict_store(jServiceData, jni, NULL, NULL);
+            jServiceData->eof = 1;
+            return ci_req_allow204(req) ? CI_MOD_ALLOW204 : CI_MOD_DONE;
+        }
+        if (status != CI_MOD_CONTINUE) {
+            return CI_ERROR;
+        }
+    }
+    if (jServiceData->sidecar) {
+        return cij_sidecar_service(req, jServiceData);
     }
+    jbyteArray jResult = NULL;
+    char * headers = NULL;
+    int ret = cij_call_service(jni, jServiceData, &jResult, &headers);//FREEME headers
+    if (ret != CI_OK) {
+        if (ret == CI_MOD_ALLOW204) {
+            //fail open: send the body as is
+            jServiceData->eof = 1;
+            return ci_req_allow204(req) ? CI_MOD_ALLOW204 : CI_MOD_DONE;
+        }
+        return CI_ERROR;
+    }
+
+    jServiceData->eof = 1;
+    cij_verdict_store(jServiceData, jni, jResult, headers);
+    if (jResult == NULL) {
+        //not modified
+        if (ci_req_allow204(req)) {
+            return CI_MOD_ALLOW204;
+        }
+        return CI_MOD_DONE;
+    }
+    ret = cij_output(req, jServiceData, jni, jResult, headers);
+    (*jni)->DeleteLocalRef(jni, jResult);
+    free(headers);
     return ret;
 }
+
 /**
  * Called when if wlen == CI_EOF in java_service_io(char * wbuf, int * wlen, char * rbuf, int * rlen, int iseof, ci_request_t * req)<br>
  * prev = java_service_io(char * wbuf, int * wlen, char * rbuf, int * rlen, int iseof, ci_request_t * req)<br>
@@ -522,11 +5969,19 @@ int java_service_io(char * wbuf, int * wlen, char * rbuf, int * rlen, int iseof,
  * @see java_service_io(char * wbuf, int * wlen, char * rbuf, int * rlen, int iseof, ci_request_t * req)
  * @see java_release_request_data(void * data)
  * @param req a pointer of request data.
- * @return CI_OK if continue modification, CI_MOD_DONE if modification has done
+ * @return CI_OK if continue modification, CI_MOD_DONE if modification has done, CI_MOD_ALLOW204 if java service() returned null
  */
 int java_end_of_data_handler(ci_request_t * req) {
-    //replace headers
-    return CI_MOD_DONE;
+    jServiceData_t * jServiceData = (jServiceData_t *)ci_service_data(req);
+    JNIEnv * frame = cij_frame_push(jServiceData);
+    int ret = cij_end_of_data(req);
+    cij_frame_pop(frame);
+    if (ret == CI_MOD_ALLOW204) {
+        cij_stat_inc(jServiceData->jdata->stat_allow204, 1);
+    } else if (ret == CI_ERROR) {
+        cij_stat_inc(jServiceData->jdata->stat_errors, 1);
+    }
+    return ret;
 }
 
 /**
@@ -539,9 +5994,30 @@ int java_end_of_data_handler(ci_request_t * req) {
  */
 void java_release_request_data(void * data) {
     jServiceData_t * jServiceData = (jServiceData_t *)data;
-    JNIEnv * jni = (jServiceData->jdata)->jni;
-    (*jni)->DeleteLocalRef(jni, jServiceData->instance);
-    free(jServiceData);
+    if (jServiceData->klass != NULL) {
+        JNIEnv * jni = cij_service_env(jServiceData->jdata);
+        if (jni != NULL) {
+            (*jni)->DeleteGlobalRef(jni, jServiceData->output);
+            if (jServiceData->instance != NULL) {
+                cij_instance_release(jni, jServiceData->klass, jServiceData->instance, !jServiceData->discard);
+            }
+            cij_gc_sample(jni);
+        }
+        cij_class_unref(jni, jServiceData->klass);
+    }
+    if (jServiceData->sidecar_open) {
+        cij_sidecar_release(jServiceData);
+    }
+    cij_handle_revoke(jServiceData->handle);//java past the deadline may still hold it
+    if (jServiceData->buffer != NULL) {
+        ci_cached_file_destroy(jServiceData->buffer);
+    }
+    if (jServiceData->decoded != NULL) {
+        ci_cached_file_destroy(jServiceData->decoded);
+    }
+    cij_codec_free(jServiceData->decoder);
+    cij_codec_free(jServiceData->encoder);
+    cij_arena_release(jServiceData->arena);
 }
 
 /**